@@ -32,6 +32,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
@@ -63,11 +66,20 @@ public:
         {
             Terminate("Error: More than one instance of AsyncIo.");
         }
-        epoll_fd = epoll_create1(0);
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
         if (epoll_fd < 0)
         {
             Terminate(SS("Error: epoll_create1 failed (" << strerror(errno) << ")"));
         }
+        // wake_fd and timer_fd are only signalled in foreground mode.
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (wake_fd < 0 || timer_fd < 0)
+        {
+            Terminate(SS("Error: Can't create wake handles (" << strerror(errno) << ")"));
+        }
+        AddInternalEvent(wake_fd, &wakeEvent);
+        AddInternalEvent(timer_fd, &timerEvent);
 
         AsyncIo::instance = this;
     }
@@ -76,12 +88,19 @@ public:
         ssource.request_stop();
         thread = nullptr; // delete and join the thread.
         AsyncIo::instance = nullptr;
+        close(timer_fd);
+        close(wake_fd);
+        close(epoll_fd);
     }
 
     virtual void Start()
     {
-        if (!thread)
+        if (!thread && !foregroundMode)
         {
+            if (ssource.stop_requested())
+            {
+                ssource = std::stop_source();
+            }
             thread = std::make_unique<jthread>(
                 [this, stoken=ssource.get_token()]() { ThreadProc(stoken); });
         }
@@ -92,26 +111,110 @@ public:
         thread = nullptr;
     }
 
+    virtual void SetForegroundMode(bool enabled)
+    {
+        if (enabled == foregroundMode)
+        {
+            return;
+        }
+        if (enabled)
+        {
+            foregroundMode = true;
+            Stop(); // (don't hold epollMutex; the thread takes it.)
+        }
+        else
+        {
+            std::unique_lock lock{epollMutex};
+            foregroundMode = false;
+            if (!epollEvents.empty())
+            {
+                Start();
+            }
+        }
+    }
+    virtual bool IsForegroundMode() const
+    {
+        return foregroundMode;
+    }
+
+    virtual void WaitForEvents(CoDispatcher::Duration timeout)
+    {
+        if (timeout != armedTime)
+        {
+            // CLOCK_MONOTONIC has the same epoch as std::chrono::steady_clock (and CoDispatcher::Now())
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+            if (ns <= 0)
+            {
+                ns = 1; // (zero disarms the timer)
+            }
+            struct itimerspec timerSpec;
+            memset(&timerSpec, 0, sizeof(timerSpec));
+            timerSpec.it_value.tv_sec = ns / 1000000000;
+            timerSpec.it_value.tv_nsec = ns % 1000000000;
+            if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timerSpec, nullptr) < 0)
+            {
+                CoIoException::ThrowErrno();
+            }
+            armedTime = timeout;
+        }
+        DispatchEvents(-1);
+    }
+
+    virtual void Wake()
+    {
+        // only write the eventfd if a wake isn't already pending.
+        if (!wakePending.exchange(true))
+        {
+            uint64_t value = 1;
+            ssize_t rc = write(wake_fd, &value, sizeof(value));
+            (void)rc; // (EAGAIN is benign: the eventfd is already signalled.)
+        }
+    }
 
 private:
     std::stop_source ssource;
 
     int epoll_fd = -1;
+    int wake_fd = -1;
+    int timer_fd = -1;
+
+    std::atomic<bool> foregroundMode = false;
+    std::atomic<bool> wakePending = false;
+    CoDispatcher::Duration armedTime = CoDispatcher::Duration::min();
 
     class EpollEvent
     {
     public:
         EpollEvent() { }
-        EpollEvent(EventHandle eventHandle, int fd,EventCallback callback) : handle(eventHandle),fd(fd), callback(callback) {}
+        EpollEvent(EventHandle eventHandle, int fd,EventCallback &&callback) : handle(eventHandle),fd(fd), callback(std::move(callback)) {}
 
         EventHandle handle = -1;
         int fd = -1;
         EventCallback callback = nullptr;
+        std::atomic<bool> retired = false;
     };
     std::mutex epollMutex;
     std::vector<std::unique_ptr<EpollEvent>> epollEvents;
+    // Unwatched events are kept alive until the current batch of epoll events has been dispatched.
+    std::vector<std::unique_ptr<EpollEvent>> retiredEvents;
+
+    EpollEvent wakeEvent;
+    EpollEvent timerEvent;
 
     EventHandle nextHandle = 0;
+    int dispatchDepth = 0; // callbacks may pump messages recursively in foreground mode.
+
+    void AddInternalEvent(int fd, EpollEvent *event)
+    {
+        struct epoll_event epollEvent;
+        memset(&epollEvent,0,sizeof(epollEvent));
+        epollEvent.data.ptr = event;
+        epollEvent.events = EPOLLIN;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &epollEvent) < 0)
+        {
+            Terminate(SS("Error: epoll_ctl failed (" << strerror(errno) << ")"));
+        }
+    }
 
     virtual EventHandle WatchFile(int fileDescriptor, EventCallback callback) 
     {
@@ -119,7 +222,7 @@ private:
         Start();
 
         EventHandle handle = ++nextHandle;
-        std::unique_ptr<EpollEvent> event = std::make_unique<EpollEvent>(handle,fileDescriptor,callback);
+        std::unique_ptr<EpollEvent> event = std::make_unique<EpollEvent>(handle,fileDescriptor,std::move(callback));
 
         struct epoll_event epollEvent;
         memset(&epollEvent,0,sizeof(epollEvent));
@@ -139,53 +242,89 @@ private:
             if ((*i)->handle == handle)
             {
                 std::unique_ptr event = std::move(*i);
-                epollEvents.erase(i); // also destructs the unique_ptr.
+                epollEvents.erase(i);
 
                 epoll_ctl(epoll_fd, EPOLL_CTL_DEL, event->fd, nullptr);
+                event->retired = true;
+                retiredEvents.push_back(std::move(event));
                 return true;
             }
         }
         return false;
     }
 
+    void DispatchEvents(int timeoutMs)
+    {
+        epoll_event events[10];
+
+        int result = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), timeoutMs);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                return;
+            }
+            CoIoException::ThrowErrno();
+        }
+        ++dispatchDepth;
+        for (int i = 0; i < result; ++i)
+        {
+            EpollEvent *ev = (EpollEvent *)events[i].data.ptr;
+            if (ev == &wakeEvent)
+            {
+                wakePending = false;
+                uint64_t value;
+                ssize_t rc = read(wake_fd, &value, sizeof(value));
+                (void)rc;
+                continue;
+            }
+            if (ev == &timerEvent)
+            {
+                armedTime = CoDispatcher::Duration::min();
+                uint64_t expirations;
+                ssize_t rc = read(timer_fd, &expirations, sizeof(expirations));
+                (void)rc;
+                continue;
+            }
+            if (ev->retired)
+            {
+                continue;
+            }
+            auto flags = events[i].events;
+            EventData eventData;
+            //EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP 
+            eventData.readReady = (flags & EPOLLIN) != 0;
+            eventData.writeReady = (flags & EPOLLOUT) != 0;
+            eventData.hasError = (flags & EPOLLERR) != 0;
+            eventData.hup = (flags & EPOLLHUP) != 0;
+            try
+            {
+                ev->callback(eventData);
+            }
+            catch (...)
+            {
+                --dispatchDepth;
+                throw;
+            }
+        }
+        if (--dispatchDepth == 0)
+        {
+            std::unique_lock lock{epollMutex};
+            retiredEvents.clear();
+        }
+    }
+
     void ThreadProc(const std::stop_token& stopToken)
     {
         try
         {
-            epoll_event events[10];
-
             while (true)
             {
                 if (stopToken.stop_requested())
                 {
                     break;
                 }
-                int result = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), 500);
-                if (result < 0)
-                {
-                    if (errno == EINTR)
-                    {
-                        continue;
-                    }
-                    CoIoException::ThrowErrno();
-                }
-                for (int i = 0; i < result; ++i)
-                {
-                    EpollEvent *ev = (EpollEvent *)events[i].data.ptr;
-                    auto flags = events[i].events;
-                    EventData eventData;
-                    //EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP 
-                    eventData.readReady = (flags & EPOLLIN) != 0;
-                    eventData.writeReady = (flags & EPOLLOUT) != 0;
-                    eventData.hasError = (flags & EPOLLERR) != 0;
-                    eventData.hup = (flags & EPOLLHUP) != 0;
-                    ev->callback(eventData);
-                }
-            }
-            if (epoll_fd != -1)
-            {
-                close(epoll_fd);
-                epoll_fd = -1;
+                DispatchEvents(500);
             }
         }
         catch (std::exception &e)
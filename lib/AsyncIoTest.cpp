@@ -28,6 +28,7 @@
 #include <chrono>
 #include "cotask/CoFile.h"
 #include "ss.h"
+#include <unistd.h>
 
 using namespace cotask;
 using namespace std;
@@ -219,9 +220,148 @@ void ReadWriteTest()
 
 ///////////////////////////////////////////////////////////
 
+CoTask<> ReadyReader(CoFile *reader, std::string *pResult)
+{
+    char buffer[64];
+    while (true)
+    {
+        ssize_t nRead = read(reader->GetFileDescriptor(), buffer, sizeof(buffer));
+        if (nRead == 0)
+        {
+            break;
+        }
+        if (nRead < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                CoIoException::ThrowErrno();
+            }
+            co_await reader->Readable();
+            continue;
+        }
+        pResult->append(buffer, nRead);
+    }
+}
+
+CoTask<> ReadyTestProc()
+{
+    std::unique_ptr<CoFile> reader;
+    std::unique_ptr<CoFile> writer;
+    CoFile::CreateSocketPair(&reader, &writer);
+
+    std::string result;
+    CoDispatcher::CurrentDispatcher().StartThread(ReadyReader(reader.get(), &result));
+    for (int i = 0; i < 3; ++i)
+    {
+        co_await writer->Writable();
+        co_await writer->CoWrite(SS("Message " << i << "\n"));
+        co_await CoDelay(100ms);
+    }
+    co_await writer->CoClose();
+    co_await CoDelay(100ms);
+    assert(result == "Message 0\nMessage 1\nMessage 2\n");
+    co_await reader->CoClose();
+}
+
+void ReadyTest()
+{
+    cout << "--- ReadyTest ---" << endl;
+    ReadyTestProc().GetResult();
+    Dispatcher().PumpUntilIdle();
+}
+
+///////////////////////////////////////////////////////////
+
+CoTask<> ReadyCloseReader(std::unique_ptr<CoFile> reader, bool *pClosed)
+{
+    char buffer[64];
+    while (read(reader->GetFileDescriptor(), buffer, sizeof(buffer)) <= 0)
+    {
+        co_await reader->Readable();
+    }
+    // close and destroy the file in the same resume as the wakeup.
+    co_await reader->CoClose();
+    reader = nullptr;
+    *pClosed = true;
+}
+
+CoTask<> ReadyCloseTestProc()
+{
+    std::unique_ptr<CoFile> reader;
+    std::unique_ptr<CoFile> writer;
+    CoFile::CreateSocketPair(&reader, &writer);
+
+    bool closed = false;
+    CoTask<> readerTask = ReadyCloseReader(std::move(reader), &closed);
+    co_await CoDelay(20ms);
+    co_await writer->CoWrite("x");
+    co_await readerTask;
+    assert(closed);
+    co_await writer->CoClose();
+}
+
+void ReadyCloseTest()
+{
+    cout << "--- ReadyCloseTest ---" << endl;
+    ReadyCloseTestProc().GetResult();
+    Dispatcher().PumpUntilIdle();
+}
+
+///////////////////////////////////////////////////////////
+
+CoTask<> LinesTestProc()
+{
+    std::unique_ptr<CoFile> reader;
+    std::unique_ptr<CoFile> writer;
+    CoFile::CreateSocketPair(&reader, &writer);
+
+    co_await writer->CoWrite("first\nsec");
+    std::string line;
+    bool result = co_await reader->CoReadLine(&line); // (Lines() shares CoReadLine()'s buffer.)
+    assert(result && line == "first");
+    (void)result;
+
+    CoDispatcher::CurrentDispatcher().StartThread(
+        [](CoFile *writer) -> CoTask<> {
+            co_await CoDelay(20ms);
+            co_await writer->CoWrite("ond\n\nthi");
+            co_await CoDelay(20ms);
+            co_await writer->CoWrite("rd");
+            co_await writer->CoClose();
+        }(writer.get()));
+
+    std::vector<std::string> lines;
+    auto generator = reader->Lines();
+    for (auto i = co_await generator.begin(); i != generator.end(); co_await ++i)
+    {
+        lines.push_back(std::move(*i));
+    }
+    assert((lines == std::vector<std::string>{"second", "", "third"}));
+    co_await reader->CoClose();
+}
+
+void LinesTest()
+{
+    cout << "--- LinesTest ---" << endl;
+    LinesTestProc().GetResult();
+    Dispatcher().PumpUntilIdle();
+}
+
+///////////////////////////////////////////////////////////
+
 int main(int argc, char **argv)
 {
     ReadWriteTest();
+    ReadyTest();
+    ReadyCloseTest();
+    LinesTest();
+
+    cout << "--- Foreground I/O ---" << endl;
+    Dispatcher().SetForegroundIo(true);
+    ReadWriteTest();
+    ReadyTest();
+    ReadyCloseTest();
+    Dispatcher().SetForegroundIo(false);
 
     Dispatcher().DestroyDispatcher();
     return 0;
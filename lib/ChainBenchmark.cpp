@@ -0,0 +1,133 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Chained await benchmark: background coroutines repeatedly co_await a CoService that completes 
+// immediately on the calling pool thread, touching a private working set between awaits. 
+// Measures the time from completion to resumption of the awaiting coroutine, and the cost of 
+// each step (which includes cache misses if the continuation migrates to another thread).
+//
+// Not run as part of the test suite. Usage: chainBenchmark [threads]
+
+#include "cotask/CoTask.h"
+#include "cotask/CoService.h"
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <vector>
+#include <thread>
+
+using namespace cotask;
+using namespace std;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t STEPS = 20000;
+static constexpr size_t WORKING_SET = 64 * 1024;
+
+static std::atomic<int64_t> totalResumeLatencyNs;
+static std::atomic<uint64_t> sink;
+
+// Completes immediately, on the calling thread, returning the completion time.
+static auto CoPing()
+{
+    struct Implementation
+    {
+        using return_type = Clock::time_point;
+
+        void Execute(CoServiceCallback<return_type> *pCallback)
+        {
+            pCallback->SetResult(Clock::now());
+        }
+        bool CancelExecute(CoServiceCallback<return_type> *pCallback)
+        {
+            return true;
+        }
+    };
+    using Awaitable = CoService<Implementation>;
+    return Awaitable{};
+}
+
+static CoTask<> ChainProc(size_t seed)
+{
+    co_await CoBackground();
+    std::vector<uint8_t> workingSet(WORKING_SET, (uint8_t)seed);
+    uint64_t sum = 0;
+    int64_t latencyNs = 0;
+    for (size_t step = 0; step < STEPS; ++step)
+    {
+        for (size_t i = 0; i < workingSet.size(); i += 64)
+        {
+            sum += workingSet[i]++;
+        }
+        Clock::time_point completedAt = co_await CoPing();
+        latencyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - completedAt).count();
+    }
+    sink += sum;
+    totalResumeLatencyNs += latencyNs;
+}
+
+static void ChainBenchmark(size_t chains)
+{
+    CoDispatcher &dispatcher = CoDispatcher::CurrentDispatcher();
+    totalResumeLatencyNs = 0;
+
+    std::vector<CoTask<>> tasks;
+    tasks.reserve(chains);
+    auto start = Clock::now();
+    for (size_t i = 0; i < chains; ++i)
+    {
+        tasks.push_back(ChainProc(i));
+    }
+    dispatcher.PumpUntilIdle();
+    auto elapsed = Clock::now() - start;
+
+    double steps = (double)(chains * STEPS);
+    cout << setw(10) << chains
+         << setw(14) << fixed << setprecision(1) << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(elapsed).count()
+         << setw(16) << setprecision(0) << std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(elapsed).count() / steps
+         << setw(18) << totalResumeLatencyNs / steps
+         << endl;
+}
+
+int main(int argc, char **argv)
+{
+    size_t threads = std::thread::hardware_concurrency();
+    if (argc > 1)
+    {
+        threads = (size_t)std::stoul(argv[1]);
+    }
+    if (threads < 2)
+    {
+        threads = 2;
+    }
+    CoDispatcher::CurrentDispatcher().SetThreadPoolSize(threads);
+    cout << "pool threads: " << threads << endl;
+    cout << "    chains      time(ms)    ns/step   resume latency(ns)" << endl;
+    for (size_t chains : {1, 2, 4, 16, 64})
+    {
+        ChainBenchmark(chains);
+    }
+    CoDispatcher::DestroyDispatcher();
+    return 0;
+}
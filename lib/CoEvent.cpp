@@ -27,170 +27,217 @@
 
 using namespace cotask;
 
-namespace cotask
-{
-#ifndef DOXYGEN
-    namespace detail
+using Implementation = detail::CoConditionaVariableImplementation::Implementation;
+
+Implementation::~Implementation()
+{ // debug hook to verify that we get deleted on close.
+    if (!closed && this_ != nullptr)
     {
-        // friend of CoConditionaVariable
-        class CoConditionaVariableImplementation
         {
-        public:
-            static auto Wait_(
-                CoConditionVariable *this_,
-                std::function<bool(void)> condition,
-                std::chrono::milliseconds timeout = NO_TIMEOUT)
+            std::lock_guard lock {this_->mutex};
+            bool result = this_->RemoveAwaiter(this);
+            if (result)
             {
-                struct Implementation : CoConditionVariable::Awaiter
-                {
-                    ~Implementation()
-                    { // debug hook to verify that we get deleted on close.
-                        if (!closed && this_ != nullptr)
-                        {
-                            {
-                                std::lock_guard lock {this_->mutex};
-                                bool result = this_->RemoveAwaiter(this);
-                                if (result)
-                                {
-                                    Dispatcher().Log().Warning("Orphaned awaiter.");
-                                }
-                            }
-                        }
-                        this_ = nullptr;
-                    }
+                Dispatcher().Log().Warning("Orphaned awaiter.");
+            }
+        }
+    }
+    this_ = nullptr;
+}
 
-                    using return_type = void;
+void Implementation::Execute(CoServiceCallback<void> *pCallback)
+{
+    if (!this_)
+        return;
+    if (this_->deleted)
+    {
+        Terminate("Use after free.");
+    }
 
-                    void Execute(CoServiceCallback<void> *pCallback)
-                    {
+    // Register before taking the mutex. If the token has already been cancelled, the callback 
+    // runs immediately (taking the mutex), and sets cancelRequested.
+    if (cancellationToken.CanBeCancelled())
+    {
+        cancellationCallback.emplace(cancellationToken, CancellationCallback{this});
+    }
 
-                        {
-                            if (!this_)
-                                return;
-                            if (this_->deleted)
-                            {
-                                Terminate("Use after free.");
-                            }
+    std::unique_lock lock{this_->mutex};
 
-                            std::unique_lock lock{this_->mutex};
-                            this->pCallback = pCallback;
+    // Test before linking, so that waits that don't suspend never touch the awaiter list.
+    bool signaled = this->signaled;
+    if (!signaled)
+    {
+        if (this_->ready)
+        {
+            signaled = true;
+            this_->ready = false;
+        }
+        if (this->conditionTest != nullptr)
+        {
+            try
+            {
+                signaled = this->TestCondition();
+            }
+            catch (const std::exception &e)
+            {
+                this_ = nullptr;
+                lock.unlock();
+                ReleaseCancellation();
+                pCallback->SetException(std::current_exception());
+                return;
+            }
+        }
+    }
+    if (signaled)
+    {
+        this_ = nullptr;
+        lock.unlock();
+        ReleaseCancellation();
 
-                            if (this_)
-                            {
-                                this_->AddAwaiter(this);
-                            }
+        pCallback->SetComplete();
+        return;
+    }
+    if (cancelRequested)
+    {
+        this_ = nullptr;
+        lock.unlock();
+        ReleaseCancellation();
 
-                            bool signaled = this->signaled;
-                            if (!signaled)
-                            {
-                                if (this_->ready)
-                                {
-                                    signaled = true;
-                                    this_->ready = false;
-                                }
-                                if (this->conditionTest != nullptr)
-                                {
-                                    try
-                                    {
-                                        signaled = this->conditionTest();
-                                    }
-                                    catch (const std::exception &e)
-                                    {
-                                        if (this_)
-                                        {
-                                            this_->RemoveAwaiter(this);
-                                            this_ = nullptr;
-                                        }
-                                        auto t = pCallback;
-                                        pCallback = nullptr;
-                                        lock.unlock();
-                                        t->SetException(std::current_exception());
-                                        return;
-                                    }
-                                }
-                            }
-                            if (signaled)
-                            {
-                                if (this_)
-                                {
-                                    this_->RemoveAwaiter(this);
-                                    this_ = nullptr;
-                                }
-                                auto t = pCallback;
-                                pCallback = nullptr;
-                                lock.unlock();
+        status = CoStatus::Cancelled;
+        pCallback->SetComplete();
+        return;
+    }
+    this->pCallback = pCallback;
+    this_->AddAwaiter(this);
+    if (this->timeout != NO_TIMEOUT)
+    {
+        pCallback->RequestTimeout(this->timeout);
+    }
+}
 
-                                t->SetComplete();
-                                return;
-                            }
-                            if (this->timeout != NO_TIMEOUT)
-                            {
-                                pCallback->RequestTimeout(this->timeout);
-                            }
-                        }
-                    }
+bool Implementation::CancelExecute(CoServiceCallback<void> *pCallback)
+{
+    // Returns false if the awaiter has already been unlinked (notified, cancelled or closed), in 
+    // which case its completion is in flight.
+    if (closed)
+    {
+        return false; // (and the condition variable has been deleted.)
+    }
+    bool result;
+    {
+        std::lock_guard guard{owner->mutex};
+        result = owner->RemoveAwaiter(this);
+    }
+    if (result)
+    {
+        ReleaseCancellation();
+    }
+    return result;
+}
 
-                    bool CancelExecute(CoServiceCallback<void> *pCallback)
-                    {
-                        if (closed)
-                            return true;
-                        if (this_)
-                        {
-                            std::lock_guard guard {this_->mutex};
-                            bool result = this_->RemoveAwaiter(this);
-                            this_ = nullptr;
-                            return result;
-                        } else {
-                            return true;
-                        }
-                    }
-                };
-                CoService<Implementation> awaiter;
-                awaiter.this_ = this_;
-                awaiter.conditionTest = condition;
-                awaiter.timeout = timeout;
-                
-                return awaiter;
-            }
-        };
-#endif
+void CoConditionVariable::Awaiter::OnCancelled() noexcept
+{
+    std::unique_lock lock{owner->mutex};
+    cancelRequested = true;
+    if (this->prev == nullptr && owner->awaitersHead != this)
+    {
+        return; // not linked: not yet waiting (Execute() will complete it), or already completed.
     }
+    owner->UnlinkAwaiter(this);
+    lock.unlock();
+
+    inCancellationCallback = true;
+    status = CoStatus::Cancelled;
+    SetComplete();
 }
 
 void CoConditionVariable::AddAwaiter(Awaiter *awaiter)
 {
-    awaiters.push_back(awaiter);
+    awaiter->prev = awaitersTail;
+    awaiter->next = nullptr;
+    if (awaitersTail)
+    {
+        awaitersTail->next = awaiter;
+    }
+    else
+    {
+        awaitersHead = awaiter;
+    }
+    awaitersTail = awaiter;
+}
+
+void CoConditionVariable::UnlinkAwaiter(Awaiter *awaiter)
+{
+    if (awaiter->prev)
+    {
+        awaiter->prev->next = awaiter->next;
+    }
+    else
+    {
+        awaitersHead = awaiter->next;
+    }
+    if (awaiter->next)
+    {
+        awaiter->next->prev = awaiter->prev;
+    }
+    else
+    {
+        awaitersTail = awaiter->prev;
+    }
+    awaiter->prev = nullptr;
+    awaiter->next = nullptr;
+    awaiter->this_ = nullptr;
 }
+
 bool CoConditionVariable::RemoveAwaiter(Awaiter *awaiter)
 {
     CheckUseAfterFree();
 
-    for (auto i = awaiters.begin(); i != awaiters.end(); ++i)
+    if (awaiter->prev == nullptr && awaitersHead != awaiter)
     {
-        if ((*i) == awaiter)
-        {
-            awaiters.erase(i);
-            awaiter->this_ = nullptr;
-            return true;
-        }
+        return false; // not linked.
     }
-    return false;
+    UnlinkAwaiter(awaiter);
+    return true;
 }
 
 CoTask<> CoConditionVariable::Wait(
-    std::chrono::milliseconds timeout,
-    std::function<bool(void)> condition)
+    CoDispatcher::Duration timeout,
+    ConditionTest condition,
+    CoCancellationToken cancellationToken)
 {
     CheckUseAfterFree();
-    try {
-        co_await detail::CoConditionaVariableImplementation::Wait_(this, condition, timeout);
-    } catch (const std::exception &e)
+    detail::CoConditionaVariableImplementation::WaitService awaiter;
+    awaiter.this_ = this;
+    awaiter.owner = this;
+    awaiter.cancellationToken = std::move(cancellationToken);
+    if (condition)
     {
-        throw;
+        awaiter.SetConditionTest(&condition);
     }
+    awaiter.timeout = timeout;
+    ThrowIfFailed(co_await detail::CoConditionaVariableImplementation::TryAwaiter{awaiter});
     co_return;
 }
 
+CoTask<CoStatus> CoConditionVariable::TryWait(
+    CoDispatcher::Duration timeout,
+    ConditionTest condition,
+    CoCancellationToken cancellationToken)
+{
+    CheckUseAfterFree();
+    detail::CoConditionaVariableImplementation::WaitService awaiter;
+    awaiter.this_ = this;
+    awaiter.owner = this;
+    awaiter.cancellationToken = std::move(cancellationToken);
+    if (condition)
+    {
+        awaiter.SetConditionTest(&condition);
+    }
+    awaiter.timeout = timeout;
+    co_return co_await detail::CoConditionaVariableImplementation::TryAwaiter{awaiter};
+}
+
 void CoConditionVariable::CheckUseAfterFree()
 {
     // incomplete guard against use after free. But it catches lots.
@@ -199,88 +246,80 @@ void CoConditionVariable::CheckUseAfterFree()
         Terminate("Use after free.");
     }
 }
-void CoConditionVariable::NotifyAll(function<void(void)> notifyAction)
+void CoConditionVariable::NotifyAll(std::unique_lock<std::mutex> &lock)
 {
-    CheckUseAfterFree();
-    // manage the queue under the mutex.
-    std::vector<Awaiter *> readyAwaiters;
+    // manage the queue under the mutex, chaining ready awaiters through their (now unused) next links.
+    Awaiter *readyHead = nullptr;
+    Awaiter **readyTail = &readyHead;
+    for (Awaiter *awaiter = awaitersHead; awaiter != nullptr; /**/)
     {
-        std::unique_lock lock{mutex};
-        if (notifyAction)
-        {
-            notifyAction();
-        }
-
-        for (auto i = awaiters.begin(); i != awaiters.end(); /**/)
+        Awaiter *next = awaiter->next;
+        bool ready = true;
+        if (awaiter->conditionTest)
         {
-            bool ready = true;
-            auto awaiter = *i;
-            if (awaiter->conditionTest)
+            try
             {
-                try
-                {
-                    ready = awaiter->conditionTest();
-                }
-                catch (const std::exception &e)
-                {
-                    awaiter->UnhandledException();
-                    ready = true;
-                }
+                ready = awaiter->TestCondition();
             }
-            if (ready)
+            catch (const std::exception &e)
             {
-                if (awaiter->pCallback != nullptr)
-                {
-                    readyAwaiters.push_back(awaiter);
-                } else {
-                    awaiter->signaled = true;
-                }
-                i = awaiters.erase(i);
-                awaiter->this_ = nullptr;
+                awaiter->UnhandledException();
+                ready = true;
             }
-            else
+        }
+        if (ready)
+        {
+            UnlinkAwaiter(awaiter);
+            if (awaiter->pCallback != nullptr)
             {
-                ++i;
+                *readyTail = awaiter;
+                readyTail = &awaiter->next;
+            } else {
+                awaiter->signaled = true;
             }
         }
+        awaiter = next;
     }
+    lock.unlock();
     // do the callbacks without the mutex.
-    for (auto i = readyAwaiters.begin(); i != readyAwaiters.end(); ++i)
+    while (readyHead != nullptr)
     {
-        Awaiter *pAwaiter = (*i);
+        Awaiter *pAwaiter = readyHead;
+        readyHead = pAwaiter->next; // (the awaiter may be deleted by SetComplete.)
+        pAwaiter->next = nullptr;
         pAwaiter->SetComplete();
     }
 }
 
-void CoConditionVariable::Notify(std::function<void(void)> action)
+void CoConditionVariable::Notify()
 {
     CheckUseAfterFree();
 
     std::unique_lock lock{mutex};
+    NotifyOne(lock);
+}
 
-    if (action)
-    {
-        action();
-    }
-    if (awaiters.size() != 0)
+void CoConditionVariable::NotifyOne(std::unique_lock<std::mutex> &lock)
+{
+    Awaiter *awaiter = awaitersHead;
+    if (awaiter != nullptr)
     {
-        Awaiter *awaiter = *(awaiters.begin());
         bool ready = true;
         if (awaiter->conditionTest)
         {
             try
             {
-                ready = awaiter->conditionTest();
+                ready = awaiter->TestCondition();
             }
             catch (const std::exception &e)
             {
-                awaiters.erase(awaiters.begin());
-                awaiter->this_ = nullptr;
+                UnlinkAwaiter(awaiter);
                 if (awaiter->pCallback != nullptr)
                 {
                     auto t = awaiter->pCallback;
                     lock.unlock();
                     awaiter->pCallback = nullptr;
+                    awaiter->ReleaseCancellation();
                     t->SetException(std::current_exception());
                     return;
                 } else {
@@ -290,13 +329,13 @@ void CoConditionVariable::Notify(std::function<void(void)> action)
         }
         if (ready)
         {
-            awaiters.erase(awaiters.begin());
-            awaiter->this_ = nullptr;
+            UnlinkAwaiter(awaiter);
             if (awaiter->pCallback != nullptr)
             {
                 auto t = awaiter->pCallback;
                 awaiter->pCallback = nullptr;
                 lock.unlock();
+                awaiter->ReleaseCancellation();
                 t->SetComplete();
                 return;
             }
@@ -336,46 +375,37 @@ CoConditionVariable::~CoConditionVariable()
 {
 
     // manage the queue under the mutex.
-    std::vector<CoServiceCallback<void>*> callbacks;
+    Awaiter *closedHead = nullptr;
+    Awaiter **closedTail = &closedHead;
     {
         std::unique_lock lock{mutex};
         this->deleted = 0xBaadF00d; // no more access to this object.
 
-        for (auto i = awaiters.begin(); i != awaiters.end(); i++)
+        for (Awaiter *awaiter = awaitersHead; awaiter != nullptr; /**/)
         {
-            auto awaiter = *i;
+            Awaiter *next = awaiter->next;
+            awaiter->prev = nullptr;
+            awaiter->next = nullptr;
             awaiter->this_ = nullptr;
             awaiter->closed = true;
             if (awaiter->pCallback != nullptr)
             {
-                try {
-                    throw CoIoClosedException();
-                } catch (const std::exception &)
-                {
-                    awaiter->UnhandledException();
-                }
-                if (awaiter->pCallback != nullptr)
-                {
-                    callbacks.push_back(awaiter->pCallback);
-                    awaiter->pCallback = nullptr;
-                }
+                awaiter->status = CoStatus::Closed;
+                *closedTail = awaiter;
+                closedTail = &awaiter->next;
             } else {
                 awaiter->signaled = true;
             }
+            awaiter = next;
         }
-        awaiters.resize(0); // callback is now irrevocably pending.
+        awaitersHead = awaitersTail = nullptr; // callbacks are now irrevocably pending.
     }
     // do the callbacks without the mutex.
-    for (auto i = callbacks.begin(); i != callbacks.end(); ++i)
+    while (closedHead != nullptr)
     {
-        CoServiceCallback<void> *pCallback = (*i);
-        std::exception_ptr ptr;
-        try {
-            throw CoIoClosedException();
-        } catch (const std::exception &)
-        {
-            ptr = std::current_exception();
-        }
-        pCallback->SetException(ptr);
+        Awaiter *pAwaiter = closedHead;
+        closedHead = pAwaiter->next;
+        pAwaiter->next = nullptr;
+        pAwaiter->SetComplete(); // (Wait() throws CoIoClosedException; TryWait() returns CoStatus::Closed.)
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,97 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Synchronous-completion benchmark: uncontended CoMutex::CoLock() / Unlock(), and waits on a 
+// CoConditionVariable that has already been notified. Neither needs to suspend, so the cost
+// measured is the overhead of the await itself.
+//
+// Not run as part of the test suite. Usage: coEventBenchmark
+
+#include "cotask/CoTask.h"
+#include "cotask/CoEvent.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+using namespace cotask;
+using namespace std;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int ITERATIONS = 200000;
+
+static double nsPerOperation;
+
+static CoTask<> MutexProc(bool background)
+{
+    if (background)
+    {
+        co_await CoBackground();
+    }
+    CoMutex mutex;
+    auto start = Clock::now();
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        co_await mutex.CoLock();
+        mutex.Unlock();
+    }
+    nsPerOperation = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(Clock::now() - start).count() / ITERATIONS;
+    co_await CoForeground();
+}
+
+static CoTask<> SignaledWaitProc(bool background)
+{
+    if (background)
+    {
+        co_await CoBackground();
+    }
+    CoConditionVariable cv;
+    auto start = Clock::now();
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        cv.Notify();
+        co_await cv.Wait();
+    }
+    nsPerOperation = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(Clock::now() - start).count() / ITERATIONS;
+    co_await CoForeground();
+}
+
+static void Run(const std::string &name, CoTask<> (*proc)(bool))
+{
+    for (bool background : {false, true})
+    {
+        proc(background).GetResult();
+        cout << setw(24) << left << name << setw(12) << (background ? "background" : "foreground")
+             << right << setw(10) << fixed << setprecision(0) << nsPerOperation << endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    cout << "operation               thread         ns/op" << endl;
+    Run("CoLock/Unlock", MutexProc);
+    Run("Notify/Wait (signaled)", SignaledWaitProc);
+    CoDispatcher::DestroyDispatcher();
+    return 0;
+}
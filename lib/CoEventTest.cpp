@@ -25,6 +25,11 @@
 #include "cotask/CoEvent.h"
 #include "cotask/CoExceptions.h"
 #include "cotask/CoBlockingQueue.h"
+#include "cotask/CoChannel.h"
+#include "cotask/CoCancellation.h"
+#include "cotask/CoFile.h"
+#include <thread>
+#include <atomic>
 #include "cotask/Os.h"
 #include <cassert>
 
@@ -296,6 +301,157 @@ void BlockingQueueTest()
     test.Run();
 }
 
+//////////// Channel test //////////////
+
+template <ChannelKind KIND>
+class CChannelTest
+{
+public:
+    using channel_type = CoChannel<std::unique_ptr<int>, KIND>;
+
+    CoTask<> Writer(bool foreground, channel_type &channel, int numberOfWrites, int writeBatchSize)
+    {
+        if (foreground)
+        {
+            co_await CoForeground();
+        }
+        else
+        {
+            co_await CoBackground();
+        }
+
+        std::vector<std::unique_ptr<int>> batch;
+        int i = 0;
+        while (i < numberOfWrites)
+        {
+            if ((i / writeBatchSize) % 2 == 0)
+            {
+                co_await channel.Push(std::make_unique<int>(i++));
+            }
+            else
+            {
+                batch.clear();
+                while (batch.size() < (size_t)writeBatchSize && i < numberOfWrites)
+                {
+                    batch.push_back(std::make_unique<int>(i++));
+                }
+                std::span<std::unique_ptr<int>> remaining{batch};
+                while (!remaining.empty())
+                {
+                    size_t pushed = co_await channel.PushMany(remaining);
+                    assert(pushed > 0);
+                    remaining = remaining.subspan(pushed);
+                }
+            }
+            if (i % (writeBatchSize * 3) == 0)
+            {
+                co_await CoDelay(11ms);
+            }
+        }
+        channel.Close();
+    }
+    CoTask<> Reader(channel_type &channel, int numberOfWrites, int readerBatchSize)
+    {
+        int numberOfReads = 0;
+        std::vector<std::unique_ptr<int>> batch(readerBatchSize);
+        try
+        {
+            while (true)
+            {
+                if (numberOfReads % 2 == 0)
+                {
+                    std::unique_ptr<int> value = co_await channel.Take();
+                    assert(*value == numberOfReads);
+                    ++numberOfReads;
+                }
+                else
+                {
+                    size_t n = co_await channel.TakeMany(batch);
+                    assert(n > 0 && n <= batch.size());
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        assert(*batch[i] == numberOfReads);
+                        ++numberOfReads;
+                    }
+                }
+                if (numberOfReads % 17 == 0)
+                {
+                    co_await CoDelay(7ms);
+                }
+            }
+        }
+        catch (const CoIoClosedException &e)
+        {
+            cout << "        Got channel closed exception." << endl;
+        }
+        assert(numberOfReads == numberOfWrites);
+        co_return;
+    }
+
+    CoTask<> TestChannel(bool foreground, int numberOfWrites, size_t capacity, int readerBatchSize, int writeBatchSize)
+    {
+        if (foreground)
+        {
+            co_await CoForeground();
+        }
+        else
+        {
+            co_await CoBackground();
+        }
+
+        channel_type channel{capacity};
+        assert(channel.Capacity() >= capacity);
+
+        // timeouts leave the channel usable.
+        bool timedOut = false;
+        try
+        {
+            co_await channel.Take(10ms);
+        }
+        catch (const CoTimedOutException &)
+        {
+            timedOut = true;
+        }
+        assert(timedOut);
+        (void)timedOut;
+
+        Dispatcher().StartThread(Writer(!foreground, channel, numberOfWrites, writeBatchSize));
+
+        co_await Reader(channel, numberOfWrites, readerBatchSize);
+        assert(channel.IsEmpty());
+
+        bool closed = false;
+        try
+        {
+            co_await channel.Push(std::make_unique<int>(0));
+        }
+        catch (const CoIoClosedException &)
+        {
+            closed = true;
+        }
+        assert(closed);
+        (void)closed;
+    }
+
+    void Run()
+    {
+        cout << "--- ChannelTest (" << (KIND == ChannelKind::Spsc ? "Spsc" : "Mpmc") << ")" << endl;
+        cout << "    Foreground" << endl;
+        CoTask<> task = TestChannel(true, 1000, 8, 7, 5);
+        task.GetResult();
+        cout << "    Background" << endl;
+        task = TestChannel(false, 999, 4, 11, 9);
+        task.GetResult();
+        cout << "    Done" << endl;
+    }
+};
+
+void ChannelTest()
+{
+    CChannelTest<ChannelKind::Mpmc>().Run();
+    CChannelTest<ChannelKind::Spsc>().Run();
+}
+
 ///////////  ConditionVariableTimeoutTest  ////
 
 // GCC 10.2 gives spurious warnings in coroutines.
@@ -405,6 +561,334 @@ void ConditionVariableDestructorTest()
     test.Run();
 }
 
+///////////  ConditionVariableWaiterListTest  ////
+
+// Waiters that time out are unlinked from the middle of the awaiter list; the 
+// remaining waiters must still be resumed, in order, by NotifyAll().
+class CConditionVariableWaiterListTest
+{
+    static constexpr int WAITERS = 7;
+
+    CoConditionVariable cv;
+    bool released = false;
+    std::vector<int> resumed;
+    int timedOut = 0;
+
+    CoTask<> Waiter(int id)
+    {
+        try
+        {
+            co_await cv.Wait(
+                (id % 2 == 1) ? CoDispatcher::Duration(50ms) : NO_TIMEOUT,
+                [this]() { return released; });
+            resumed.push_back(id);
+        }
+        catch (const CoTimedOutException &)
+        {
+            ++timedOut;
+        }
+    }
+
+public:
+    CoTask<> Test()
+    {
+        for (int i = 0; i < WAITERS; ++i)
+        {
+            Dispatcher().StartThread(Waiter(i));
+        }
+        co_await CoDelay(250ms);
+        assert(timedOut == WAITERS / 2);
+        assert(resumed.size() == 0);
+
+        cv.NotifyAll([this]() { released = true; });
+        co_await CoDelay(50ms);
+
+        assert(timedOut == WAITERS / 2);
+        assert((resumed == std::vector<int>{0, 2, 4, 6}));
+
+        // the list must be empty (and still usable).
+        released = false;
+        resumed.clear();
+        Dispatcher().StartThread(Waiter(0));
+        co_await CoDelay(10ms);
+        cv.NotifyAll([this]() { released = true; });
+        co_await CoDelay(10ms);
+        assert((resumed == std::vector<int>{0}));
+
+        Dispatcher().PostQuit();
+    }
+    void Run()
+    {
+        cout << "--- ConditionVariableWaiterListTest --- " << endl;
+        Dispatcher().MessageLoop(Test());
+    }
+};
+
+void ConditionVariableWaiterListTest()
+{
+    CConditionVariableWaiterListTest test;
+    test.Run();
+}
+
+///////////  CancellationTest  ////
+
+class CCancellationTest
+{
+public:
+    static CoTask<int> WaitForReady(CoConditionVariable &cv, bool &ready, CoDispatcher::Duration timeout, CoCancellationToken cancellationToken)
+    {
+        try
+        {
+            co_await cv.Wait(
+                timeout,
+                [&ready]() {
+                    return ready;
+                },
+                cancellationToken);
+            co_return 1;
+        }
+        catch (const CoCancelledException &)
+        {
+            co_return 2;
+        }
+        catch (const CoTimedOutException &)
+        {
+            co_return 3;
+        }
+    }
+
+    CoTask<> Test()
+    {
+        CoConditionVariable cv;
+        bool ready = false;
+
+        cout << "    wait" << endl;
+        {
+            CoCancellationSource source;
+            source.CancelAfter(20ms);
+            int result = co_await WaitForReady(cv, ready, NO_TIMEOUT, source.Token());
+            assert(result == 2);
+            (void)result;
+        }
+        {
+            // a satisfied condition isn't interrupted by a cancelled token.
+            CoCancellationSource source;
+            source.Cancel();
+            ready = true;
+            int result = co_await WaitForReady(cv, ready, NO_TIMEOUT, source.Token());
+            assert(result == 1);
+            ready = false;
+            result = co_await WaitForReady(cv, ready, NO_TIMEOUT, source.Token());
+            assert(result == 2);
+        }
+
+        cout << "    linked" << endl;
+        {
+            CoCancellationSource parent;
+            CoCancellationSource other;
+            CoCancellationSource child{parent.Token(), other.Token()};
+            assert(!child.IsCancelled());
+            parent.Cancel();
+            assert(child.IsCancelled() && child.Token().IsCancelled());
+            assert(!other.IsCancelled());
+            assert(!CoCancellationToken().CanBeCancelled());
+        }
+
+        cout << "    delay" << endl;
+        {
+            CoCancellationSource source;
+            auto start = CoDispatcher::Now();
+            co_await CoDelay(10ms, source.Token());
+            source.CancelAfter(20ms);
+            bool caught = false;
+            try
+            {
+                co_await CoDelay(10s, source.Token());
+            }
+            catch (const CoCancelledException &)
+            {
+                caught = true;
+            }
+            assert(caught);
+            assert(CoDispatcher::Now() - start < 1s);
+        }
+
+        cout << "    file" << endl;
+        {
+            CoFile input, output;
+            CoFile::CreateSocketPair(input, output);
+            char buffer[16];
+            CoCancellationSource source;
+            source.CancelAfter(20ms);
+            bool caught = false;
+            try
+            {
+                co_await output.CoRead(buffer, sizeof(buffer), NO_TIMEOUT, source.Token());
+            }
+            catch (const CoCancelledException &)
+            {
+                caught = true;
+            }
+            assert(caught);
+            // the file is still usable.
+            co_await input.CoWrite("abc", 3);
+            size_t nRead = co_await output.CoRead(buffer, sizeof(buffer));
+            assert(nRead == 3);
+            (void)nRead;
+        }
+
+        cout << "    races" << endl;
+        {
+            // cancellation (on another thread), notifies and timeouts race. Each wait must complete exactly once.
+            int outcomes[4] = {0, 0, 0, 0};
+            for (int i = 0; i < 600; ++i)
+            {
+                CoCancellationSource source;
+                ready = false;
+                CoTask<int> waiter = WaitForReady(cv, ready, (i % 5 == 0) ? 1ms : NO_TIMEOUT, source.Token());
+                std::atomic<bool> go = false;
+                std::thread canceller([&source, &go]() {
+                    while (!go)
+                    {
+                        std::this_thread::yield();
+                    }
+                    source.Cancel();
+                });
+                switch (i % 3)
+                {
+                case 0: // cancel first.
+                    go = true;
+                    canceller.join();
+                    cv.Notify([&ready]() { ready = true; });
+                    break;
+                case 1: // notify first.
+                    cv.Notify([&ready]() { ready = true; });
+                    go = true;
+                    canceller.join();
+                    break;
+                default: // concurrently.
+                    go = true;
+                    cv.Notify([&ready]() { ready = true; });
+                    canceller.join();
+                    break;
+                }
+                int result = co_await waiter;
+                ++outcomes[result];
+            }
+            cout << "        notified: " << outcomes[1] << " cancelled: " << outcomes[2] << " timed out: " << outcomes[3] << endl;
+            assert(outcomes[1] + outcomes[2] + outcomes[3] == 600);
+            assert(outcomes[1] != 0 && outcomes[2] != 0);
+        }
+        Dispatcher().PostQuit();
+    }
+    void Run()
+    {
+        cout << "--- CancellationTest --- " << endl;
+        Dispatcher().MessageLoop(Test());
+        Dispatcher().PumpUntilIdle();
+    }
+};
+
+void CancellationTest()
+{
+    CCancellationTest test;
+    test.Run();
+}
+
+///////////  TryWaitTest  ////
+
+// The Try... variants report timeouts, cancellation and closing as a CoStatus.
+class CTryWaitTest
+{
+    CoStatus closedStatus = CoStatus::Ok;
+    CoResult<size_t> closedRead;
+
+    CoTask<> WaitForClose(CoConditionVariable &cv)
+    {
+        closedStatus = co_await cv.TryWait(NO_TIMEOUT, []() { return false; });
+    }
+    CoTask<> ReadUntilClosed(CoFile &file)
+    {
+        char buffer[16];
+        closedRead = co_await file.TryRead(buffer, sizeof(buffer));
+    }
+
+public:
+    CoTask<> Test()
+    {
+        CoConditionVariable cv;
+        bool ready = false;
+
+        cout << "    wait" << endl;
+        {
+            CoStatus status = co_await cv.TryWait(10ms, [&ready]() { return ready; });
+            assert(status == CoStatus::TimedOut);
+
+            CoCancellationSource source;
+            source.CancelAfter(10ms);
+            status = co_await cv.TryWait(NO_TIMEOUT, [&ready]() { return ready; }, source.Token());
+            assert(status == CoStatus::Cancelled);
+
+            ready = true;
+            status = co_await cv.TryWait(10ms, [&ready]() { return ready; }, source.Token());
+            assert(status == CoStatus::Ok);
+            (void)status;
+        }
+        {
+            CoConditionVariable *pCv = new CoConditionVariable();
+            Dispatcher().StartThread(WaitForClose(*pCv));
+            co_await CoDelay(10ms);
+            delete pCv;
+            co_await CoDelay(10ms);
+            assert(closedStatus == CoStatus::Closed);
+        }
+
+        cout << "    read" << endl;
+        {
+            CoFile input, output;
+            CoFile::CreateSocketPair(input, output);
+            char buffer[16];
+            CoResult<size_t> result = co_await output.TryRead(buffer, sizeof(buffer), 10ms);
+            assert(result.status == CoStatus::TimedOut);
+
+            co_await input.CoWrite("abc", 3);
+            result = co_await output.TryRead(buffer, sizeof(buffer), 10ms);
+            assert(result && result.value == 3);
+
+            Dispatcher().StartThread(ReadUntilClosed(output));
+            co_await CoDelay(10ms);
+            output.Close();
+            co_await CoDelay(10ms);
+            assert(closedRead.status == CoStatus::Closed);
+            (void)result;
+        }
+
+        cout << "    delay" << endl;
+        {
+            CoCancellationSource source;
+            CoStatus status = co_await TryDelay(1ms, source.Token());
+            assert(status == CoStatus::Ok);
+            source.CancelAfter(10ms);
+            status = co_await TryDelay(10s, source.Token());
+            assert(status == CoStatus::Cancelled);
+            (void)status;
+        }
+        Dispatcher().PostQuit();
+    }
+    void Run()
+    {
+        cout << "--- TryWaitTest --- " << endl;
+        Dispatcher().MessageLoop(Test());
+        Dispatcher().PumpUntilIdle();
+    }
+};
+
+void TryWaitTest()
+{
+    CTryWaitTest test;
+    test.Run();
+}
+
 ///////////////////////////////////////////////
 
 int main(int argc, char **argv)
@@ -412,7 +896,11 @@ int main(int argc, char **argv)
     ConditionVariableDestructorTest();
 
     ConditionVariableTimeoutTest();
+    ConditionVariableWaiterListTest();
+    CancellationTest();
+    TryWaitTest();
     BlockingQueueTest();
+    ChannelTest();
 
     MutexTest();
     ConditionVariableTest();
@@ -87,7 +87,7 @@ CoExec::~CoExec()
     CoKill().GetResult();
 }
 
-CoTask<> CoExec::CoKill(std::chrono::milliseconds gracePeriod)
+CoTask<> CoExec::CoKill(CoDispatcher::Duration gracePeriod)
 {
     Kill(SignalType::Terminate);
     try {
@@ -102,13 +102,13 @@ CoTask<> CoExec::CoKill(std::chrono::milliseconds gracePeriod)
     co_await this->CoWait();
     co_return;
 }
-CoTask<bool> CoExec::CoWait(std::chrono::milliseconds timeout)
+CoTask<bool> CoExec::CoWait(CoDispatcher::Duration timeout)
 {
-    std::chrono::milliseconds maxTime = Dispatcher().Now() + timeout;
+    CoDispatcher::Duration maxTime = Dispatcher().Now() + timeout;
     while (!HasTerminated())
     {
         co_await CoDelay(100ms);
-        if (Dispatcher().Now() > maxTime)
+        if (timeout != NO_TIMEOUT && Dispatcher().Now() > maxTime)
         {
             throw CoTimedOutException();
         }
@@ -135,11 +135,15 @@ bool CoExec::HasTerminated() const {
     return false;
 }
 
-bool CoExec::Wait(std::chrono::milliseconds timeoutMs)
+bool CoExec::Wait(CoDispatcher::Duration timeout)
 {
     if (this->processId != os::ProcessId::Invalid)
     {
-        exitResult = os::WaitForProcess(processId, timeoutMs.count());
+        // os::WaitForProcess() takes whole milliseconds, with -1 to wait indefinitely.
+        int timeoutMs = timeout < CoDispatcher::Duration::zero()
+            ? -1
+            : (int)std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+        exitResult = os::WaitForProcess(processId, timeoutMs);
         this->processId = os::ProcessId::Invalid;
     }
     return exitResult;
@@ -148,14 +152,13 @@ bool CoExec::Wait(std::chrono::milliseconds timeoutMs)
 CoTask<> CoExec::OutputReader(CoFile &file, std::ostream &outputStream)
 {
 
-    std::string line;
-
     cvOutput.Execute([this] {
         ++activeOutputs;
     });
-    while (co_await file.CoReadLine(&line))
+    auto lines = file.Lines();
+    while (co_await lines.Next())
     {
-        cvOutput.Execute([&line, &outputStream]() {
+        cvOutput.Execute([&line = lines.Value(), &outputStream]() {
             outputStream << line << std::endl;
         });
     }
@@ -195,8 +198,8 @@ CoTask<> CoExec::DiscardingOutputReader(CoFile &file)
         char buffer[512];
         while (true)
         {
-            int nRead = co_await file.CoRead(buffer, sizeof(buffer));
-            if (nRead == 0)
+            CoResult<size_t> result = co_await file.TryRead(buffer, sizeof(buffer));
+            if (!result || result.value == 0)
                 break;
         }
     }
@@ -63,7 +63,7 @@ CoTask<> CoForwardStdOut(CoFile &output, int &openOutputs)
         cout << "ForwardOutput: " << e.what() << endl;
     }
     cout << "StdOut done." << endl;
-    if (--openOutputs)
+    if (--openOutputs == 0)
     {
         CoDispatcher::CurrentDispatcher().PostQuit();
     }
@@ -87,7 +87,7 @@ CoTask<> CoForwardStdErr(CoFile &output, int &openOutputs)
         cout << "ForwardOutput: " << e.what() << endl;
     }
     cout << "Stderr done." << endl;
-    if (--openOutputs)
+    if (--openOutputs == 0)
     {
         CoDispatcher::CurrentDispatcher().PostQuit();
     }
@@ -27,6 +27,7 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <string.h>
 #include "cotask/CoService.h"
 #include <functional>
 #include <sys/socket.h>
@@ -56,21 +57,53 @@ void CoFile::WatchFile(int fd)
     {
         readReady = true;
         writeReady = true;
+        readSlot.Reset(ReadySlot::READY);
+        writeSlot.Reset(ReadySlot::READY);
         eventHandle = AsyncIo::GetInstance().WatchFile(fd, [this](AsyncIo::EventData eventData) {
-            if (eventData.readReady || eventData.hasError)
+            if (eventData.readReady || eventData.hasError || eventData.hup)
             {
+                readSlot.Signal();
                 readCv.Notify([this] {
                     this->readReady = true;
                 });
             }
             if (eventData.writeReady || eventData.hasError)
             {
+                writeSlot.Signal();
                 writeCv.Notify([this] {
                     this->writeReady = true;
                 });
             }
         });
     }
+    else
+    {
+        // wake Readable() and Writable() waiters.
+        readSlot.Signal();
+        writeSlot.Signal();
+    }
+}
+
+void CoFile::ReadySlot::Signal()
+{
+    uintptr_t previous = state.load(std::memory_order_acquire);
+    while (true)
+    {
+        if (previous > READY)
+        {
+            // hand the readiness directly to the waiter.
+            if (state.compare_exchange_weak(previous, NOT_READY, std::memory_order_acq_rel))
+            {
+                ReadyAwaiter *pAwaiter = (ReadyAwaiter *)previous;
+                pAwaiter->pDispatcher->Post(pAwaiter->handle, pAwaiter->priority);
+                return;
+            }
+        }
+        else if (previous == READY || state.compare_exchange_weak(previous, READY, std::memory_order_acq_rel))
+        {
+            return;
+        }
+    }
 }
 
 CoFile::~CoFile()
@@ -230,7 +263,14 @@ CoTask<> CoFile::CoOpen(const std::filesystem::path &path, CoFile::OpenMode mode
     co_return;
 }
 
-CoTask<size_t> CoFile::CoRead(void *data, size_t length, std::chrono::milliseconds timeout)
+CoTask<size_t> CoFile::CoRead(void *data, size_t length, CoDispatcher::Duration timeout, CoCancellationToken cancellationToken)
+{
+    CoResult<size_t> result = co_await TryRead(data, length, timeout, std::move(cancellationToken));
+    ThrowIfFailed(result.status);
+    co_return result.value;
+}
+
+CoTask<CoResult<size_t>> CoFile::TryRead(void *data, size_t length, CoDispatcher::Duration timeout, CoCancellationToken cancellationToken)
 {
     OpsLock opLock(this); // count outstanding iops;
 
@@ -247,12 +287,12 @@ CoTask<size_t> CoFile::CoRead(void *data, size_t length, std::chrono::millisecon
 
         if (closed)
         {
-            throw CoIoClosedException();
+            co_return CoResult<size_t>{CoStatus::Closed};
         }
         ssize_t nRead = read(this->file_fd, pData, length);
         if (nRead == 0)
         {
-            co_return totalRead;
+            co_return CoResult<size_t>{CoStatus::Ok, totalRead};
         }
         else if (nRead < 0)
         {
@@ -260,16 +300,21 @@ CoTask<size_t> CoFile::CoRead(void *data, size_t length, std::chrono::millisecon
             {
                 if (totalRead != 0)
                 {
-                    co_return totalRead;
+                    co_return CoResult<size_t>{CoStatus::Ok, totalRead};
                 }
                 readReady = false;
                 lock.unlock();
 
-                co_await readCv.Wait(
+                CoStatus status = co_await readCv.TryWait(
                     timeout,
                     [this]() {
                         return this->readReady || this->closed;
-                    });
+                    },
+                    cancellationToken);
+                if (status != CoStatus::Ok)
+                {
+                    co_return CoResult<size_t>{status};
+                }
                  
                 lock.lock();
             }
@@ -285,10 +330,17 @@ CoTask<size_t> CoFile::CoRead(void *data, size_t length, std::chrono::millisecon
             pData += nRead;
         }
     }
-    co_return totalRead;
+    co_return CoResult<size_t>{CoStatus::Ok, totalRead};
+}
+
+CoTask<size_t> CoFile::CoRecv(void *data, size_t length, CoDispatcher::Duration timeout, CoCancellationToken cancellationToken)
+{
+    CoResult<size_t> result = co_await TryRecv(data, length, timeout, std::move(cancellationToken));
+    ThrowIfFailed(result.status);
+    co_return result.value;
 }
 
-CoTask<size_t> CoFile::CoRecv(void *data, size_t length, std::chrono::milliseconds timeout)
+CoTask<CoResult<size_t>> CoFile::TryRecv(void *data, size_t length, CoDispatcher::Duration timeout, CoCancellationToken cancellationToken)
 {
     OpsLock opLock(this); // count outstanding iops;
 
@@ -302,7 +354,7 @@ CoTask<size_t> CoFile::CoRecv(void *data, size_t length, std::chrono::millisecon
 
         if (closed)
         {
-            throw CoIoClosedException();
+            co_return CoResult<size_t>{CoStatus::Closed};
         }
         int nRead = recv(this->file_fd, pData, length, 0);
         //cout << "recv  nRead = " <<nRead << endl;
@@ -313,13 +365,18 @@ CoTask<size_t> CoFile::CoRecv(void *data, size_t length, std::chrono::millisecon
                 readReady = false;
                 lock.unlock();
 
-                co_await readCv.Wait(
+                CoStatus status = co_await readCv.TryWait(
                     timeout,
                     [this]() {
                         bool ready =  this->readReady || this->closed;
                         //cout << "recv ready: " << ready << endl;
                         return ready;
-                    });
+                    },
+                    cancellationToken);
+                if (status != CoStatus::Ok)
+                {
+                    co_return CoResult<size_t>{status};
+                }
 
                 lock.lock();
                 continue;
@@ -329,11 +386,11 @@ CoTask<size_t> CoFile::CoRecv(void *data, size_t length, std::chrono::millisecon
                 CoIoException::ThrowErrno();
             }
         }
-        co_return nRead;
+        co_return CoResult<size_t>{CoStatus::Ok, (size_t)nRead};
     }
 }
 
-CoTask<> CoFile::CoWrite(const void *data, size_t length, std::chrono::milliseconds timeout)
+CoTask<> CoFile::CoWrite(const void *data, size_t length, CoDispatcher::Duration timeout, CoCancellationToken cancellationToken)
 {
     OpsLock opLock(this); // count outstanding iops;
 
@@ -356,13 +413,15 @@ CoTask<> CoFile::CoWrite(const void *data, size_t length, std::chrono::milliseco
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
             {
+                writeReady = false;
                 lock.unlock();
 
                 co_await writeCv.Wait(
                     timeout,
                     [this]() {
                         return this->writeReady || this->closed;
-                    });
+                    },
+                    cancellationToken);
                 
                 lock.lock();
                 continue;
@@ -380,7 +439,7 @@ CoTask<> CoFile::CoWrite(const void *data, size_t length, std::chrono::milliseco
     }
     co_return;
 }
-CoTask<> CoFile::CoSend(const void *data, size_t length, std::chrono::milliseconds timeout)
+CoTask<> CoFile::CoSend(const void *data, size_t length, CoDispatcher::Duration timeout, CoCancellationToken cancellationToken)
 {
     OpsLock opLock(this); // count outstanding iops;
 
@@ -408,7 +467,8 @@ CoTask<> CoFile::CoSend(const void *data, size_t length, std::chrono::millisecon
                     timeout,
                     [this]() {
                         return this->writeReady || this->closed;
-                    });
+                    },
+                    cancellationToken);
                 lock.lock();
             }
             else
@@ -440,12 +500,12 @@ void CoFile::CreateSocketPair(CoFile &sender, CoFile &receiver)
     receiver.Attach(sv[1]);
 }
 
-CoTask<> CoFile::CoWriteLine(const std::string &line, std::chrono::milliseconds timeout)
+CoTask<> CoFile::CoWriteLine(const std::string &line, CoDispatcher::Duration timeout, CoCancellationToken cancellationToken)
 {
 
-    co_await CoWrite(line.c_str(), line.length(), timeout);
+    co_await CoWrite(line.c_str(), line.length(), timeout, cancellationToken);
     char endl = '\n';
-    co_await CoWrite(&endl, 1, timeout);
+    co_await CoWrite(&endl, 1, timeout, cancellationToken);
 }
 CoTask<bool> CoFile::CoReadLine(std::string *result)
 {
@@ -473,4 +533,39 @@ CoTask<bool> CoFile::CoReadLine(std::string *result)
         lineHead = 0;
         lineTail = nRead;
     }
+}
+
+AsyncGenerator<std::string> CoFile::Lines()
+{
+    std::string line;
+    while (true)
+    {
+        while (lineHead != lineTail)
+        {
+            char *start = lineBuffer + lineHead;
+            char *end = lineBuffer + lineTail;
+            char *eol = (char *)memchr(start, '\n', end - start);
+            if (eol == nullptr)
+            {
+                line.append(start, end);
+                lineHead = lineTail;
+                break;
+            }
+            line.append(start, eol);
+            lineHead = (int)(eol - lineBuffer) + 1;
+            co_yield line;
+            line.clear();
+        }
+        size_t nRead = co_await CoRead(lineBuffer, sizeof(lineBuffer));
+        if (nRead == 0)
+        {
+            if (line.length() != 0)
+            {
+                co_yield line;
+            }
+            co_return;
+        }
+        lineHead = 0;
+        lineTail = (int)nRead;
+    }
 }
\ No newline at end of file
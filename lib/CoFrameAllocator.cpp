@@ -0,0 +1,309 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "cotask/CoFrameAllocator.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <new>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace cotask;
+
+namespace
+{
+    constexpr size_t N_SIZE_CLASSES = 7; // 64, 128, ... 4096
+    constexpr uint32_t OVERSIZE_CLASS = 0xFFFFFFFF;
+
+    struct ThreadCache;
+
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) BlockHeader
+    {
+        ThreadCache *owner;
+        uint32_t sizeClass;
+    };
+
+    // Free blocks are linked through the first word of the frame.
+    inline BlockHeader *&NextBlock(BlockHeader *block)
+    {
+        return *(BlockHeader **)(block + 1);
+    }
+
+    struct ThreadCache
+    {
+        BlockHeader *freeLists[N_SIZE_CLASSES] = {};
+        // blocks freed by other threads.
+        std::atomic<BlockHeader *> remoteFreeList = nullptr;
+
+        // 1 for the owning thread, plus one for each block allocated from the heap, plus temporary pins 
+        // held by remote frees. The cache is deleted when the count reaches zero.
+        std::atomic<int64_t> refs = 1;
+        std::atomic<bool> orphaned = false;
+
+        // Written only by the owning thread.
+        std::atomic<uint64_t> hits = 0;
+        std::atomic<uint64_t> misses = 0;
+        std::atomic<uint64_t> remoteFrees = 0;
+        std::atomic<uint64_t> oversize = 0;
+    };
+
+    inline void Bump(std::atomic<uint64_t> &counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<ThreadCache *> caches;
+        CoFrameAllocator::Statistics exitedThreads;
+        // counts for threads without a cache (i.e. during thread shutdown).
+        std::atomic<uint64_t> remoteFrees = 0;
+        std::atomic<uint64_t> oversize = 0;
+    };
+    // never deleted; frames may be freed during static destruction.
+    Registry *registry = new Registry();
+
+    void ReleaseCache(ThreadCache *cache)
+    {
+        if (cache->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            delete cache;
+        }
+    }
+
+    void DrainOrphan(ThreadCache *cache)
+    {
+        BlockHeader *block = cache->remoteFreeList.exchange(nullptr, std::memory_order_acquire);
+        while (block != nullptr)
+        {
+            BlockHeader *next = NextBlock(block);
+            std::free(block);
+            ReleaseCache(cache);
+            block = next;
+        }
+    }
+
+    void CollectRemoteFrees(ThreadCache *cache)
+    {
+        BlockHeader *block = cache->remoteFreeList.exchange(nullptr, std::memory_order_acquire);
+        while (block != nullptr)
+        {
+            BlockHeader *next = NextBlock(block);
+            NextBlock(block) = cache->freeLists[block->sizeClass];
+            cache->freeLists[block->sizeClass] = block;
+            block = next;
+        }
+    }
+
+    void OrphanCache(ThreadCache *cache)
+    {
+        CollectRemoteFrees(cache);
+        for (size_t i = 0; i < N_SIZE_CLASSES; ++i)
+        {
+            BlockHeader *block = cache->freeLists[i];
+            while (block != nullptr)
+            {
+                BlockHeader *next = NextBlock(block);
+                std::free(block);
+                ReleaseCache(cache);
+                block = next;
+            }
+            cache->freeLists[i] = nullptr;
+        }
+        {
+            std::lock_guard lock{registry->mutex};
+            registry->exitedThreads.hits += cache->hits;
+            registry->exitedThreads.misses += cache->misses;
+            registry->exitedThreads.remoteFrees += cache->remoteFrees;
+            registry->exitedThreads.oversize += cache->oversize;
+            registry->caches.erase(std::find(registry->caches.begin(), registry->caches.end(), cache));
+        }
+        // Pairs with RemoteFree(): either we see the block in the list, or the remote thread sees orphaned.
+        cache->orphaned.store(true);
+        DrainOrphan(cache);
+        ReleaseCache(cache);
+    }
+
+    thread_local ThreadCache *tlsCache = nullptr;
+    thread_local bool tlsCacheDestroyed = false;
+
+    struct CacheHolder
+    {
+        ThreadCache *cache = nullptr;
+        ~CacheHolder()
+        {
+            tlsCache = nullptr;
+            tlsCacheDestroyed = true;
+            if (cache)
+            {
+                OrphanCache(cache);
+            }
+        }
+    };
+    thread_local CacheHolder tlsCacheHolder;
+
+    ThreadCache *GetThreadCache()
+    {
+        ThreadCache *cache = tlsCache;
+        if (cache != nullptr || tlsCacheDestroyed)
+        {
+            return cache;
+        }
+        cache = new ThreadCache();
+        {
+            std::lock_guard lock{registry->mutex};
+            registry->caches.push_back(cache);
+        }
+        tlsCacheHolder.cache = cache;
+        tlsCache = cache;
+        return cache;
+    }
+
+    void RemoteFree(BlockHeader *block)
+    {
+        ThreadCache *current = tlsCache;
+        if (current)
+        {
+            Bump(current->remoteFrees);
+        }
+        else
+        {
+            registry->remoteFrees.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ThreadCache *owner = block->owner;
+        owner->refs.fetch_add(1, std::memory_order_relaxed); // keep the owner alive while we're using it.
+
+        BlockHeader *head = owner->remoteFreeList.load(std::memory_order_relaxed);
+        do
+        {
+            NextBlock(block) = head;
+        } while (!owner->remoteFreeList.compare_exchange_weak(head, block));
+
+        if (owner->orphaned.load())
+        {
+            DrainOrphan(owner);
+        }
+        ReleaseCache(owner);
+    }
+}
+
+void *CoFrameAllocator::Allocate(size_t size)
+{
+    if constexpr (!POOLED)
+    {
+        return ::operator new(size);
+    }
+    size_t blockSize = size + sizeof(BlockHeader);
+    ThreadCache *cache = GetThreadCache();
+    if (blockSize > MAX_SIZE_CLASS || cache == nullptr)
+    {
+        BlockHeader *block = (BlockHeader *)::operator new(blockSize);
+        block->owner = nullptr;
+        block->sizeClass = OVERSIZE_CLASS;
+        if (cache)
+        {
+            Bump(cache->oversize);
+        }
+        else
+        {
+            registry->oversize.fetch_add(1, std::memory_order_relaxed);
+        }
+        return block + 1;
+    }
+    uint32_t sizeClass = 0;
+    while ((MIN_SIZE_CLASS << sizeClass) < blockSize)
+    {
+        ++sizeClass;
+    }
+
+    BlockHeader *block = cache->freeLists[sizeClass];
+    if (block == nullptr && cache->remoteFreeList.load(std::memory_order_relaxed) != nullptr)
+    {
+        CollectRemoteFrees(cache);
+        block = cache->freeLists[sizeClass];
+    }
+    if (block != nullptr)
+    {
+        cache->freeLists[sizeClass] = NextBlock(block);
+        Bump(cache->hits);
+        return block + 1;
+    }
+
+    block = (BlockHeader *)std::malloc(MIN_SIZE_CLASS << sizeClass);
+    if (block == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    block->owner = cache;
+    block->sizeClass = sizeClass;
+    cache->refs.fetch_add(1, std::memory_order_relaxed);
+    Bump(cache->misses);
+    return block + 1;
+}
+
+void CoFrameAllocator::Free(void *p, size_t size) noexcept
+{
+    if (p == nullptr)
+    {
+        return;
+    }
+    if constexpr (!POOLED)
+    {
+        ::operator delete(p);
+        return;
+    }
+    BlockHeader *block = ((BlockHeader *)p) - 1;
+    if (block->sizeClass == OVERSIZE_CLASS)
+    {
+        ::operator delete(block);
+        return;
+    }
+    ThreadCache *cache = tlsCache;
+    if (block->owner == cache)
+    {
+        NextBlock(block) = cache->freeLists[block->sizeClass];
+        cache->freeLists[block->sizeClass] = block;
+        return;
+    }
+    RemoteFree(block);
+}
+
+CoFrameAllocator::Statistics CoFrameAllocator::GetStatistics()
+{
+    std::lock_guard lock{registry->mutex};
+    Statistics result = registry->exitedThreads;
+    result.remoteFrees += registry->remoteFrees;
+    result.oversize += registry->oversize;
+    for (ThreadCache *cache : registry->caches)
+    {
+        result.hits += cache->hits.load(std::memory_order_relaxed);
+        result.misses += cache->misses.load(std::memory_order_relaxed);
+        result.remoteFrees += cache->remoteFrees.load(std::memory_order_relaxed);
+        result.oversize += cache->oversize.load(std::memory_order_relaxed);
+    }
+    return result;
+}
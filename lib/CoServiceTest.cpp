@@ -26,6 +26,12 @@
 #include "cotask/CoService.h"
 #include <cassert>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <random>
+#include <vector>
+#include <algorithm>
 
 using namespace cotask;
 using namespace std;
@@ -198,10 +204,224 @@ void TestSimpleService()
 
 //**********************************
 
+// Completes services on a separate thread after a random delay, so that results, 
+// timeouts and cancellations race.
+class RacingCompleter
+{
+public:
+    struct Entry
+    {
+        CoServiceCallback<int> *pCallback;
+        int value;
+        std::chrono::steady_clock::time_point completeAt;
+        bool completeOnCancel;
+    };
+
+    RacingCompleter()
+    {
+        thread = std::thread([this]() { ThreadProc(); });
+    }
+    ~RacingCompleter()
+    {
+        stopping = true;
+        thread.join();
+    }
+    void Add(CoServiceCallback<int> *pCallback, int value, std::chrono::microseconds delay, bool completeOnCancel)
+    {
+        std::lock_guard lock{mutex};
+        pending.push_back(Entry{pCallback, value, std::chrono::steady_clock::now() + delay, completeOnCancel});
+    }
+    // true if the entry was removed before completion.
+    bool Cancel(CoServiceCallback<int> *pCallback)
+    {
+        std::unique_lock lock{mutex};
+        for (auto i = pending.begin(); i != pending.end(); ++i)
+        {
+            if (i->pCallback == pCallback)
+            {
+                Entry entry = *i;
+                pending.erase(i);
+                if (entry.completeOnCancel)
+                {
+                    // deliver the result while the cancel is in progress.
+                    lock.unlock();
+                    entry.pCallback->SetResult(std::move(entry.value));
+                    return false;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    void ThreadProc()
+    {
+        std::vector<Entry> ready;
+        while (!stopping)
+        {
+            {
+                std::lock_guard lock{mutex};
+                auto now = std::chrono::steady_clock::now();
+                for (auto i = pending.begin(); i != pending.end(); /**/)
+                {
+                    if (i->completeAt <= now)
+                    {
+                        ready.push_back(*i);
+                        i = pending.erase(i);
+                    }
+                    else
+                    {
+                        ++i;
+                    }
+                }
+            }
+            // complete outside the lock, so that Cancel() can fail with the result in flight.
+            for (auto &entry : ready)
+            {
+                entry.pCallback->SetResult(std::move(entry.value));
+            }
+            if (ready.empty())
+            {
+                std::this_thread::yield();
+            }
+            ready.clear();
+        }
+    }
+    std::mutex mutex;
+    std::vector<Entry> pending;
+    std::atomic<bool> stopping = false;
+    std::thread thread;
+};
+
+static RacingCompleter *pRacingCompleter = nullptr;
+
+auto RacingService(int value, std::chrono::microseconds completeAfter, std::chrono::microseconds timeout, bool completeOnCancel)
+{
+    struct Implementation
+    {
+        using return_type = int;
+        int resultValue;
+        std::chrono::microseconds completeAfter;
+        std::chrono::microseconds timeout;
+        bool completeOnCancel;
+
+        void Execute(CoServiceCallback<return_type> *pCallback)
+        {
+            if (timeout != 0us)
+            {
+                pCallback->RequestTimeout(timeout);
+            }
+            if (completeAfter == 0us)
+            {
+                pCallback->SetResult(std::move(resultValue));
+            }
+            else
+            {
+                pRacingCompleter->Add(pCallback, resultValue, completeAfter, completeOnCancel);
+            }
+        }
+        bool CancelExecute(CoServiceCallback<return_type> *pCallback)
+        {
+            return pRacingCompleter->Cancel(pCallback);
+        }
+    };
+    CoService<Implementation> service;
+    service.resultValue = value;
+    service.completeAfter = completeAfter;
+    service.timeout = timeout;
+    service.completeOnCancel = completeOnCancel;
+    return service;
+}
+
+static constexpr int STRESS_WORKERS = 32;
+static constexpr int STRESS_ITERATIONS = 300;
+
+static std::atomic<int> stressResults;
+static std::atomic<int> stressTimeouts;
+static std::atomic<int> stressFinished;
+
+CoTask<> StressWorker(int id)
+{
+    co_await CoBackground();
+    std::mt19937 random(id);
+    std::uniform_int_distribution<int> delay(0, 300);
+    for (int i = 0; i < STRESS_ITERATIONS; ++i)
+    {
+        // mostly close races between the result and the timeout; occasionally an immediate result or timeout.
+        int completeAfter = delay(random);
+        int timeout = std::max(1, completeAfter + delay(random) / 10 - 15);
+        bool completeOnCancel = false;
+        switch (i % 16)
+        {
+        case 0:
+            completeAfter = 0;
+            break;
+        case 1:
+            timeout = -1;
+            break;
+        case 2:
+            timeout = 0;
+            break;
+        case 3: // the result arrives while the timeout is cancelling it.
+            completeAfter = 1000000;
+            timeout = 20;
+            completeOnCancel = true;
+            break;
+        }
+        try
+        {
+            int result = co_await RacingService(i, std::chrono::microseconds(completeAfter), std::chrono::microseconds(timeout), completeOnCancel);
+            assert(result == i);
+            (void)result;
+            ++stressResults;
+        }
+        catch (const CoTimedOutException &)
+        {
+            assert(timeout != 0 && !completeOnCancel);
+            ++stressTimeouts;
+        }
+    }
+    ++stressFinished;
+    co_return;
+}
+
+CoTask<> StressTest()
+{
+    for (int i = 0; i < STRESS_WORKERS; ++i)
+    {
+        Dispatcher().StartThread(StressWorker(i));
+    }
+    while (stressFinished != STRESS_WORKERS)
+    {
+        co_await CoDelay(10ms);
+    }
+    co_return;
+}
+
+void TestServiceStress()
+{
+    cout << "---- TestServiceStress ---" << endl;
+    RacingCompleter completer;
+    pRacingCompleter = &completer;
+
+    CoDispatcher::CurrentDispatcher().SetThreadPoolSize(4);
+    CoTask<> task = StressTest();
+    task.GetResult();
+
+    cout << "    results: " << stressResults << " timeouts: " << stressTimeouts << endl;
+    assert(stressResults + stressTimeouts == STRESS_WORKERS * STRESS_ITERATIONS);
+    assert(stressResults != 0 && stressTimeouts != 0);
+    pRacingCompleter = nullptr;
+}
+
+//**********************************
+
 int main(int argc, char**argv)
 {
     // TestServiceTimeout();
     TestSimpleService();
+    TestServiceStress();
 
     Dispatcher().DestroyDispatcher();
     return 0;
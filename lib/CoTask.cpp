@@ -28,96 +28,141 @@
 #include "ss.h"
 #include "CoTaskSchedulerPool.h"
 #include "cotask/Os.h"
+#include "cotask/AsyncIo.h"
 
 using namespace cotask;
 using namespace std;
 
 static constexpr bool debugTimers = false;
-using Clock = std::chrono::steady_clock;
+
+namespace cotask::detail
+{
+    // CoDispatcher's record of a task started with StartThread().
+    struct DetachedThread
+    {
+        DetachedThread(CoTask<> &&task, CoDispatcher *dispatcher)
+            : task(std::move(task)), dispatcher(dispatcher)
+        {
+        }
+        CoTask<> task;
+        CoDispatcher *dispatcher;
+        DetachedThread *prev = nullptr;
+        DetachedThread *next = nullptr;
+        DetachedThread *nextCompleted = nullptr;
+    };
+}
 
 thread_local CoDispatcher *CoDispatcher::pInstance;
 CoDispatcher *CoDispatcher::gForegroundDispatcher;
 std::mutex CoDispatcher::gLogMutex;
 
 
-CoDispatcher::TimeMs CoDispatcher::Now()
+CoDispatcher::Duration CoDispatcher::Now()
 {
 
-    auto now = Clock::now();
+    auto now = CoClock::now();
     auto duration = now.time_since_epoch();
 
-    return std::chrono::duration_cast<std::chrono::milliseconds>(duration);
+    return std::chrono::duration_cast<Duration>(duration);
 }
 
-void CoDispatcher::PostDelayed(TimeMs delay, const std::coroutine_handle<> &handle)
+CoDispatcher::TimerHandle CoDispatcher::PostDelayed(Duration delay, const std::coroutine_handle<> &handle, CoPriority priority)
 {
     if (!IsForeground())
     {
-        pForegroundDispatcher->PostDelayed(delay, handle);
+        return pForegroundDispatcher->PostDelayed(delay, handle, priority);
     }
     else
     {
+        TimerHandle timerHandle;
         {
             std::lock_guard lock{this->schedulerMutex};
-            CoroutineTimerEntry entry{Now() + delay, handle};
-            coroutineTimerQueue.push(std::move(entry));
+            timerHandle = timerQueue.Insert(Now() + delay, handle, priority);
         }
+        outstandingWork.fetch_add(1, std::memory_order_relaxed);
         PumpMessageNotifyOne();
+        return timerHandle;
     }
 }
-uint64_t CoDispatcher::PostDelayedFunction(TimeMs delay, std::function<void(void)> callback)
+CoDispatcher::TimerHandle CoDispatcher::PostDelayedFunction(Duration delay, InplaceFunction<void(void)> callback, CoPriority priority)
 {
     if (!IsForeground())
     {
-        return pForegroundDispatcher->PostDelayedFunction(delay, callback);
+        return pForegroundDispatcher->PostDelayedFunction(delay, std::move(callback), priority);
     }
     else
     {
-        uint64_t handle;
+        TimerHandle timerHandle;
         {
             std::lock_guard lock{this->schedulerMutex};
-            handle = ++nextTimerHandle;
-            TimerFunctionEntry entry{Now() + delay, callback, handle};
-            bool inserted = false;
-            if (debugTimers) Log().Debug(SS("insert fn " << functionTimerQueue.size() << "  "));
-            for (auto i = functionTimerQueue.begin(); i != functionTimerQueue.end(); ++i)
-            {
-                if (entry.time.count() < i->time.count())
-                {
-                    functionTimerQueue.insert(i, std::move(entry));
-                    inserted = true;
-                    break;
-                }
-            }
-            if (!inserted)
-            {
-                functionTimerQueue.push_back(entry);
-            }
-            if (debugTimers) Log().Debug(SS("...." << functionTimerQueue.size()));
+            timerHandle = timerQueue.Insert(Now() + delay, std::move(callback), priority);
+            if (debugTimers) Log().Debug(SS("fn timer inserted: " << timerQueue.size()));
         }
+        outstandingWork.fetch_add(1, std::memory_order_relaxed);
         PumpMessageNotifyOne();
-        return handle;
+        return timerHandle;
     }
 }
 
-bool CoDispatcher::CancelDelayedFunction(uint64_t handle)
+bool CoDispatcher::CancelTimer(TimerHandle timerHandle)
 {
     if (!IsForeground())
     {
-        return pForegroundDispatcher->CancelDelayedFunction(handle);
+        return pForegroundDispatcher->CancelTimer(timerHandle);
+    }
+    bool cancelled;
+    {
+        std::lock_guard lock{this->schedulerMutex};
+
+        cancelled = timerQueue.Cancel(timerHandle);
+        if (debugTimers && cancelled) Log().Debug(SS("timer cancelled: " << timerQueue.size()));
+    }
+    if (cancelled)
+    {
+        OnWorkCompleted();
+    }
+    return cancelled;
+}
+
+bool CoTimer::AddDelay(DelayAwaiter *pAwaiter)
+{
+    std::lock_guard lock{mutex};
+    if (cancelled)
+    {
+        pAwaiter->cancelled = true;
+        return false; // don't suspend.
     }
-    std::lock_guard lock{this->schedulerMutex};
+    pendingDelays.push_back(pAwaiter);
+    pAwaiter->timerHandle = CoDispatcher::CurrentDispatcher().PostDelayed(pAwaiter->delay, pAwaiter->coroutine);
+    return true;
+}
 
-    for (auto i = functionTimerQueue.begin(); i != functionTimerQueue.end(); ++i)
+void CoTimer::RemoveDelay(DelayAwaiter *pAwaiter)
+{
+    std::lock_guard lock{mutex};
+    for (auto i = pendingDelays.begin(); i != pendingDelays.end(); ++i)
     {
-        if (i->timerHandle == handle)
+        if (*i == pAwaiter)
         {
-            functionTimerQueue.erase(i);
-            if (debugTimers) Log().Debug(SS("fn timer cancelled: " << functionTimerQueue.size()));
-            return true;
+            pendingDelays.erase(i);
+            break;
+        }
+    }
+}
+
+void CoTimer::Cancel()
+{
+    std::lock_guard lock{mutex};
+    cancelled = true;
+    for (DelayAwaiter *pAwaiter : pendingDelays)
+    {
+        // If the timer can't be cancelled, it has already fired, and the coroutine is about to resume.
+        if (!pAwaiter->cancelled && CoDispatcher::ForegroundDispatcher().CancelTimer(pAwaiter->timerHandle))
+        {
+            pAwaiter->cancelled = true;
+            CoDispatcher::ForegroundDispatcher().Post(pAwaiter->coroutine, pAwaiter->priority);
         }
     }
-    return false;
 }
 
 void CoDispatcher::PostBackground(std::coroutine_handle<> handle)
@@ -125,20 +170,58 @@ void CoDispatcher::PostBackground(std::coroutine_handle<> handle)
     this->pSchedulerPool->Post(handle);
 }
 
-void CoDispatcher::Post(std::coroutine_handle<> handle)
+void CoDispatcher::Post(std::coroutine_handle<> handle, CoPriority priority)
 {
     if (!IsForeground())
     {
-        pForegroundDispatcher->Post(handle);
+        pForegroundDispatcher->Post(handle, priority);
     }
     else
     {
+        outstandingWork.fetch_add(1, std::memory_order_relaxed);
+        postQueues->lanes[(size_t)priority].push(handle);
+        PumpMessageNotifyOne();
+    }
+}
+
+bool CoDispatcher::PopPosted(std::coroutine_handle<> *pHandle, CoPriority *pPriority)
+{
+    auto &queues = postQueues->lanes;
+    auto &passedOver = postQueues->passedOver;
+
+    // Highest priority first; except that a lane that has been passed over STARVATION_LIMIT times 
+    // in a row goes first. (Lanes are only passed over in favour of higher-priority lanes.)
+    size_t lane = CO_PRIORITY_LANES;
+    for (size_t i = 0; i < CO_PRIORITY_LANES; ++i)
+    {
+        if (passedOver[i] >= STARVATION_LIMIT && queues[i].pop(pHandle))
         {
-            std::unique_lock lock{schedulerMutex};
-            queue.push(handle);
+            lane = i;
+            break;
         }
-        PumpMessageNotifyOne();
     }
+    if (lane == CO_PRIORITY_LANES)
+    {
+        for (size_t i = 0; i < CO_PRIORITY_LANES; ++i)
+        {
+            if (queues[i].pop(pHandle))
+            {
+                lane = i;
+                break;
+            }
+        }
+        if (lane == CO_PRIORITY_LANES)
+        {
+            return false;
+        }
+    }
+    passedOver[lane] = 0;
+    for (size_t i = lane + 1; i < CO_PRIORITY_LANES; ++i)
+    {
+        passedOver[i] = queues[i].empty() ? 0 : passedOver[i] + 1;
+    }
+    *pPriority = (CoPriority)lane;
+    return true;
 }
 
 void CoDispatcher::PumpUntilIdle()
@@ -151,7 +234,44 @@ void CoDispatcher::PumpUntilIdle()
 
     while (!IsDone())
     {
-        PumpMessages();
+        // (OnWorkCompleted() wakes us when background work completes.)
+        PumpMessages(true);
+    }
+}
+
+void CoDispatcher::WaitUntilIdle()
+{
+    if (IsForeground() && IsCurrentThread())
+    {
+        PumpUntilIdle();
+        return;
+    }
+    if (pInstance != nullptr && !pInstance->IsForeground())
+    {
+        throw logic_error("Can't wait for idle on a thread pool thread.");
+    }
+    CoDispatcher *foreground = pForegroundDispatcher;
+    while (true)
+    {
+        int64_t work = foreground->outstandingWork.load(std::memory_order_acquire);
+        if (work == 0)
+        {
+            return;
+        }
+        foreground->outstandingWork.wait(work, std::memory_order_acquire);
+    }
+}
+
+void CoDispatcher::OnWorkCompleted()
+{
+    if (outstandingWork.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        // became idle.
+        if (!IsCurrentThread())
+        {
+            PumpMessageNotifyOne(); // wake PumpUntilIdle().
+        }
+        outstandingWork.notify_all();
     }
 }
 
@@ -193,128 +313,78 @@ void CoDispatcher::SetThreadPoolSize(size_t size)
     pSchedulerPool->Resize(size);
 }
 
-bool CoDispatcher::PumpTimerMessages(TimeMs time)
+bool CoDispatcher::PumpTimerMessages(Duration time)
 {
-    std::unique_lock<std::mutex> lock{schedulerMutex};
-
-    if (coroutineTimerQueue.empty())
+    // Expired timers are removed in batches, so that the scheduler mutex is taken once per 
+    // batch rather than once per timer. Timers in a batch have already been removed from the 
+    // queue, so they can no longer be cancelled; callers of CancelTimer() must 
+    // already deal with timers that are in flight.
+    //
+    // Expired coroutines go to the back of the post lane for their priority, so that an Idle 
+    // delay that expires doesn't run ahead of High posts. (They were already counted as outstanding 
+    // work when the timer was posted.) Delayed functions, which are short callbacks that cancel or 
+    // post, are called here.
+    constexpr size_t MAX_BATCH = 16;
+    TimerQueue::Timer batch[MAX_BATCH];
+    size_t nExpired = 0;
     {
-        if (functionTimerQueue.empty())
-        {
-            return false;
-        }
-        else
-        {
-            if (functionTimerQueue.begin()->time <= time)
-            {
-                auto fn = functionTimerQueue.begin()->fn;
-
-                if (debugTimers) Log().Debug(SS("fn executed: " << functionTimerQueue.size() << "..."));
-
-                functionTimerQueue.pop_front();
-
-                if (debugTimers) Log().Debug(SS("...." << functionTimerQueue.size()));
+        std::lock_guard lock{schedulerMutex};
 
-                lock.unlock();
-                fn();
-
-                return true;
-            }
-            return false;
+        while (nExpired < MAX_BATCH && timerQueue.PopExpired(time, &batch[nExpired]))
+        {
+            ++nExpired;
         }
+        if (debugTimers && nExpired != 0) Log().Debug(SS("timers expired: " << nExpired << " remaining: " << timerQueue.size()));
     }
-    else
+    CoPriority savedPriority = detail::currentPriority;
+    for (size_t i = 0; i < nExpired; ++i)
     {
-        if (functionTimerQueue.empty())
+        if (batch[i].coroutine)
         {
-            if (coroutineTimerQueue.top().time <= time)
-            {
-                auto handle = coroutineTimerQueue.top().handle;
-                coroutineTimerQueue.pop();
-                lock.unlock();
-                handle.resume();
-                return true;
-            }
-            return false;
+            postQueues->lanes[(size_t)batch[i].priority].push(batch[i].coroutine);
+            continue;
         }
-        else
+        try
         {
-            if (functionTimerQueue.front().time.count() <= coroutineTimerQueue.top().time.count())
-            {
-                if (functionTimerQueue.front().time <= time)
-                {
-                    auto fn = functionTimerQueue.front().fn;
-
-                    if (debugTimers) Log().Debug(SS("fn executed: " << functionTimerQueue.size() << "..."));
-
-                    functionTimerQueue.pop_front();
-
-                    if (debugTimers) Log().Debug(SS("...." << functionTimerQueue.size()));
-
-                    lock.unlock();
-                    fn();
-                    return true;
-                }
-            }
-            else if (coroutineTimerQueue.top().time.count() < time.count())
+            ++foregroundDispatchDepth;
+            detail::currentPriority = batch[i].priority;
+            batch[i].Fire();
+            detail::currentPriority = savedPriority;
+            --foregroundDispatchDepth;
+            OnWorkCompleted();
+        }
+        catch (...)
+        {
+            detail::currentPriority = savedPriority;
+            --foregroundDispatchDepth;
+            OnWorkCompleted();
+            // put the rest of the batch back, so that they aren't lost. (They are still counted as outstanding work.)
+            std::lock_guard lock{schedulerMutex};
+            for (size_t j = i + 1; j < nExpired; ++j)
             {
-                if (coroutineTimerQueue.top().time <= time)
-                {
-                    auto handle = coroutineTimerQueue.top().handle;
-                    coroutineTimerQueue.pop();
-                    lock.unlock();
-                    handle.resume();
-                    return true;
-                }
+                timerQueue.Insert(time, std::move(batch[j]));
             }
-            return false;
+            throw;
         }
     }
+    return nExpired != 0;
 }
 
-bool CoDispatcher::GetNextTimer(CoDispatcher::TimeMs *pResult) const
+bool CoDispatcher::GetNextTimer(CoDispatcher::Duration *pResult) const
 {
-    if (this->coroutineTimerQueue.empty())
+    if (this->timerQueue.empty())
     {
-        if (this->functionTimerQueue.empty())
-        {
-            return false;
-        }
-        else
-        {
-            *pResult = this->functionTimerQueue.front().time;
-            return true;
-        }
-    }
-    else
-    {
-        if (this->functionTimerQueue.empty())
-        {
-            *pResult = this->coroutineTimerQueue.top().time;
-            return true;
-        }
-        else
-        {
-            auto t1 = this->coroutineTimerQueue.top().time;
-            auto t2 = this->functionTimerQueue.front().time;
-            if (t1 < t2)
-            {
-                *pResult = t1;
-            }
-            else
-            {
-                *pResult = t2;
-            }
-            return true;
-        }
+        return false;
     }
+    *pResult = this->timerQueue.NextTime();
+    return true;
 }
 
-void CoDispatcher::SleepFor(TimeMs delay)
+void CoDispatcher::SleepFor(Duration delay)
 {
     SleepUntil(Now() + delay);
 }
-void CoDispatcher::SleepUntil(TimeMs time)
+void CoDispatcher::SleepUntil(Duration time)
 {
     if (IsForeground())
     {
@@ -325,8 +395,8 @@ void CoDispatcher::SleepUntil(TimeMs time)
             if (now >= time)
                 break;
 
-            TimeMs waitTime = time;
-            TimeMs timerDelay;
+            Duration waitTime = time;
+            Duration timerDelay;
             if (GetNextTimer(&timerDelay))
             {
                 if (timerDelay < time)
@@ -334,26 +404,17 @@ void CoDispatcher::SleepUntil(TimeMs time)
                     waitTime = timerDelay;
                 }
             }
-            {
-                std::unique_lock lock{pumpMessageMutex};
-                TimeMs delay = waitTime - Now();
-                if (delay < 1ms)
-                    delay = 1ms;
-                pumpMessageConditionVariable.wait_for(lock, delay);
-            }
+            PumpMessageWaitUntil(waitTime);
             PumpMessages();
         }
     }
     else
     {
-        TimeMs delay = time - Now();
-        if (delay < 1ms)
-            delay = 1ms;
-        std::this_thread::sleep_for(delay);
+        std::this_thread::sleep_until(CoTimePoint(time));
     }
 }
 
-void CoDispatcher::PumpMessages(std::chrono::milliseconds timeout)
+void CoDispatcher::PumpMessages(Duration timeout)
 {
     auto endTime = Now() + timeout;
     if (PumpMessages())
@@ -370,8 +431,8 @@ void CoDispatcher::PumpMessages(std::chrono::milliseconds timeout)
             if (now >= endTime)
                 throw CoTimedOutException();
 
-            TimeMs waitTime = endTime;
-            TimeMs timerDelay;
+            Duration waitTime = endTime;
+            Duration timerDelay;
             if (GetNextTimer(&timerDelay))
             {
                 if (timerDelay < waitTime)
@@ -379,13 +440,7 @@ void CoDispatcher::PumpMessages(std::chrono::milliseconds timeout)
                     waitTime = timerDelay;
                 }
             }
-            {
-                std::unique_lock lock{pumpMessageMutex};
-                TimeMs delay = waitTime - now;
-                if (delay < 1ms)
-                    delay = 1ms;
-                pumpMessageConditionVariable.wait_for(lock, delay);
-            }
+            PumpMessageWaitUntil(waitTime);
             if (PumpMessages())
             {
                 return;
@@ -434,7 +489,7 @@ bool CoDispatcher::PumpMessages()
 
     bool processedAny = false;
 
-    TimeMs now = Now();
+    Duration now = Now();
 
     while (true)
     {
@@ -451,22 +506,27 @@ bool CoDispatcher::PumpMessages()
         };
 
         {
-            std::unique_lock<std::mutex> lock{schedulerMutex};
-            while (!this->queue.empty())
+            // pump posted messages, each at the priority it was posted at.
+            std::coroutine_handle<> t;
+            CoPriority priority;
+            while (PopPosted(&t, &priority))
             {
                 processedAny = true;
                 processedMessage = true;
-                // pump posted messages.
-                std::coroutine_handle<> t = queue.pop();
-                lock.unlock();
+                ++foregroundDispatchDepth;
+                CoPriority savedPriority = std::exchange(detail::currentPriority, priority);
+                unsigned savedTransferDepth = std::exchange(detail::transferDepth, 0);
                 t.resume();
-                lock.lock();
+                detail::transferDepth = savedTransferDepth;
+                detail::currentPriority = savedPriority;
+                --foregroundDispatchDepth;
+                OnWorkCompleted();
             }
         }
         if (!processedMessage)
         {
             pSchedulerPool->ScavengeDeadThreads();
-            ScavengeTasks();
+            ReapCompletedThreads();
 
             return processedAny;
         }
@@ -474,6 +534,7 @@ bool CoDispatcher::PumpMessages()
 }
 
 CoDispatcher::CoDispatcher()
+    : postQueues(std::make_unique<PostQueues>())
 {
     this->pForegroundDispatcher = this;
     this->pSchedulerPool = new CoTaskSchedulerPool(this);
@@ -488,6 +549,10 @@ CoDispatcher::~CoDispatcher()
 {
     if (IsForeground())
     {
+        if (foregroundIo)
+        {
+            pAsyncIo.load()->SetForegroundMode(false); // hand i/o back to the AsyncIo thread.
+        }
         if (this->pSchedulerPool)
         {
             delete this->pSchedulerPool;
@@ -495,6 +560,13 @@ CoDispatcher::~CoDispatcher()
         }
         Log().Debug("Dispatcher deleted.");
     }
+    // destroy detached tasks, complete or not.
+    while (detachedThreads != nullptr)
+    {
+        detail::DetachedThread *thread = detachedThreads;
+        detachedThreads = thread->next;
+        delete thread;
+    }
     {
         std::lock_guard lock{gLogMutex}; // protect the shared_ptr.
         this->log = nullptr;
@@ -535,11 +607,12 @@ bool CoDispatcher::IsDone() const
     {
         return pForegroundDispatcher->IsDone();
     }
-    if ((!coroutineTimerQueue.empty()) || (!queue.empty()) || (!functionTimerQueue.empty()))
+    int64_t work = outstandingWork.load(std::memory_order_acquire);
+    if (IsCurrentThread())
     {
-        return false;
+        work -= foregroundDispatchDepth;
     }
-    return pSchedulerPool->IsDone();
+    return work == 0;
 }
 
 size_t CoDispatcher::Instrumentation::GetThreadPoolSize()
@@ -551,89 +624,155 @@ size_t CoDispatcher::Instrumentation::GetNumberOfDeadThreads()
     return CurrentDispatcher().pSchedulerPool->deadThreads.size();
 }
 
-void CoDispatcher::PumpMessageNotifyOne()
+void CoDispatcher::SetForegroundIo(bool enabled)
 {
+    if (!IsForeground())
     {
-        std::lock_guard lock{pumpMessageMutex};
-        // cout << "notify" << endl;
-        this->messagePosted = true;
-        pumpMessageConditionVariable.notify_one();
+        throw std::logic_error("Not on foreground thread.");
     }
+    AsyncIo &asyncIo = AsyncIo::GetInstance();
+    asyncIo.SetForegroundMode(enabled);
+    this->pAsyncIo = &asyncIo;
+    this->foregroundIo = enabled;
 }
 
-void CoDispatcher::PumpMessageWaitOne()
+void CoDispatcher::PumpMessageNotifyOne()
 {
-    while (true)
+    // Pairs with PumpMessageWaitUntil(): either the foreground thread sees messagePosted before
+    // it sleeps, or we see that it is sleeping.
+    this->messagePosted = true;
+    if (this->sleeping.load() && this->sleeping.exchange(false))
     {
-        std::unique_lock lock{pumpMessageMutex};
-        if (this->messagePosted)
+        if (foregroundIo)
         {
-            this->messagePosted = false;
-            return;
+            pAsyncIo.load()->Wake();
         }
-        std::chrono::milliseconds nextTimer;
-        if (this->GetNextTimer(&nextTimer))
+        else
         {
-            auto delay = nextTimer - Now();
-            if (delay.count() < 0)
-            {
-                return;
-            }
-            if (delay.count() == 0)
-            {
-                delay = 1ms;
-            }
-            pumpMessageConditionVariable.wait_for(lock, delay);
-            return;
+            wakeSemaphore.release();
         }
-        else
+    }
+}
+
+void CoDispatcher::PumpMessageWaitUntil(Duration time)
+{
+    // discard wakes from previous waits that timed out.
+    while (wakeSemaphore.try_acquire())
+    {
+    }
+    this->sleeping = true;
+    if (this->messagePosted.exchange(false))
+    {
+        this->sleeping = false;
+        return;
+    }
+    if (foregroundIo)
+    {
+        pAsyncIo.load()->WaitForEvents(time);
+    }
+    else
+    {
+        (void)wakeSemaphore.try_acquire_until(std::chrono::time_point_cast<CoClock::duration>(CoTimePoint(time)));
+    }
+    this->sleeping = false;
+}
+
+void CoDispatcher::PumpMessageWaitOne()
+{
+    if (this->messagePosted.exchange(false))
+    {
+        return;
+    }
+    Duration now = Now();
+    Duration waitTime = now + 1000ms;
+    Duration nextTimer;
+    if (this->GetNextTimer(&nextTimer))
+    {
+        if (nextTimer <= now)
         {
-            pumpMessageConditionVariable.wait_for(lock, 1000ms);
             return;
         }
+        waitTime = nextTimer;
     }
+    PumpMessageWaitUntil(waitTime);
 }
 
-int scavengeTaskCounter = 0;
-void CoDispatcher::ScavengeTasks()
+void CoDispatcher::OnDetachedThreadCompleted(void *taggedPrecursor) noexcept
 {
-    while (true)
+    auto thread = (detail::DetachedThread *)(((uintptr_t)taggedPrecursor) & ~CoTask<>::promise_type::DETACHED_TAG);
+    auto &completedThreads = thread->dispatcher->completedThreads;
+    detail::DetachedThread *head = completedThreads.load(std::memory_order_relaxed);
+    do
     {
-        bool removedOne = false;
-        for (auto i = coroutineThreads.begin(); i != coroutineThreads.end(); /**/)
-        {
+        thread->nextCompleted = head;
+    } while (!completedThreads.compare_exchange_weak(head, thread, std::memory_order_release, std::memory_order_relaxed));
+}
 
-            if (i->handle.done())
-            {
-                CoTask<> t = std::move(*i);
-                i = coroutineThreads.erase(i);
-                try
-                {
+void CoDispatcher::ReapCompletedThreads()
+{
+    if (completedThreads.load(std::memory_order_relaxed) == nullptr)
+    {
+        return;
+    }
+    detail::DetachedThread *thread = completedThreads.exchange(nullptr, std::memory_order_acquire);
+    while (thread != nullptr)
+    {
+        detail::DetachedThread *next = thread->nextCompleted;
+        ReapThread(thread);
+        thread = next;
+    }
+}
 
-                    t.GetResult();
-                    removedOne = true;
-                    break;
-                }
-                catch (const std::exception &e)
-                {
-                    Log().Error(SS("Coroutine Thread exited abnormally. (" << e.what() << ")"));
-                    std::terminate();
-                }
-            }
-            else
-            {
-                ++i;
-            }
-        }
-        if (!removedOne)
-            break;
+void CoDispatcher::ReapThread(detail::DetachedThread *thread)
+{
+    if (thread->prev)
+    {
+        thread->prev->next = thread->next;
+    }
+    else
+    {
+        detachedThreads = thread->next;
+    }
+    if (thread->next)
+    {
+        thread->next->prev = thread->prev;
+    }
+    CoTask<> t = std::move(thread->task);
+    delete thread;
+    try
+    {
+        t.GetResult();
+    }
+    catch (const std::exception &e)
+    {
+        Log().Error(SS("Coroutine Thread exited abnormally. (" << e.what() << ")"));
+        std::terminate();
     }
 }
 
 void CoDispatcher::StartThread(CoTask<> &&task)
 {
-    ScavengeTasks();
-    coroutineThreads.insert(coroutineThreads.begin(), std::move(task));
+    ReapCompletedThreads();
+    if (!task.handle)
+    {
+        return;
+    }
+    auto thread = new detail::DetachedThread(std::move(task), this);
+    thread->next = detachedThreads;
+    if (detachedThreads)
+    {
+        detachedThreads->prev = thread;
+    }
+    detachedThreads = thread;
+
+    // The task has already started, and may complete on another thread at any time. If it 
+    // has already completed, reap it now; otherwise its final_suspend queues it on completedThreads.
+    void *expected = nullptr;
+    void *tagged = (void *)(((uintptr_t)thread) | CoTask<>::promise_type::DETACHED_TAG);
+    if (!thread->task.handle.promise().precursor.compare_exchange_strong(expected, tagged, std::memory_order_acq_rel))
+    {
+        ReapThread(thread);
+    }
 }
 
 void CoDispatcher::PostQuit()
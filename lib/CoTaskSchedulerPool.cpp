@@ -24,11 +24,21 @@
 
 #include "CoTaskSchedulerPool.h"
 #include <functional>
+#include <stdexcept>
+#include <algorithm>
 #include "ss.h"
 #include "cotask/Os.h"
 
 using namespace cotask;
 
+// The worker thread (if any) that is running on the current thread.
+static thread_local CoTaskSchedulerThread *tlsCurrentThread = nullptr;
+
+static int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 CoTaskSchedulerPool::CoTaskSchedulerPool(CoDispatcher *pForegroundDispatcher)
     : pForegroundDispatcher(pForegroundDispatcher)
 {
@@ -38,6 +48,9 @@ CoTaskSchedulerPool::CoTaskSchedulerPool(CoDispatcher *pForegroundDispatcher)
     int nThreads = nCpus - 1;
     if (nThreads < 1)
         nThreads = 1;
+    if (nThreads > (int)MAX_THREADS)
+        nThreads = (int)MAX_THREADS;
+    watchdogThread = std::make_unique<std::jthread>([this] { WatchdogProc(); });
     Resize(nThreads);
 }
 CoTaskSchedulerPool::~CoTaskSchedulerPool()
@@ -49,26 +62,36 @@ CoTaskSchedulerPool::~CoTaskSchedulerPool()
 
 void CoTaskSchedulerPool::ScavengeDeadThreads()
 {
-    if (this->deadThreads.size() != 0)
+    // (called on every idle pump, so don't take the lock unless there's something to do.)
+    if (hasDeadThreads.load(std::memory_order_acquire))
     {
-        std::unique_lock lock{threadTerminatedMutex};
-        for (auto thread : deadThreads)
+        std::vector<CoTaskSchedulerThread *> threadsToDelete;
+        {
+            std::unique_lock lock{schedulerMutex};
+            hasDeadThreads = false;
+            threadsToDelete.swap(deadThreads);
+        }
+        for (auto thread : threadsToDelete)
         {
             delete thread;
             Log().Debug("Thread terminated.");
         }
-        deadThreads.resize(0);
     }
 }
 
 void CoTaskSchedulerPool::DestroyAllThreads()
 {
+    this->terminating = true;
+    this->desiredSize = 0;
     {
-        std::unique_lock lock{schedulerMutex};
-        this->terminating = true;
-        this->desiredSize = 0;
+        std::unique_lock lock{parkMutex};
         readyToRun.notify_all();
     }
+    {
+        std::unique_lock lock{watchdogMutex};
+        watchdogCv.notify_all();
+    }
+    watchdogThread.reset(); // (joins.)
 
     while (true)
     {
@@ -89,22 +112,42 @@ void CoTaskSchedulerPool::DestroyAllThreads()
 
 void CoTaskSchedulerPool::Resize(size_t desiredSize)
 {
+    if (desiredSize > MAX_THREADS)
+    {
+        throw std::invalid_argument(SS("Thread pool size can't exceed " << MAX_THREADS << "."));
+    }
     {
         std::unique_lock lock{schedulerMutex};
-        this->desiredSize = desiredSize;
+        this->desiredSize = (int)desiredSize;
         // if a reduction, just wait for threads to check desired size.
         for (size_t i = threads.size(); i < desiredSize; ++i)
         {
+            size_t slot = 0;
+            while (slotInUse[slot])
+            {
+                ++slot;
+            }
+            slotInUse[slot] = true;
+            if (!workerQueues[slot])
+            {
+                workerQueues[slot] = std::make_unique<WorkerQueue>();
+                slotCount.store(slot + 1, std::memory_order_release);
+            }
             ++threadSize;
-            threads.push_back(new CoTaskSchedulerThread(this, pForegroundDispatcher));
+            threads.push_back(new CoTaskSchedulerThread(this, pForegroundDispatcher, slot));
         }
+    }
+    {
+        std::unique_lock lock{parkMutex};
         readyToRun.notify_all();
     }
 }
 
-CoTaskSchedulerThread::CoTaskSchedulerThread(CoTaskSchedulerPool *pool, CoDispatcher *pForegroundDispatcher)
+CoTaskSchedulerThread::CoTaskSchedulerThread(CoTaskSchedulerPool *pool, CoDispatcher *pForegroundDispatcher, size_t slot)
     : pool(pool),
-      pForegroundDispatcher(pForegroundDispatcher)
+      pForegroundDispatcher(pForegroundDispatcher),
+      slot(slot),
+      randomState((uint32_t)(slot * 2654435761u) | 1)
 {
     std::function<void(void)> fn = std::bind(&CoTaskSchedulerThread::ThreadProc, this);
     this->pThread = std::make_unique<std::jthread>(fn);
@@ -116,10 +159,14 @@ void CoTaskSchedulerThread::ThreadProc()
     {
         os::SetThreadBackgroundPriority();
         CoDispatcher::pInstance = (new CoDispatcher(pForegroundDispatcher, this->pool));
+        tlsCurrentThread = this;
         while (true)
         {
             auto h = pool->getOne(this);
+            detail::currentPriority = CoPriority::Normal; // (awaiters that resume here restore their own.)
+            detail::transferDepth = 0;
             h.resume();
+            pForegroundDispatcher->OnWorkCompleted();
         }
     }
     catch (const TerminateException &ignored)
@@ -129,46 +176,385 @@ void CoTaskSchedulerThread::ThreadProc()
     {
         pForegroundDispatcher->Log().Error(SS("Worker thread terminated abnormally. (" << e.what() << ")"));
     }
+    tlsCurrentThread = nullptr;
     pool->OnThreadTerminated(this);
     CoDispatcher::RemoveThreadDispatcher();
 }
 
 void CoTaskSchedulerPool::Post(std::coroutine_handle<> handle)
 {
-    std::unique_lock lock(schedulerMutex);
+    pForegroundDispatcher->outstandingWork.fetch_add(1, std::memory_order_relaxed);
+    CoTaskSchedulerThread *pThread = tlsCurrentThread;
+    if (pThread != nullptr && pThread->pool == this)
+    {
+        // Run it next on this thread; bump the previous occupant of the LIFO slot to the deque.
+        WorkerQueue *queue = workerQueues[pThread->slot].get();
+        queue->lifoPostedAt.store(NowNs(), std::memory_order_relaxed);
+        // (seq_cst: pairs with the watchdog disarming itself, and with workers parking.)
+        void *previous = queue->lifoSlot.exchange(handle.address(), std::memory_order_seq_cst);
+        if (previous == nullptr)
+        {
+            // We'll pick it up when the current handle returns. If the current handle blocks 
+            // instead, the watchdog hands it to a parked worker.
+            if (parkedThreads.load(std::memory_order_seq_cst) != 0 && !watchdogArmed.load(std::memory_order_seq_cst))
+            {
+                ArmWatchdog();
+            }
+            return;
+        }
+        queue->deque.Push(previous);
+    }
+    else
+    {
+        std::unique_lock lock(injectionMutex);
+        injectionQueue.push(handle);
+        ++injectionCount;
+    }
+    // Pairs with the fence in getOne(): either a parking thread sees the new work, or we see the parked thread.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parkedThreads.load(std::memory_order_relaxed) != 0 && searchingThreads.load(std::memory_order_relaxed) == 0)
+    {
+        WakeWorker();
+    }
+}
 
-    handleQueue.push(handle);
+void CoTaskSchedulerPool::WakeWorker()
+{
+    std::unique_lock lock{parkMutex};
     readyToRun.notify_one();
 }
 
+void CoTaskSchedulerPool::ArmWatchdog()
+{
+    if (!watchdogArmed.exchange(true))
+    {
+        std::unique_lock lock{watchdogMutex};
+        watchdogCv.notify_one();
+    }
+}
+
+void CoTaskSchedulerPool::WatchdogProc()
+{
+    std::chrono::nanoseconds period = LIFO_STEAL_DELAY;
+    std::unique_lock lock{watchdogMutex};
+    while (!terminating)
+    {
+        if (!watchdogArmed)
+        {
+            period = LIFO_STEAL_DELAY;
+            watchdogCv.wait(lock);
+            continue;
+        }
+        watchdogCv.wait_for(lock, period);
+        if (terminating)
+        {
+            break;
+        }
+        lock.unlock(); // (WakeWorker() takes parkMutex, which is held while arming.)
+
+        int64_t now = NowNs();
+        bool hasLifoWork = false;
+        bool hasStaleLifoWork = false;
+        size_t n = slotCount.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; ++i)
+        {
+            WorkerQueue *queue = workerQueues[i].get();
+            if (queue->lifoSlot.load(std::memory_order_seq_cst) != nullptr)
+            {
+                hasLifoWork = true;
+                if (now - queue->lifoPostedAt.load(std::memory_order_relaxed) >= LIFO_STEAL_DELAY.count())
+                {
+                    hasStaleLifoWork = true;
+                }
+            }
+        }
+        if (hasStaleLifoWork)
+        {
+            if (parkedThreads.load() != 0)
+            {
+                WakeWorker(); // it will steal the stale handle.
+            }
+            period = LIFO_STEAL_DELAY;
+        }
+        else if (hasLifoWork)
+        {
+            // the owners are keeping up. Check less often.
+            period = std::min(period * 2, WATCHDOG_MAX_PERIOD);
+        }
+        else
+        {
+            watchdogArmed = false;
+            if (HasLifoWork())
+            {
+                watchdogArmed = true; // a Post() saw us armed while we were scanning.
+            }
+        }
+        lock.lock();
+    }
+}
+
+bool CoTaskSchedulerPool::ShouldTerminate()
+{
+    if (terminating)
+    {
+        --threadSize;
+        return true;
+    }
+    int size = threadSize.load();
+    while (size > desiredSize.load())
+    {
+        if (threadSize.compare_exchange_weak(size, size - 1))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::coroutine_handle<> CoTaskSchedulerPool::PopInjected()
+{
+    if (injectionCount.load(std::memory_order_relaxed) == 0)
+    {
+        return nullptr;
+    }
+    std::unique_lock lock(injectionMutex);
+    if (injectionQueue.empty())
+    {
+        return nullptr;
+    }
+    --injectionCount;
+    return injectionQueue.pop();
+}
+
+std::coroutine_handle<> CoTaskSchedulerPool::Steal(CoTaskSchedulerThread *pThread)
+{
+    size_t n = slotCount.load(std::memory_order_acquire);
+    if (n <= 1)
+    {
+        return nullptr;
+    }
+    // xorshift32
+    uint32_t x = pThread->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pThread->randomState = x;
+
+    size_t start = x % n;
+    int64_t now = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t victim = start + i;
+        if (victim >= n)
+        {
+            victim -= n;
+        }
+        if (victim == pThread->slot)
+        {
+            continue;
+        }
+        WorkerQueue *queue = workerQueues[victim].get();
+        while (queue->deque.SizeHint() != 0)
+        {
+            void *address = queue->deque.Steal();
+            if (address != nullptr)
+            {
+                return std::coroutine_handle<>::from_address(address);
+            }
+        }
+        if (queue->lifoSlot.load(std::memory_order_relaxed) != nullptr)
+        {
+            if (now == 0)
+            {
+                now = NowNs();
+            }
+            std::coroutine_handle<> result = StealLifo(queue, now);
+            if (result)
+            {
+                return result;
+            }
+        }
+    }
+    return nullptr;
+}
+
+std::coroutine_handle<> CoTaskSchedulerPool::StealLifo(WorkerQueue *queue, int64_t now)
+{
+    void *address = queue->lifoSlot.load(std::memory_order_acquire);
+    if (address == nullptr)
+    {
+        return nullptr;
+    }
+    if (now - queue->lifoPostedAt.load(std::memory_order_relaxed) < LIFO_STEAL_DELAY.count())
+    {
+        return nullptr; // the owner will probably get to it before we do.
+    }
+    if (!queue->lifoSlot.compare_exchange_strong(address, nullptr, std::memory_order_acq_rel))
+    {
+        return nullptr;
+    }
+    return std::coroutine_handle<>::from_address(address);
+}
+
+std::coroutine_handle<> CoTaskSchedulerPool::FindWork(CoTaskSchedulerThread *pThread)
+{
+    std::coroutine_handle<> result;
+    if (++pThread->dispatchCount % INJECTION_CHECK_INTERVAL == 0)
+    {
+        result = PopInjected();
+        if (result)
+        {
+            return result;
+        }
+    }
+    WorkerQueue *queue = workerQueues[pThread->slot].get();
+    if (queue->lifoSlot.load(std::memory_order_relaxed) != nullptr)
+    {
+        void *address = queue->lifoSlot.exchange(nullptr, std::memory_order_acquire);
+        if (address != nullptr)
+        {
+            if (pThread->lifoRuns < MAX_LIFO_RUNS)
+            {
+                ++pThread->lifoRuns;
+                return std::coroutine_handle<>::from_address(address);
+            }
+            queue->deque.Push(address); // give the rest of the deque a turn.
+        }
+    }
+    pThread->lifoRuns = 0;
+
+    // Take from the top of our own deque, so that handles run in the order they were posted.
+    while (queue->deque.SizeHint() != 0)
+    {
+        void *address = queue->deque.Steal();
+        if (address != nullptr)
+        {
+            return std::coroutine_handle<>::from_address(address);
+        }
+    }
+    result = PopInjected();
+    if (result)
+    {
+        return result;
+    }
+    return Steal(pThread);
+}
+
+bool CoTaskSchedulerPool::HasWork()
+{
+    if (injectionCount.load() != 0)
+    {
+        return true;
+    }
+    size_t n = slotCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (workerQueues[i]->deque.SizeHint() != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CoTaskSchedulerPool::HasLifoWork()
+{
+    size_t n = slotCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (workerQueues[i]->lifoSlot.load() != nullptr)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 std::coroutine_handle<> CoTaskSchedulerPool::getOne(CoTaskSchedulerThread *pThread)
 {
-    std::unique_lock lock(schedulerMutex);
-    pThread->isRunning = false; // done here, because operation has to be atomic under the schedulerMutex.
+    bool searching = false; // true if we were woken, and are counted in searchingThreads.
 
     while (true)
     {
-        if (this->terminating)
+        if (ShouldTerminate())
         {
-            --threadSize;
+            if (searching)
+            {
+                --searchingThreads;
+            }
             throw TerminateException();
         }
-        if (this->desiredSize < this->threadSize)
+        std::coroutine_handle<> result = FindWork(pThread);
+        if (result)
         {
-            --threadSize;
+            // If we were the last searching thread, and there's more work, pass the baton.
+            if (searching && searchingThreads.fetch_sub(1) == 1 && parkedThreads.load() != 0 && HasWork())
+            {
+                WakeWorker();
+            }
+            return result;
+        }
+
+        std::unique_lock lock(parkMutex);
+        ++parkedThreads;
+        if (searching)
+        {
+            --searchingThreads;
+            searching = false;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (HasWork())
+        {
+            --parkedThreads;
+            continue;
+        }
+        if (ShouldTerminate())
+        {
+            --parkedThreads;
             throw TerminateException();
         }
-        if (!handleQueue.empty())
+        if (HasLifoWork())
         {
-            pThread->isRunning = true;
-            return handleQueue.pop();
+            // Another thread's LIFO slot may become stealable if its owner is busy. The watchdog 
+            // wakes us if it does.
+            ArmWatchdog();
         }
         readyToRun.wait(lock);
+        --parkedThreads;
+        ++searchingThreads;
+        searching = true;
     }
 }
 
 void CoTaskSchedulerPool::OnThreadTerminated(CoTaskSchedulerThread *thread)
 {
+    // hand any work left in our queue to the other threads.
+    WorkerQueue *queue = workerQueues[thread->slot].get();
+    bool postedWork = false;
+    while (true)
+    {
+        void *address = queue->lifoSlot.exchange(nullptr);
+        if (address == nullptr)
+        {
+            if (queue->deque.SizeHint() == 0)
+            {
+                break;
+            }
+            address = queue->deque.Steal();
+        }
+        if (address != nullptr)
+        {
+            std::unique_lock lock(injectionMutex);
+            injectionQueue.push(std::coroutine_handle<>::from_address(address));
+            ++injectionCount;
+            postedWork = true;
+        }
+    }
+    if (postedWork)
+    {
+        WakeWorker();
+    }
+
     bool found = false;
     {
         std::unique_lock lock{schedulerMutex};
@@ -178,6 +564,7 @@ void CoTaskSchedulerPool::OnThreadTerminated(CoTaskSchedulerThread *thread)
             {
                 found = true;
                 threads.erase(i);
+                slotInUse[thread->slot] = false;
                 Log().Debug("Thread terminating.");
                 break;
             }
@@ -185,20 +572,8 @@ void CoTaskSchedulerPool::OnThreadTerminated(CoTaskSchedulerThread *thread)
         if (found)
         {
             deadThreads.push_back(thread); // for cleanup.
+            hasDeadThreads = true;
             threadTerminatedCv.notify_one();
         }
     }
 }
-bool CoTaskSchedulerPool::IsDone()
-{
-    std::unique_lock lock{schedulerMutex};
-
-    if (!handleQueue.empty())
-        return false;
-    for (auto thread : threads)
-    {
-        if (thread->isRunning)
-            return false;
-    }
-    return true;
-}
@@ -24,10 +24,14 @@
 
 #pragma once
 #include "cotask/CoTask.h"
+#include "WorkStealingDeque.h"
 #include <thread>
 #include <exception>
 #include <coroutine>
 #include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <chrono>
 
 #ifndef DOXYGEN
 namespace cotask
@@ -47,17 +51,41 @@ namespace cotask
     {
         friend class CoTaskSchedulerPool;
 
-        CoTaskSchedulerThread(CoTaskSchedulerPool *pool, CoDispatcher *pForegroundDispatcher);
+        CoTaskSchedulerThread(CoTaskSchedulerPool *pool, CoDispatcher *pForegroundDispatcher, size_t slot);
         
 
         void ThreadProc();
 
     private:
-        bool isRunning = false;
         CoTaskSchedulerPool *pool;
         CoDispatcher *pForegroundDispatcher;
+        size_t slot;
+        uint32_t randomState;
+        uint32_t dispatchCount = 0;
+        uint32_t lifoRuns = 0; // consecutive handles taken from the LIFO slot.
         std::unique_ptr<std::jthread> pThread;
     };
+
+    /**
+     * @brief Work-stealing thread pool for background coroutines.
+     * 
+     * Each worker thread owns a WorkerQueue. A handle posted from a worker thread goes into that 
+     * worker's LIFO slot, so that it runs next on the same thread, while the data it uses is still 
+     * in cache. Whatever was in the LIFO slot is moved onto the worker's deque. Handles posted from 
+     * any other thread go onto a shared injection queue. 
+     * 
+     * Idle workers take work from their own LIFO slot, then their own deque, then the injection 
+     * queue, then steal from other workers' deques (starting at a random victim). A LIFO slot 
+     * can only be stolen once its handle has waited longer than LIFO_STEAL_DELAY (i.e. the owning 
+     * thread is busy with a long-running task). Workers that find no work park on a condition 
+     * variable; Post() only signals the condition variable if there are parked workers, and no 
+     * worker is already out looking for work. 
+     * 
+     * Filling an empty LIFO slot doesn't wake anyone. Instead, if workers are parked, it arms a 
+     * watchdog thread, which wakes a parked worker once a LIFO slot goes stale. The watchdog backs 
+     * off to WATCHDOG_MAX_PERIOD while LIFO slots keep being refilled, and disarms itself once 
+     * all LIFO slots are empty.
+     */
     class CoTaskSchedulerPool
     {
         friend class CoDispatcher;
@@ -69,33 +97,79 @@ namespace cotask
         std::coroutine_handle<> getOne(CoTaskSchedulerThread *pThread);
 
         void Resize(size_t threads);
-        bool IsDone();
         void Post(std::coroutine_handle<> handle);
         void ScavengeDeadThreads();
     private:
-        int runningTasks = 0;
+        static constexpr size_t MAX_THREADS = 256;
+        // how often a worker checks the injection queue before its own deque, so that work posted
+        // from outside the pool can't be starved by workers that keep reposting.
+        static constexpr uint32_t INJECTION_CHECK_INTERVAL = 61;
+        // how many handles in a row a worker takes from its LIFO slot before servicing its deque, so
+        // that two tasks that keep resuming each other can't starve the rest of the deque.
+        static constexpr uint32_t MAX_LIFO_RUNS = 3;
+        // how long a handle waits in a busy worker's LIFO slot before other workers may steal it.
+        static constexpr std::chrono::nanoseconds LIFO_STEAL_DELAY = std::chrono::microseconds(50);
+        // the longest the armed watchdog sleeps between checks for stale LIFO slots.
+        static constexpr std::chrono::nanoseconds WATCHDOG_MAX_PERIOD = std::chrono::milliseconds(10);
+
+        struct WorkerQueue
+        {
+            WorkStealingDeque deque;
+            std::atomic<void *> lifoSlot = nullptr;
+            std::atomic<int64_t> lifoPostedAt = 0; // steady_clock nanoseconds.
+        };
+
         CoDispatcher *pForegroundDispatcher = nullptr;
-        bool terminating = false;
+        std::atomic<bool> terminating = false;
 
-        int desiredSize = 0;
-        int threadSize = 0; // differs from thread.size() while a thread is in the process of terminating.
+        std::atomic<int> desiredSize = 0;
+        std::atomic<int> threadSize = 0; // differs from thread.size() while a thread is in the process of terminating.
         std::vector<CoTaskSchedulerThread *> threads;
         std::vector<CoTaskSchedulerThread *> deadThreads;
+        std::atomic<bool> hasDeadThreads = false;
         void DestroyAllThreads();
     
         ILog &Log() const { return pForegroundDispatcher->Log(); }
 
-
+        std::coroutine_handle<> FindWork(CoTaskSchedulerThread *pThread);
+        std::coroutine_handle<> PopInjected();
+        std::coroutine_handle<> Steal(CoTaskSchedulerThread *pThread);
+        std::coroutine_handle<> StealLifo(WorkerQueue *queue, int64_t now);
+        bool HasWork();
+        bool HasLifoWork();
+        bool ShouldTerminate();
+        void WakeWorker();
+        void ArmWatchdog();
+        void WatchdogProc();
+
+        // protects threads, deadThreads, slotInUse.
         std::mutex schedulerMutex;
+
+        // WorkerQueues outlive the threads that own them (a thief may be reading a queue while its owner 
+        // exits), and are reused by later threads that get the same slot.
+        std::unique_ptr<WorkerQueue> workerQueues[MAX_THREADS];
+        bool slotInUse[MAX_THREADS] = {};
+        std::atomic<size_t> slotCount = 0;
+
+        std::mutex injectionMutex;
+        Fifo<std::coroutine_handle<>> injectionQueue;
+        std::atomic<size_t> injectionCount = 0;
+
+        std::mutex parkMutex;
         std::condition_variable readyToRun;
+        std::atomic<int> parkedThreads = 0;
+        std::atomic<int> searchingThreads = 0;
+
+        std::mutex watchdogMutex;
+        std::condition_variable watchdogCv;
+        std::atomic<bool> watchdogArmed = false;
+        std::unique_ptr<std::jthread> watchdogThread;
 
         void OnThreadTerminated(CoTaskSchedulerThread*thread);
 
-        std::mutex threadTerminatedMutex;
         std::condition_variable threadTerminatedCv;
-        Fifo<std::coroutine_handle<>> handleQueue;
     };
 
 } // namespace
 
-#endif
\ No newline at end of file
+#endif
@@ -25,12 +25,31 @@
 // See if we can get the simplest of coroutine examples to work on Gcc 10.
 
 #include "cotask/CoTask.h"
+#include "cotask/TimerQueue.h"
+#include "cotask/MpscQueue.h"
+#include "cotask/Fifo.h"
+#include "cotask/CoCombinators.h"
+#include "cotask/CoCancellation.h"
+#include "cotask/CoFile.h"
+#include "cotask/LazyTask.h"
+#include "cotask/AsyncGenerator.h"
+#include "WorkStealingDeque.h"
 
 #include <iostream>
 #include <chrono>
 #include <thread>
 #include <exception>
 #include <cassert>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <pthread.h>
+#include <sched.h>
 
 using namespace cotask;
 using namespace std;
@@ -72,7 +91,7 @@ CoTask<> DelayTask1()
     cout << "Exit Task1" << endl;
 
     auto elapsed = CoDispatcher::Now() - startMs;
-    assert(elapsed.count() >= 3000);
+    assert(elapsed >= 3000ms);
     assert(checkPoints == 4);
     co_return;
 }
@@ -233,6 +252,90 @@ void TestThreadPoolSizing()
 
     CoDispatcher::DestroyDispatcher();
 }
+/** BackgroundFairnessTest *************************************/
+// A continuation posted from a pool thread runs next on the same thread (the LIFO slot), but
+// a task that keeps reposting itself mustn't starve other work on the thread's queue.
+
+static std::atomic<bool> fairnessFlag;
+
+CoTask<> FairnessSetter()
+{
+    co_await CoBackground();
+    fairnessFlag = true;
+}
+
+CoTask<> FairnessSpinner()
+{
+    co_await CoBackground();
+    int spins = 0;
+    while (!fairnessFlag)
+    {
+        ++spins;
+        assert(spins < 1000); // Setter never ran.
+        co_await CoBackground();
+    }
+}
+
+CoTask<> FairnessProc()
+{
+    co_await CoBackground();
+    // Setter lands in the LIFO slot; Spinner then bumps it to the deque.
+    CoTask<> setter = FairnessSetter();
+    CoTask<> spinner = FairnessSpinner();
+    co_await setter;
+    co_await spinner;
+}
+
+void BackgroundFairnessTest()
+{
+    cout << "--- BackgroundFairnessTest" << endl;
+    fairnessFlag = false;
+    CoDispatcher::CurrentDispatcher().SetThreadPoolSize(1);
+    CoTask<> task = FairnessProc();
+    task.GetResult();
+    assert(fairnessFlag);
+    CoDispatcher::DestroyDispatcher();
+}
+
+static std::atomic<bool> lifoStealRan;
+static std::thread::id lifoStealThread;
+
+CoTask<> LifoStealContinuation()
+{
+    co_await CoBackground(); // lands in the current worker's LIFO slot.
+    lifoStealThread = std::this_thread::get_id();
+    lifoStealRan = true;
+}
+
+CoTask<> LifoStealProc()
+{
+    co_await CoBackground();
+    std::this_thread::sleep_for(10ms); // let the other workers park.
+    std::thread::id owner = std::this_thread::get_id();
+    CoTask<> continuation = LifoStealContinuation();
+
+    // Block the owning worker; another worker has to steal the continuation.
+    auto deadline = std::chrono::steady_clock::now() + 5s;
+    while (!lifoStealRan && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(1ms);
+    }
+    assert(lifoStealRan);
+    co_await continuation;
+    assert(lifoStealThread != owner);
+    (void)owner;
+}
+
+void BackgroundLifoStealTest()
+{
+    cout << "--- BackgroundLifoStealTest" << endl;
+    lifoStealRan = false;
+    CoDispatcher::CurrentDispatcher().SetThreadPoolSize(4);
+    CoTask<> task = LifoStealProc();
+    task.GetResult();
+    CoDispatcher::DestroyDispatcher();
+}
+
 /** VoidTest *************************************/
 
 CoTask<> VoidTask1()
@@ -364,11 +467,1344 @@ void CatchTest()
     }
 }
 /***************************************/
+
+void TimerQueueTest()
+{
+    cout << "------ TimerQueueTest -----" << endl;
+
+    // check ordering and cancellation against a reference implementation.
+    TimerQueue timerQueue;
+    std::multimap<std::pair<int64_t, uint64_t>, int> reference;
+    std::map<int, std::pair<TimerQueue::TimerHandle, std::pair<int64_t, uint64_t>>> pending;
+    std::mt19937 random(1234);
+    uint64_t sequence = 0;
+    int fired = -1;
+
+    for (int i = 0; i < 20000; ++i)
+    {
+        int op = random() % 3;
+        if (op != 0 || pending.empty())
+        {
+            int64_t time = random() % 100;
+            TimerQueue::TimerHandle handle = timerQueue.Insert(std::chrono::milliseconds(time), [i, &fired]() { fired = i; });
+            assert(handle != 0);
+            auto key = std::make_pair(time, sequence++);
+            reference.insert(std::make_pair(key, i));
+            pending[i] = std::make_pair(handle, key);
+        }
+        else
+        {
+            auto victim = pending.begin();
+            std::advance(victim, random() % pending.size());
+            bool cancelled = timerQueue.Cancel(victim->second.first);
+            assert(cancelled);
+            cancelled = timerQueue.Cancel(victim->second.first);
+            assert(!cancelled); // second cancel fails.
+            (void)cancelled;
+            reference.erase(reference.find(victim->second.second));
+            pending.erase(victim);
+        }
+        assert(timerQueue.size() == reference.size());
+        if (!reference.empty())
+        {
+            assert(timerQueue.NextTime() == std::chrono::milliseconds(reference.begin()->first.first));
+        }
+    }
+    while (!reference.empty())
+    {
+        TimerQueue::Timer timer;
+        bool popped = timerQueue.PopExpired(std::chrono::milliseconds(100), &timer);
+        assert(popped);
+        (void)popped;
+        timer.Fire();
+        int expected = reference.begin()->second;
+        assert(fired == expected);
+        (void)expected;
+        bool cancelled = timerQueue.Cancel(pending[expected].first);
+        assert(!cancelled); // stale handle.
+        (void)cancelled;
+        reference.erase(reference.begin());
+    }
+    assert(timerQueue.empty());
+
+    // expired only.
+    timerQueue.Insert(std::chrono::milliseconds(10), []() {});
+    TimerQueue::Timer timer;
+    bool popped = timerQueue.PopExpired(std::chrono::milliseconds(9), &timer);
+    assert(!popped);
+    popped = timerQueue.PopExpired(std::chrono::milliseconds(10), &timer);
+    assert(popped);
+    (void)popped;
+}
+
+/***************************************/
+
+CoTask<int> FrameTask(int value)
+{
+    co_return value;
+}
+
+CoTask<int> BigFrameTask(int value)
+{
+    char buffer[CoFrameAllocator::MAX_SIZE_CLASS * 2];
+    co_await CoDelay(0ms);
+    snprintf(buffer, sizeof(buffer), "%d", value);
+    co_return atoi(buffer);
+}
+
+void FrameAllocatorTest()
+{
+    cout << "------ FrameAllocatorTest -----" << endl;
+    // warm up this thread's free list.
+    {
+        CoTask<int> task = FrameTask(0);
+    }
+    auto before = CoFrameAllocator::GetStatistics();
+    for (int i = 0; i < 1000; ++i)
+    {
+        CoTask<int> task = FrameTask(i);
+        int result = task.GetResult();
+        assert(result == i);
+        (void)result;
+    }
+    auto after = CoFrameAllocator::GetStatistics();
+    if (CoFrameAllocator::POOLED)
+    {
+        assert(after.hits - before.hits >= 1000);
+        assert(after.misses == before.misses);
+    }
+
+    // Frames allocated on another thread, and freed here, both while the thread is running, 
+    // and after it has exited.
+    constexpr size_t N_TASKS = 100;
+    std::vector<CoTask<int>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool allocated = false;
+    bool freed = false;
+    std::thread thread([&]() {
+        std::vector<CoTask<int>> myTasks;
+        for (size_t i = 0; i < 2 * N_TASKS; ++i)
+        {
+            myTasks.push_back(FrameTask((int)i));
+        }
+        std::unique_lock lock{mutex};
+        tasks = std::move(myTasks);
+        allocated = true;
+        cv.notify_all();
+        cv.wait(lock, [&]() { return freed; });
+        // reuse the blocks we got back.
+        for (size_t i = 0; i < N_TASKS; ++i)
+        {
+            FrameTask((int)i).GetResult();
+        }
+    });
+    {
+        std::unique_lock lock{mutex};
+        cv.wait(lock, [&]() { return allocated; });
+        tasks.erase(tasks.begin() + N_TASKS, tasks.end());
+        freed = true;
+        cv.notify_all();
+    }
+    thread.join();
+    auto remote = CoFrameAllocator::GetStatistics();
+    {
+        CoTask<int> task = BigFrameTask(7);
+        int result = task.GetResult();
+        assert(result == 7);
+        (void)result;
+    }
+    if (CoFrameAllocator::POOLED)
+    {
+        assert(CoFrameAllocator::GetStatistics().oversize - remote.oversize == 1);
+        assert(remote.remoteFrees - after.remoteFrees == N_TASKS);
+        assert(remote.misses - after.misses == 2 * N_TASKS);
+    }
+    tasks.clear(); // the owning thread has exited.
+    assert(!CoFrameAllocator::POOLED || CoFrameAllocator::GetStatistics().remoteFrees - after.remoteFrees == 2 * N_TASKS);
+    (void)before;
+    (void)after;
+
+    cout << "    hits: " << remote.hits << " misses: " << remote.misses
+         << " remote frees: " << remote.remoteFrees << " oversize: " << remote.oversize << endl;
+}
+
+/***************************************/
+
+void FifoTest()
+{
+    cout << "------ FifoTest -----" << endl;
+    {
+        // randomized comparison against std::deque, with wrapping and growth.
+        Fifo<int> fifo(4);
+        std::deque<int> reference;
+        std::mt19937 random(17);
+        for (int i = 0; i < 100000; ++i)
+        {
+            int op = random() % 8;
+            if (op < 4 || reference.empty())
+            {
+                fifo.push(i);
+                reference.push_back(i);
+            }
+            else if (op < 7)
+            {
+                int value = fifo.pop();
+                assert(value == reference.front());
+                (void)value;
+                reference.pop_front();
+            }
+            else
+            {
+                size_t index = random() % reference.size();
+                fifo.erase(index);
+                reference.erase(reference.begin() + index);
+            }
+            assert(fifo.size() == reference.size());
+            if (!reference.empty())
+            {
+                size_t index = random() % reference.size();
+                assert(fifo[index] == reference[index]);
+                assert(fifo.front() == reference.front());
+                assert(fifo.back() == reference.back());
+                (void)index;
+            }
+        }
+        assert((fifo.capacity() & (fifo.capacity() - 1)) == 0);
+        bool threw = false;
+        try
+        {
+            fifo[fifo.size()];
+        }
+        catch (const std::out_of_range &)
+        {
+            threw = true;
+        }
+        assert(threw);
+    }
+    {
+        // move-only elements; growth while wrapped.
+        Fifo<std::unique_ptr<std::string>> fifo(4);
+        for (int i = 0; i < 3; ++i)
+        {
+            fifo.push(std::make_unique<std::string>(std::to_string(i)));
+        }
+        fifo.pop();
+        fifo.pop();
+        for (int i = 3; i < 20; ++i)
+        {
+            fifo.emplace(new std::string(std::to_string(i)));
+        }
+        for (int i = 2; i < 20; ++i)
+        {
+            auto value = fifo.pop();
+            assert(*value == std::to_string(i));
+        }
+        assert(fifo.empty());
+        Fifo<std::unique_ptr<std::string>> moved{std::move(fifo)};
+        moved.push(std::make_unique<std::string>("x"));
+        assert(moved.size() == 1);
+
+        // moved-from Fifos are empty, and usable.
+        assert(fifo.empty() && fifo.capacity() == 0);
+        for (int i = 0; i < 5; ++i)
+        {
+            fifo.push(std::make_unique<std::string>(std::to_string(i)));
+        }
+        moved = std::move(fifo);
+        fifo.emplace(new std::string("y"));
+        assert(fifo.size() == 1 && *fifo.front() == "y");
+        for (int i = 0; i < 5; ++i)
+        {
+            auto value = moved.pop();
+            assert(*value == std::to_string(i));
+        }
+    }
+    {
+        // moved-from Fifos of trivially copyable elements (which grow with realloc).
+        Fifo<int> fifo(4);
+        fifo.push(1);
+        Fifo<int> moved{std::move(fifo)};
+        for (int i = 0; i < 10; ++i)
+        {
+            fifo.push(i);
+        }
+        for (int i = 0; i < 10; ++i)
+        {
+            int value = fifo.pop();
+            assert(value == i);
+            (void)value;
+        }
+        int first = moved.pop();
+        assert(first == 1);
+        (void)first;
+    }
+    {
+        // fixed capacity: backpressure.
+        Fifo<std::string> fifo(8, 8);
+        bool pushed = true;
+        for (int i = 0; i < 8; ++i)
+        {
+            pushed = pushed && fifo.try_push(std::to_string(i));
+        }
+        assert(pushed);
+        assert(fifo.full());
+        pushed = fifo.try_push("overflow");
+        assert(!pushed);
+        bool threw = false;
+        try
+        {
+            fifo.push("overflow");
+        }
+        catch (const std::length_error &)
+        {
+            threw = true;
+        }
+        assert(threw);
+        assert(fifo.capacity() == 8);
+        std::string value = fifo.pop();
+        assert(value == "0");
+        pushed = fifo.try_push("8");
+        assert(pushed);
+        (void)pushed;
+        Fifo<std::string> copy{fifo};
+        for (int i = 1; i <= 8; ++i)
+        {
+            value = copy.pop();
+            assert(value == std::to_string(i));
+        }
+        assert(fifo.size() == 8);
+    }
+}
+
+/***************************************/
+
+void MpscQueueTest()
+{
+    cout << "------ MpscQueueTest -----" << endl;
+    // small ring, so that producers overflow.
+    constexpr size_t PRODUCERS = 4;
+    constexpr uint32_t ITEMS = 20000;
+    MpscQueue<uint64_t> queue(16);
+
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < PRODUCERS; ++p)
+    {
+        producers.emplace_back([&queue, p]() {
+            for (uint32_t i = 0; i < ITEMS; ++i)
+            {
+                queue.push(((uint64_t)p << 32) | i);
+            }
+        });
+    }
+    uint32_t expected[PRODUCERS] = {};
+    size_t received = 0;
+    while (received < PRODUCERS * ITEMS)
+    {
+        uint64_t value;
+        if (queue.pop(&value))
+        {
+            size_t p = value >> 32;
+            assert(p < PRODUCERS);
+            assert((uint32_t)value == expected[p]); // in order, per producer.
+            ++expected[p];
+            ++received;
+        }
+    }
+    for (auto &thread : producers)
+    {
+        thread.join();
+    }
+    assert(queue.empty());
+}
+
+void WorkStealingDequeTest()
+{
+    cout << "------ WorkStealingDequeTest -----" << endl;
+    // small initial buffer, so that the deque grows while thieves are reading it.
+    constexpr size_t THIEVES = 3;
+    constexpr size_t ITEMS = 200000;
+    WorkStealingDeque deque(4);
+    std::unique_ptr<std::atomic<uint32_t>[]> delivered(new std::atomic<uint32_t>[ITEMS]);
+    for (size_t i = 0; i < ITEMS; ++i)
+    {
+        delivered[i] = 0;
+    }
+    std::atomic<size_t> received = 0;
+    auto deliver = [&](void *item) {
+        size_t index = (size_t)(uintptr_t)item - 1;
+        assert(index < ITEMS);
+        ++delivered[index];
+        ++received;
+    };
+
+    std::vector<std::thread> thieves;
+    for (size_t i = 0; i < THIEVES; ++i)
+    {
+        thieves.emplace_back([&]() {
+            while (received.load() < ITEMS)
+            {
+                void *item = deque.Steal();
+                if (item != nullptr)
+                {
+                    deliver(item);
+                }
+            }
+        });
+    }
+    // the owner pushes, and takes from its own deque the way a pool worker does.
+    for (size_t i = 0; i < ITEMS; ++i)
+    {
+        deque.Push((void *)(uintptr_t)(i + 1));
+        if (i % 3 == 0)
+        {
+            void *item = deque.Steal();
+            if (item != nullptr)
+            {
+                deliver(item);
+            }
+        }
+    }
+    for (auto &thread : thieves)
+    {
+        thread.join();
+    }
+    assert(received.load() == ITEMS);
+    for (size_t i = 0; i < ITEMS; ++i)
+    {
+        assert(delivered[i].load() == 1);
+    }
+    assert(deque.SizeHint() == 0);
+    assert(deque.Steal() == nullptr);
+}
+
+/***************************************/
+
+static constexpr size_t JITTER_POSTS = 2000;
+static std::coroutine_handle<> jitterHandles[JITTER_POSTS];
+static size_t jitterResumeOrder[JITTER_POSTS];
+static std::atomic<size_t> jitterResumed;
+
+struct JitterAwaiter
+{
+    std::coroutine_handle<> *pHandle;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept { *pHandle = handle; }
+    void await_resume() const noexcept {}
+};
+
+CoTask<> JitterNotification(size_t index)
+{
+    co_await JitterAwaiter{&jitterHandles[index]};
+    jitterResumeOrder[jitterResumed++] = index;
+}
+
+// Post() from a realtime (SCHED_FIFO) thread, the way an audio thread would post notifications.
+// Post() must never block, even when it has to wake the foreground thread.
+void PostJitterTest()
+{
+    cout << "------ PostJitterTest -----" << endl;
+    CoDispatcher &dispatcher = CoDispatcher::CurrentDispatcher();
+    jitterResumed = 0;
+    std::vector<CoTask<>> tasks;
+    for (size_t i = 0; i < JITTER_POSTS; ++i)
+    {
+        tasks.push_back(JitterNotification(i));
+    }
+
+    std::vector<int64_t> postTimesNs;
+    postTimesNs.reserve(JITTER_POSTS);
+    bool realtime = false;
+    std::thread rtThread([&]() {
+        sched_param param{};
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+        realtime = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+
+        // 16 posts every 250us, like an audio callback.
+        for (size_t i = 0; i < JITTER_POSTS; ++i)
+        {
+            auto startTime = std::chrono::steady_clock::now();
+            CoDispatcher::ForegroundDispatcher().Post(jitterHandles[i]);
+            postTimesNs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count());
+            if (i % 16 == 15)
+            {
+                std::this_thread::sleep_for(250us);
+            }
+        }
+    });
+    while (jitterResumed < JITTER_POSTS)
+    {
+        dispatcher.PumpMessages(10000ms);
+    }
+    rtThread.join();
+    if (!realtime)
+    {
+        cout << "    (SCHED_FIFO not permitted. Posting from a normal-priority thread.)" << endl;
+    }
+
+    for (size_t i = 0; i < JITTER_POSTS; ++i)
+    {
+        assert(jitterResumeOrder[i] == i);
+    }
+    std::sort(postTimesNs.begin(), postTimesNs.end());
+    cout << "    Post() time (ns) median: " << postTimesNs[postTimesNs.size() / 2]
+         << " p99: " << postTimesNs[postTimesNs.size() * 99 / 100]
+         << " max: " << postTimesNs.back()
+         << endl;
+    assert(postTimesNs.back() < 50 * 1000 * 1000); // (generous: a normal-priority thread can be preempted.)
+    tasks.clear();
+    CoDispatcher::DestroyDispatcher();
+}
+
+/***************************************/
+
+CoTask<bool> CoTimerTask(CoTimer &timer, std::chrono::milliseconds delay)
+{
+    co_return co_await timer.Delay(delay);
+}
+
+void CoTimerTest()
+{
+    cout << "------ CoTimerTest -----" << endl;
+    CoDispatcher &dispatcher = CoDispatcher::CurrentDispatcher();
+    {
+        CoTimer timer;
+        bool result = CoTimerTask(timer, 10ms).GetResult();
+        assert(result == true);
+        (void)result;
+    }
+    {
+        CoTimer timer;
+        auto startTime = dispatcher.Now();
+        CoTask<bool> task = CoTimerTask(timer, 60000ms);
+        dispatcher.PostDelayedFunction(100ms, [&timer]() { timer.Cancel(); });
+        bool result = task.GetResult();
+        assert(result == false);
+        assert(dispatcher.Now() - startTime < 10000ms);
+        assert(dispatcher.IsDone()); // no dead timer left behind.
+
+        // sticky.
+        result = CoTimerTask(timer, 60000ms).GetResult();
+        assert(result == false);
+        (void)result;
+        (void)startTime;
+    }
+}
+
+/***************************************/
+
+CoTask<> TimerLatenessTask(std::vector<CoDispatcher::Duration> *pLateness)
+{
+    for (int i = 0; i < 50; ++i)
+    {
+        auto delay = std::chrono::duration_cast<CoDispatcher::Duration>(std::chrono::microseconds(100 + 37 * (i % 10)));
+        auto startTime = CoClock::now();
+        co_await CoDelay(delay);
+        pLateness->push_back(std::chrono::duration_cast<CoDispatcher::Duration>(CoClock::now() - startTime) - delay);
+    }
+}
+
+// I/O timeouts share the timer queue with CoDelay(), and must not be rounded up to whole milliseconds.
+CoTask<> ReadTimeoutLatenessTask(std::vector<CoDispatcher::Duration> *pLateness)
+{
+    std::unique_ptr<CoFile> reader;
+    std::unique_ptr<CoFile> writer;
+    CoFile::CreateSocketPair(&reader, &writer);
+
+    char buffer[16];
+    for (int i = 0; i < 20; ++i)
+    {
+        auto timeout = std::chrono::duration_cast<CoDispatcher::Duration>(std::chrono::microseconds(300 + 37 * (i % 10)));
+        auto startTime = CoClock::now();
+        CoResult<size_t> result = co_await reader->TryRead(buffer, sizeof(buffer), timeout);
+        assert(result.status == CoStatus::TimedOut);
+        (void)result;
+        pLateness->push_back(std::chrono::duration_cast<CoDispatcher::Duration>(CoClock::now() - startTime) - timeout);
+    }
+}
+
+void TimerLatenessTest()
+{
+    cout << "------ TimerLatenessTest -----" << endl;
+
+    std::vector<CoDispatcher::Duration> lateness;
+    TimerLatenessTask(&lateness).GetResult();
+
+    std::sort(lateness.begin(), lateness.end());
+    cout << "    lateness (us) min: " << std::chrono::duration_cast<std::chrono::microseconds>(lateness.front()).count()
+         << " median: " << std::chrono::duration_cast<std::chrono::microseconds>(lateness[lateness.size() / 2]).count()
+         << " max: " << std::chrono::duration_cast<std::chrono::microseconds>(lateness.back()).count()
+         << endl;
+
+    // timers must never fire early.
+    assert(lateness.front() >= CoDispatcher::Duration(0));
+    if constexpr (std::chrono::duration_cast<std::chrono::microseconds>(CoDispatcher::Duration(1)).count() < 1000)
+    {
+        // sub-millisecond resolution: typical lateness should be well under a millisecond, even on a loaded machine.
+        assert(lateness[lateness.size() / 2] < 2ms);
+    }
+
+    std::vector<CoDispatcher::Duration> readLateness;
+    ReadTimeoutLatenessTask(&readLateness).GetResult();
+
+    std::sort(readLateness.begin(), readLateness.end());
+    cout << "    CoRead timeout lateness (us) min: " << std::chrono::duration_cast<std::chrono::microseconds>(readLateness.front()).count()
+         << " median: " << std::chrono::duration_cast<std::chrono::microseconds>(readLateness[readLateness.size() / 2]).count()
+         << " max: " << std::chrono::duration_cast<std::chrono::microseconds>(readLateness.back()).count()
+         << endl;
+
+    assert(readLateness.front() >= CoDispatcher::Duration(0));
+    if constexpr (std::chrono::duration_cast<std::chrono::microseconds>(CoDispatcher::Duration(1)).count() < 1000)
+    {
+        assert(readLateness[readLateness.size() / 2] < 2ms);
+    }
+}
+
+/***************************************/
+// counts destruction of detached coroutine frames (parameters live until the frame is destroyed).
+static std::atomic<int> liveThreadFrames = 0;
+class ThreadFrameCounter
+{
+public:
+    ThreadFrameCounter() { ++liveThreadFrames; }
+    ThreadFrameCounter(const ThreadFrameCounter &) { ++liveThreadFrames; }
+    ~ThreadFrameCounter() { --liveThreadFrames; }
+};
+
+CoTask<> DetachedThreadProc(ThreadFrameCounter counter, int mode)
+{
+    switch (mode)
+    {
+    case 0: // completes before StartThread() is called.
+        break;
+    case 1:
+        co_await CoDelay(1ms);
+        break;
+    case 2:
+        co_await CoBackground(); // completes on a pool thread.
+        break;
+    }
+    co_return;
+}
+
+void StartThreadReapingTest()
+{
+    cout << "------ StartThreadReapingTest -----" << endl;
+
+    constexpr int THREADS = 300;
+    for (int i = 0; i < THREADS; ++i)
+    {
+        Dispatcher().StartThread(DetachedThreadProc(ThreadFrameCounter(), i % 3));
+    }
+    // synchronously-completed threads are reaped immediately.
+    assert(liveThreadFrames <= THREADS * 2 / 3);
+
+    auto start = CoClock::now();
+    while (liveThreadFrames != 0)
+    {
+        assert(CoClock::now() - start < 10s);
+        Dispatcher().PumpMessages(true);
+    }
+}
+
+/***************************************/
+
+static std::atomic<bool> backgroundWorkDone = false;
+
+CoTask<> SlowBackgroundTask()
+{
+    co_await CoBackground();
+    std::this_thread::sleep_for(100ms);
+    backgroundWorkDone = true;
+}
+
+CoTask<> IsDoneAfterDelayTask()
+{
+    co_await CoDelay(1ms);
+    // the work item that's running this coroutine doesn't count.
+    assert(Dispatcher().IsDone());
+}
+
+void IdleTest()
+{
+    cout << "------ IdleTest -----" << endl;
+    CoDispatcher &dispatcher = Dispatcher();
+    dispatcher.PumpUntilIdle();
+    assert(dispatcher.IsDone());
+
+    // timers count until they fire or are cancelled.
+    auto timerHandle = dispatcher.PostDelayedFunction(60s, []() {});
+    assert(!dispatcher.IsDone());
+    bool cancelled = dispatcher.CancelTimer(timerHandle);
+    assert(cancelled);
+    (void)cancelled;
+    assert(dispatcher.IsDone());
+
+    dispatcher.StartThread(IsDoneAfterDelayTask());
+    dispatcher.PumpUntilIdle();
+
+    // background work counts until it completes. Wait for it without polling, on another thread.
+    backgroundWorkDone = false;
+    dispatcher.StartThread(SlowBackgroundTask());
+    assert(!dispatcher.IsDone());
+    std::thread waiter([]() {
+        CoDispatcher::ForegroundDispatcher().WaitUntilIdle();
+        assert(backgroundWorkDone);
+    });
+    dispatcher.PumpUntilIdle();
+    assert(backgroundWorkDone);
+    waiter.join();
+}
+
+/****** CombinatorTest ************************************/
+
+CoTask<int> DelayedValue(int value, CoDispatcher::Duration delay)
+{
+    co_await CoDelay(delay);
+    co_return value;
+}
+CoTask<int> DelayedThrow(CoDispatcher::Duration delay)
+{
+    co_await CoDelay(delay);
+    throw std::logic_error("DelayedThrow");
+}
+CoTask<> DelayedVoid(CoDispatcher::Duration delay)
+{
+    co_await CoDelay(delay);
+}
+CoTask<int> BackgroundValue(int value)
+{
+    co_await CoBackground();
+    co_return value;
+}
+
+CoTask<> CancellableDelay(CoDispatcher::Duration delay, CoCancellationToken cancellationToken, bool *pCancelled)
+{
+    try
+    {
+        co_await CoDelay(delay, cancellationToken);
+    }
+    catch (const CoCancelledException &)
+    {
+        *pCancelled = true;
+        throw;
+    }
+}
+
+CoTask<> CombinatorTestProc()
+{
+    // tasks run concurrently: the group takes as long as the slowest task.
+    auto start = CoDispatcher::Now();
+    std::vector<CoTask<int>> tasks;
+    tasks.push_back(DelayedValue(1, 100ms));
+    tasks.push_back(DelayedValue(2, 50ms));
+    tasks.push_back(DelayedValue(3, 80ms));
+    tasks.push_back(BackgroundValue(4));
+    std::vector<int> values = co_await WhenAll(std::move(tasks));
+    auto elapsed = CoDispatcher::Now() - start;
+    assert((values == std::vector<int>{1, 2, 3, 4}));
+    assert(elapsed >= 100ms && elapsed < 200ms);
+    (void)elapsed;
+
+    auto [i, v, s] = co_await WhenAll(DelayedValue(5, 20ms), DelayedVoid(10ms), BackgroundValue(6));
+    assert(i == 5 && s == 6);
+    (void)i;
+    (void)v;
+    (void)s;
+
+    std::vector<CoTask<>> voidTasks;
+    voidTasks.push_back(DelayedVoid(10ms));
+    voidTasks.push_back(DelayedVoid(20ms));
+    co_await WhenAll(std::move(voidTasks));
+
+    // a single failure is rethrown as is, after all tasks have completed.
+    start = CoDispatcher::Now();
+    bool caught = false;
+    try
+    {
+        co_await WhenAll(DelayedThrow(10ms), DelayedValue(1, 50ms));
+    }
+    catch (const std::logic_error &)
+    {
+        caught = true;
+    }
+    assert(caught && CoDispatcher::Now() - start >= 50ms);
+
+    // multiple failures are aggregated.
+    caught = false;
+    try
+    {
+        co_await WhenAll(DelayedThrow(10ms), DelayedValue(1, 20ms), DelayedThrow(30ms));
+    }
+    catch (const CoAggregateException &e)
+    {
+        caught = true;
+        assert(e.Exceptions().size() == 2);
+    }
+    assert(caught);
+
+    // WhenAny returns the first task to complete.
+    start = CoDispatcher::Now();
+    auto first = co_await WhenAny(DelayedValue(1, 200ms), DelayedValue(2, 20ms), DelayedValue(3, 100ms));
+    assert(first.index == 1 && first.value == 2);
+    assert(CoDispatcher::Now() - start < 100ms);
+
+    size_t firstVoid = co_await WhenAny(DelayedVoid(50ms), DelayedVoid(10ms));
+    assert(firstVoid == 1);
+    (void)firstVoid;
+
+    first = co_await WhenAny(DelayedValue(1, 200ms), BackgroundValue(7));
+    assert(first.index == 1 && first.value == 7);
+    co_await CoForeground();
+
+    caught = false;
+    try
+    {
+        co_await WhenAny(DelayedValue(1, 50ms), DelayedThrow(10ms));
+    }
+    catch (const std::logic_error &)
+    {
+        caught = true;
+    }
+    assert(caught);
+
+    // WhenAny() with task factories cancels the losers.
+    start = CoDispatcher::Now();
+    bool loserCancelled = false;
+    size_t winner = co_await WhenAny(
+        [](CoCancellationToken token) { return DelayedVoid(10ms); },
+        [&loserCancelled](CoCancellationToken token) { return CancellableDelay(10s, token, &loserCancelled); });
+    assert(winner == 0);
+    co_await CoDelay(10ms);
+    assert(loserCancelled && CoDispatcher::Now() - start < 1s);
+    (void)winner;
+
+    first = co_await WhenAny(
+        [](CoCancellationToken token) { return DelayedValue(1, 200ms); },
+        [](CoCancellationToken token) { return DelayedValue(2, 20ms); });
+    assert(first.index == 1 && first.value == 2);
+
+    // ... and so does the parent token. 
+    CoCancellationSource parent;
+    parent.CancelAfter(10ms);
+    bool cancelled1 = false, cancelled2 = false;
+    caught = false;
+    try
+    {
+        co_await WhenAny(
+            parent.Token(),
+            [&cancelled1](CoCancellationToken token) { return CancellableDelay(10s, token, &cancelled1); },
+            [&cancelled2](CoCancellationToken token) { return CancellableDelay(10s, token, &cancelled2); });
+    }
+    catch (const CoCancelledException &)
+    {
+        caught = true;
+    }
+    co_await CoDelay(10ms);
+    assert(caught && cancelled1 && cancelled2);
+    (void)caught;
+}
+
+void CombinatorTest()
+{
+    cout << "------ CombinatorTest -----" << endl;
+    CombinatorTestProc().GetResult();
+    // let the losers of WhenAny() run to completion.
+    Dispatcher().PumpUntilIdle();
+    assert(Dispatcher().IsDone());
+}
+
+/****** ResultStorageTest ************************************/
+
+// Counts the copies and moves made getting a value out of a CoTask<T>.
+struct CountedValue
+{
+    static inline int copies = 0;
+    static inline int moves = 0;
+
+    explicit CountedValue(int value) : value(value) {}
+    CountedValue(const CountedValue &other) : value(other.value) { ++copies; }
+    CountedValue(CountedValue &&other) noexcept : value(other.value) { ++moves; }
+    CountedValue &operator=(const CountedValue &) = delete;
+    CountedValue &operator=(CountedValue &&) = delete;
+
+    int value;
+};
+
+CoTask<CountedValue> ReturnCounted(int value)
+{
+    CountedValue result{value};
+    co_return result;
+}
+CoTask<CountedValue> ReturnCountedTemporary(int value)
+{
+    co_return CountedValue{value};
+}
+CoTask<CountedValue> ReturnCountedInBackground(int value)
+{
+    co_await CoBackground();
+    co_return CountedValue{value};
+}
+CoTask<std::unique_ptr<int>> ReturnMoveOnly(int value)
+{
+    co_return std::make_unique<int>(value);
+}
+CoTask<int &> ReturnReference(int &value)
+{
+    co_return value;
+}
+CoTask<std::pair<int, int>> ReturnBraced()
+{
+    co_return {1, 2};
+}
+
+CoTask<> ResultStorageTestProc()
+{
+    // (CountedValue is neither default-constructible nor assignable.)
+    CountedValue::copies = CountedValue::moves = 0;
+    CountedValue v1 = co_await ReturnCounted(1);
+    assert(v1.value == 1);
+    assert(CountedValue::copies == 0 && CountedValue::moves == 2); // into the promise, and out.
+
+    CountedValue::copies = CountedValue::moves = 0;
+    CountedValue v2 = co_await ReturnCountedTemporary(2);
+    assert(v2.value == 2);
+    assert(CountedValue::copies == 0 && CountedValue::moves == 2);
+
+    CountedValue::copies = CountedValue::moves = 0;
+    CountedValue v3 = co_await ReturnCountedInBackground(3);
+    co_await CoForeground();
+    assert(v3.value == 3);
+    assert(CountedValue::copies == 0 && CountedValue::moves == 2);
+    (void)v1; (void)v2; (void)v3;
+
+    std::unique_ptr<int> p = co_await ReturnMoveOnly(4);
+    assert(p && *p == 4);
+
+    int target = 5;
+    int &ref = co_await ReturnReference(target);
+    assert(&ref == &target);
+    (void)ref;
+
+    auto pair = co_await ReturnBraced();
+    assert(pair.first == 1 && pair.second == 2);
+    (void)pair;
+
+    // the combinators don't need default-constructible results either.
+    std::vector<CoTask<CountedValue>> tasks;
+    tasks.push_back(ReturnCounted(6));
+    tasks.push_back(ReturnCountedInBackground(7));
+    std::vector<CountedValue> values = co_await WhenAll(std::move(tasks));
+    co_await CoForeground();
+    assert(values.size() == 2 && values[0].value == 6 && values[1].value == 7);
+    auto [a, b] = co_await WhenAll(ReturnCounted(8), ReturnMoveOnly(9));
+    assert(a.value == 8 && *b == 9);
+    (void)a; (void)b;
+}
+
+void ResultStorageTest()
+{
+    cout << "------ ResultStorageTest -----" << endl;
+    ResultStorageTestProc().GetResult();
+    Dispatcher().PumpUntilIdle();
+}
+
+/****** LazyTaskTest ************************************/
+
+static int lazyStarted = 0;
+
+LazyTask<int> LazyValue(int value)
+{
+    ++lazyStarted;
+    co_return value;
+}
+LazyTask<int> LazyChain(int depth)
+{
+    if (depth == 0)
+    {
+        co_return co_await LazyValue(1);
+    }
+    co_return 1 + co_await LazyChain(depth - 1);
+}
+LazyTask<> LazyVoid()
+{
+    co_await LazyChain(2);
+}
+LazyTask<> LazyThrow()
+{
+    co_await CoDelay(1ms);
+    throw std::logic_error("LazyThrow");
+}
+LazyTask<int> LazyBackgroundValue(int value)
+{
+    co_await CoBackground();
+    co_return value;
+}
+
+CoTask<> LazyTaskTestProc()
+{
+    // doesn't run until awaited.
+    lazyStarted = 0;
+    LazyTask<int> task = LazyValue(3);
+    assert(lazyStarted == 0);
+    int value = co_await task;
+    assert(value == 3 && lazyStarted == 1);
+
+    value = co_await LazyChain(4);
+    assert(value == 5);
+
+    value = co_await LazyBackgroundValue(6);
+    co_await CoForeground();
+    assert(value == 6);
+
+    bool caught = false;
+    try
+    {
+        co_await LazyThrow();
+    }
+    catch (const std::logic_error &)
+    {
+        caught = true;
+    }
+    assert(caught);
+
+    // long runs of synchronous completions don't overflow the stack, even if symmetric 
+    // transfers aren't compiled as tail calls.
+    int total = 0;
+    for (int i = 0; i < 100000; ++i)
+    {
+        total += co_await LazyChain(1);
+    }
+    assert(total == 200000);
+    (void)total;
+
+    // conversions.
+    CoTask<int> eager = LazyValue(7).Start();
+    value = co_await eager;
+    assert(value == 7);
+    value = co_await ToLazyTask(BackgroundValue(8));
+    co_await CoForeground();
+    assert(value == 8);
+    auto [a, b] = co_await WhenAll(LazyValue(9).Start(), LazyBackgroundValue(10).Start());
+    co_await CoForeground();
+    assert(a == 9 && b == 10);
+    (void)value;
+    (void)caught;
+    (void)a;
+    (void)b;
+}
+
+// Continuations posted to unwind the stack stay on the worker thread.
+CoTask<> LazyBackgroundLoopProc()
+{
+    co_await CoBackground();
+    std::thread::id workerThread = std::this_thread::get_id();
+    bool sameThread = true;
+    int total = 0;
+    for (int i = 0; i < 100000; ++i)
+    {
+        total += co_await LazyValue(1);
+        sameThread = sameThread && std::this_thread::get_id() == workerThread;
+    }
+    co_await CoForeground();
+    assert(total == 100000 && sameThread);
+    (void)total;
+    (void)sameThread;
+}
+
+void LazyTaskTest()
+{
+    cout << "------ LazyTaskTest -----" << endl;
+    LazyTaskTestProc().GetResult();
+
+    // (one worker, so that an idle worker can't steal a posted continuation.)
+    Dispatcher().SetThreadPoolSize(1);
+    LazyBackgroundLoopProc().GetResult();
+    Dispatcher().DestroyDispatcher();
+
+    // a lazy task converted to a CoTask<> can be started as a thread.
+    lazyStarted = 0;
+    Dispatcher().StartThread(LazyVoid());
+    Dispatcher().PumpUntilIdle();
+    assert(lazyStarted == 1);
+    assert(Dispatcher().IsDone());
+}
+
+/***************************************/
+
+static int generatorLocalsAlive = 0;
+struct GeneratorLocal
+{
+    GeneratorLocal() { ++generatorLocalsAlive; }
+    ~GeneratorLocal() { --generatorLocalsAlive; }
+};
+
+AsyncGenerator<int> CountTo(int n)
+{
+    GeneratorLocal local;
+    for (int i = 1; i <= n; ++i)
+    {
+        co_yield i;
+    }
+}
+
+AsyncGenerator<std::string> SlowStrings()
+{
+    co_await CoDelay(1ms);
+    co_yield "a";
+    co_await CoBackground();
+    std::string b = "b";
+    co_yield b;
+    co_await CoForeground();
+    const std::string c = "c";
+    co_yield c;
+}
+
+AsyncGenerator<int> ThrowAfter(int n)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        co_yield i;
+    }
+    throw std::logic_error("ThrowAfter");
+}
+
+CoTask<> GeneratorTestProc()
+{
+    // Next()/Value()
+    int total = 0;
+    {
+        auto numbers = CountTo(4);
+        while (co_await numbers.Next())
+        {
+            total += numbers.Value();
+        }
+        assert(total == 10);
+        bool more = co_await numbers.Next(); // (stays at the end.)
+        assert(!more);
+        (void)more;
+    }
+    assert(generatorLocalsAlive == 0);
+
+    // iterators, with a producer that suspends and switches threads.
+    std::vector<std::string> strings;
+    {
+        auto generator = SlowStrings();
+        for (auto i = co_await generator.begin(); i != generator.end(); co_await ++i)
+        {
+            strings.push_back(std::move(*i));
+        }
+    }
+    co_await CoForeground();
+    assert((strings == std::vector<std::string>{"a", "b", "c"}));
+
+    // empty sequence.
+    {
+        auto empty = CountTo(0);
+        auto i = co_await empty.begin();
+        assert(i == empty.end());
+        (void)i;
+    }
+
+    // producer exceptions are rethrown to the consumer.
+    bool caught = false;
+    int count = 0;
+    try
+    {
+        auto generator = ThrowAfter(2);
+        while (co_await generator.Next())
+        {
+            ++count;
+        }
+    }
+    catch (const std::logic_error &)
+    {
+        caught = true;
+    }
+    assert(caught && count == 2);
+
+    // abandoning the sequence destroys the suspended producer.
+    {
+        auto generator = CountTo(100);
+        co_await generator.Next();
+        assert(generatorLocalsAlive == 1);
+    }
+    assert(generatorLocalsAlive == 0);
+
+    // long synchronous sequences don't overflow the stack.
+    long long sum = 0;
+    auto generator = CountTo(100000);
+    while (co_await generator.Next())
+    {
+        sum += generator.Value();
+    }
+    assert(sum == 100000LL * 100001 / 2);
+    (void)sum;
+    (void)caught;
+    (void)count;
+}
+
+// Consumer continuations posted to unwind the stack stay on the worker thread.
+CoTask<> GeneratorBackgroundLoopProc()
+{
+    co_await CoBackground();
+    std::thread::id workerThread = std::this_thread::get_id();
+    bool sameThread = true;
+    int count = 0;
+    auto numbers = CountTo(100000);
+    while (co_await numbers.Next())
+    {
+        ++count;
+        sameThread = sameThread && std::this_thread::get_id() == workerThread;
+    }
+    co_await CoForeground();
+    assert(count == 100000 && sameThread);
+    (void)count;
+    (void)sameThread;
+}
+
+void GeneratorTest()
+{
+    cout << "------ GeneratorTest -----" << endl;
+    GeneratorTestProc().GetResult();
+    Dispatcher().PumpUntilIdle();
+    assert(Dispatcher().IsDone());
+
+    // (one worker, so that an idle worker can't steal a posted continuation.)
+    Dispatcher().SetThreadPoolSize(1);
+    GeneratorBackgroundLoopProc().GetResult();
+    Dispatcher().DestroyDispatcher();
+}
+
+/***************************************/
+
+CoTask<> RecordLane(std::vector<std::string> *order, std::string name)
+{
+    co_await CoForeground(); // (queues at the inherited priority.)
+    order->push_back(name);
+}
+
+CoTask<> DelayedRecordLane(std::vector<std::string> *order, std::string name)
+{
+    co_await CoDelay(1ms);
+    order->push_back(name);
+}
+
+CoTask<CoPriority> ChildPriority()
+{
+    co_await CoDelay(1ms);
+    co_return CoDispatcher::CurrentPriority();
+}
+
+CoTask<> InheritPriority(CoPriority expected, bool *pDone)
+{
+    assert(CoDispatcher::CurrentPriority() == expected);
+    co_await CoDelay(1ms);
+    assert(CoDispatcher::CurrentPriority() == expected);
+    co_await CoBackground();
+    assert(CoDispatcher::CurrentPriority() == expected);
+    co_await CoDelay(1ms); // (from the background.)
+    assert(CoDispatcher::CurrentPriority() == expected);
+    co_await CoForeground();
+    assert(CoDispatcher::CurrentPriority() == expected);
+    CoPriority childPriority = co_await ChildPriority();
+    assert(childPriority == expected);
+    (void)childPriority;
+
+    co_await CoForeground(CoPriority::Idle);
+    assert(CoDispatcher::CurrentPriority() == CoPriority::Idle);
+    *pDone = true;
+}
+
+CoTask<> SpinProc(int iterations, int *pCount)
+{
+    for (int i = 0; i < iterations; ++i)
+    {
+        co_await CoForeground();
+        ++*pCount;
+    }
+}
+
+CoTask<> SampleProc(int *pCount, int *pSample)
+{
+    co_await CoForeground();
+    *pSample = *pCount;
+}
+
+void PriorityTest()
+{
+    cout << "------ PriorityTest -----" << endl;
+    assert(CoDispatcher::CurrentPriority() == CoPriority::Normal);
+
+    // higher priority lanes first.
+    std::vector<std::string> order;
+    Dispatcher().StartThread(CoPriority::Idle, [&order] { return RecordLane(&order, "idle"); });
+    Dispatcher().StartThread(RecordLane(&order, "normal"));
+    Dispatcher().StartThread(CoPriority::High, [&order] { return RecordLane(&order, "high"); });
+    assert(CoDispatcher::CurrentPriority() == CoPriority::Normal);
+    Dispatcher().PumpUntilIdle();
+    assert((order == std::vector<std::string>{"high", "normal", "idle"}));
+
+    // an expired idle timer waits behind queued high-priority posts.
+    order.clear();
+    Dispatcher().StartThread(CoPriority::Idle, [&order] { return DelayedRecordLane(&order, "idle timer"); });
+    std::this_thread::sleep_for(5ms);
+    Dispatcher().StartThread(CoPriority::High, [&order] { return RecordLane(&order, "high 1"); });
+    Dispatcher().StartThread(CoPriority::High, [&order] { return RecordLane(&order, "high 2"); });
+    Dispatcher().PumpUntilIdle();
+    assert((order == std::vector<std::string>{"high 1", "high 2", "idle timer"}));
+
+    // continuations inherit the priority.
+    bool done = false;
+    Dispatcher().StartThread(CoPriority::High, [&done] { return InheritPriority(CoPriority::High, &done); });
+    Dispatcher().PumpUntilIdle();
+    assert(done);
+    done = false;
+    Dispatcher().StartThread(CoPriority::Idle, [&done] { return InheritPriority(CoPriority::Idle, &done); });
+    Dispatcher().PumpUntilIdle();
+    assert(done);
+
+    // a busy high-priority task delays lower-priority work, but doesn't stall it.
+    constexpr int ITERATIONS = 200;
+    int count = 0;
+    int normalSample = -1;
+    int idleSample = -1;
+    Dispatcher().StartThread(CoPriority::High, [&count] { return SpinProc(ITERATIONS, &count); });
+    Dispatcher().StartThread(CoPriority::Idle, [&count, &idleSample] { return SampleProc(&count, &idleSample); });
+    Dispatcher().StartThread(SampleProc(&count, &normalSample));
+    Dispatcher().PumpUntilIdle();
+    assert(count == ITERATIONS);
+    assert(normalSample >= 1 && normalSample <= (int)CoDispatcher::STARVATION_LIMIT + 1);
+    assert(idleSample >= 1 && idleSample < ITERATIONS);
+    (void)normalSample;
+    (void)idleSample;
+    (void)done;
+}
+
+/***************************************/
+
 int main(int argc, char **argv)
 {
+    TimerQueueTest();
+    CoTimerTest();
+    TimerLatenessTest();
+    FrameAllocatorTest();
+    FifoTest();
+    MpscQueueTest();
+    WorkStealingDequeTest();
+    PostJitterTest();
     CatchTest();
     VoidTest();
+    StartThreadReapingTest();
+    IdleTest();
+    CombinatorTest();
+    ResultStorageTest();
+    LazyTaskTest();
+    GeneratorTest();
+    PriorityTest();
     TestThreadPoolSizing();
+    BackgroundFairnessTest();
+    BackgroundLifoStealTest();
     BackgroundSwitchOnreturnTest();
     BackgroundNestedTest();
     BackgroundTest();
@@ -0,0 +1,136 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Fifo benchmark: cotask::Fifo vs std::deque, for a pointer-sized element (as used by 
+// the dispatcher and scheduler queues), and a move-only element.
+//
+// Not run as part of the test suite. Usage: fifoBenchmark
+
+#include "cotask/Fifo.h"
+#include <iostream>
+#include <iomanip>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <string>
+
+using namespace cotask;
+using namespace std;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t OPERATIONS = 10000000;
+
+static size_t sink;
+
+template <typename T>
+struct FifoAdapter
+{
+    Fifo<T> queue;
+    void push(T &&value) { queue.push(std::move(value)); }
+    T pop() { return queue.pop(); }
+};
+
+template <typename T>
+struct DequeAdapter
+{
+    std::deque<T> queue;
+    void push(T &&value) { queue.push_back(std::move(value)); }
+    T pop()
+    {
+        T result = std::move(queue.front());
+        queue.pop_front();
+        return result;
+    }
+};
+
+// Keep `depth` items in the queue: push one, pop one.
+template <typename QUEUE, typename MAKE, typename CONSUME>
+static double SteadyStateNs(size_t depth, MAKE make, CONSUME consume)
+{
+    QUEUE queue;
+    for (size_t i = 0; i < depth; ++i)
+    {
+        queue.push(make(i));
+    }
+    auto start = Clock::now();
+    for (size_t i = 0; i < OPERATIONS; ++i)
+    {
+        queue.push(make(i));
+        consume(queue.pop());
+    }
+    auto elapsed = Clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(elapsed).count() / OPERATIONS;
+}
+
+// Fill to `depth` then drain, repeatedly (exercises growth on the first pass).
+template <typename QUEUE, typename MAKE, typename CONSUME>
+static double BurstNs(size_t depth, MAKE make, CONSUME consume)
+{
+    QUEUE queue;
+    size_t passes = OPERATIONS / depth;
+    auto start = Clock::now();
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        for (size_t i = 0; i < depth; ++i)
+        {
+            queue.push(make(i));
+        }
+        for (size_t i = 0; i < depth; ++i)
+        {
+            consume(queue.pop());
+        }
+    }
+    auto elapsed = Clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(elapsed).count() / (passes * depth);
+}
+
+template <typename T, typename MAKE, typename CONSUME>
+static void Compare(const char *name, MAKE make, CONSUME consume)
+{
+    cout << name << endl;
+    cout << "     depth    Fifo steady(ns)   deque steady(ns)    Fifo burst(ns)   deque burst(ns)" << endl;
+    for (size_t depth : {1, 16, 256, 4096, 65536})
+    {
+        cout << setw(10) << depth << fixed << setprecision(2)
+             << setw(19) << SteadyStateNs<FifoAdapter<T>>(depth, make, consume)
+             << setw(19) << SteadyStateNs<DequeAdapter<T>>(depth, make, consume)
+             << setw(18) << BurstNs<FifoAdapter<T>>(depth, make, consume)
+             << setw(18) << BurstNs<DequeAdapter<T>>(depth, make, consume)
+             << endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Compare<void *>(
+        "void *",
+        [](size_t i) { return (void *)(i * 8); },
+        [](void *p) { sink += (size_t)p; });
+    Compare<std::unique_ptr<size_t>>(
+        "std::unique_ptr<size_t> (move-only)",
+        [](size_t i) { return std::unique_ptr<size_t>(new size_t(i)); },
+        [](std::unique_ptr<size_t> p) { sink += *p; });
+    return sink == 0 ? 0 : 0;
+}
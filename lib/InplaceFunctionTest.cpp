@@ -0,0 +1,250 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "cotask/InplaceFunction.h"
+#include "cotask/CoTask.h"
+#include "cotask/CoEvent.h"
+#include <iostream>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdlib>
+#include <cassert>
+
+using namespace cotask;
+using namespace std;
+
+// Count every allocation made by the test thread. (Thread pool threads allocate their 
+// dispatchers whenever they get around to starting up.)
+static std::atomic<uint64_t> allocationCount = 0;
+static thread_local bool countAllocations = false;
+
+void *operator new(size_t size)
+{
+    if (countAllocations)
+        ++allocationCount;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+////// InplaceFunctionTest ///////////////////
+
+void InplaceFunctionTest()
+{
+    cout << "--- InplaceFunction Test ---" << endl;
+    using Fn = InplaceFunction<int(int)>;
+
+    {
+        Fn empty;
+        assert(!empty);
+        assert(empty == nullptr);
+        bool caught = false;
+        try
+        {
+            empty(1);
+        }
+        catch (const std::bad_function_call &)
+        {
+            caught = true;
+        }
+        assert(caught);
+        (void)caught;
+    }
+    {
+        int *p = nullptr;
+        int offset = 3;
+        auto small = [p, offset](int v) { return p == nullptr ? v + offset : 0; };
+        static_assert(Fn::is_inplace<decltype(small)>);
+
+        uint64_t allocations = allocationCount;
+        (void)allocations;
+        Fn fn{small};
+        assert(fn(1) == 4);
+        Fn moved{std::move(fn)};
+        assert(!fn);
+        assert(moved(2) == 5);
+        fn = std::move(moved);
+        assert(fn(3) == 6);
+        fn = nullptr;
+        assert(!fn);
+        assert(allocationCount == allocations);
+    }
+    {
+        // move-only callables.
+        auto value = std::make_unique<int>(10);
+        Fn fn{[value = std::move(value)](int v) { return *value + v; }};
+        assert(fn(1) == 11);
+        Fn moved = std::move(fn);
+        assert(moved(2) == 12);
+    }
+    {
+        // too large for in-place storage.
+        std::string a = "abcdefghijklmnopqrstuvwxyz0123456789";
+        std::string b = "0123456789";
+        auto large = [a, b](int v) { return (int)(a.length() + b.length()) + v; };
+        static_assert(!Fn::is_inplace<decltype(large)>);
+        Fn fn{large};
+        Fn moved{std::move(fn)};
+        assert(moved(1) == 47);
+    }
+    {
+        std::function<int(int)> emptyFunction;
+        Fn fn{emptyFunction};
+        assert(!fn);
+        Fn fn2{std::function<int(int)>([](int v) { return v * 2; })};
+        assert(fn2(4) == 8);
+
+        int (*emptyPointer)(int) = nullptr;
+        Fn fn3{emptyPointer};
+        assert(!fn3);
+    }
+    {
+        // destructors run exactly once.
+        auto counter = std::make_shared<int>(0);
+        {
+            Fn fn{[counter](int v) { return v; }};
+            assert(counter.use_count() == 2);
+            Fn moved{std::move(fn)};
+            assert(counter.use_count() == 2);
+        }
+        assert(counter.use_count() == 1);
+    }
+    cout << "done" << endl;
+}
+
+////// AllocationTest ///////////////////
+
+class CAllocationTest
+{
+public:
+    static constexpr int WARMUP_ITERATIONS = 100;
+    static constexpr int ITERATIONS = 1000;
+
+    CoConditionVariable cv;
+    int available = 0;
+    int received = 0;
+    int timerCount = 0;
+    int lastReceived = 0;
+    int iteration = 0;
+    bool done = false;
+
+    CoTask<> Consumer()
+    {
+        int *pAvailable = &available;
+        bool *pDone = &done;
+        while (true)
+        {
+            // (five pointers: larger than std::function's small-object buffer, and 
+            // ConditionTest's inplace capacity. Stored by value, without type erasure.)
+            int *pReceived = &received;
+            uint64_t padding = 0;
+            co_await cv.Wait([this, pAvailable, pDone, pReceived, padding] {
+                (void)padding;
+                assert(pReceived == &received);
+                if (*pAvailable > 0)
+                {
+                    --*pAvailable;
+                    ++received;
+                    return true;
+                }
+                return *pDone;
+            });
+            if (done)
+                break;
+        }
+        co_return;
+    }
+
+    void Iterate()
+    {
+        int *pCount = &timerCount;
+        int *pReceived = &received;
+        Dispatcher().PostDelayedFunction(0ms, [this, pCount, pReceived]() {
+            ++*pCount;
+            lastReceived = *pReceived;
+        });
+        if (++iteration % 2 == 0)
+        {
+            cv.Notify([this]() { ++available; });
+        }
+        else
+        {
+            cv.NotifyAll([this]() { ++available; });
+        }
+        cv.Execute([this]() { assert(available >= 0); });
+        bool consumed = cv.Test([this]() { return available == 0; });
+        (void)consumed;
+        Dispatcher().PumpUntilIdle();
+    }
+
+    void Run()
+    {
+        Dispatcher().StartThread(Consumer());
+        for (int i = 0; i < WARMUP_ITERATIONS; ++i)
+        {
+            Iterate();
+        }
+        uint64_t allocations = allocationCount;
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            Iterate();
+        }
+        uint64_t steadyStateAllocations = allocationCount - allocations;
+        cout << "Allocations in " << ITERATIONS << " iterations: " << steadyStateAllocations << endl;
+        assert(steadyStateAllocations == 0 || !CoFrameAllocator::POOLED); // (AddressSanitizer builds allocate coroutine frames with new.)
+        assert(received == WARMUP_ITERATIONS + ITERATIONS);
+        assert(timerCount == WARMUP_ITERATIONS + ITERATIONS);
+
+        cv.NotifyAll([this]() { done = true; });
+        Dispatcher().PumpUntilIdle();
+    }
+};
+
+void AllocationTest()
+{
+    cout << "--- Allocation Test ---" << endl;
+    CAllocationTest test;
+    test.Run();
+    cout << "done" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    countAllocations = true;
+    InplaceFunctionTest();
+    AllocationTest();
+    Dispatcher().DestroyDispatcher();
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// I/O benchmark: socketpair ping-pong, comparing CoFile::CoRead()/CoWrite() (condition variable
+// wakeups) against CoFile::Readable()/Writable() (direct handoff), with i/o events delivered 
+// by the AsyncIo thread, and with foreground i/o (see CoDispatcher::SetForegroundIo()).
+//
+// Not run as part of the test suite. Usage: ioBenchmark
+
+#include "cotask/CoTask.h"
+#include "cotask/CoFile.h"
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <cassert>
+
+using namespace cotask;
+using namespace std;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t MESSAGES = 20000;
+
+/////// CoRead/CoWrite ///////
+
+static CoTask<> CoEchoProc(CoFile *file)
+{
+    char c;
+    for (size_t i = 0; i < MESSAGES; ++i)
+    {
+        size_t nRead = co_await file->CoRead(&c, 1);
+        assert(nRead == 1);
+        (void)nRead;
+        co_await file->CoWrite(&c, 1);
+    }
+}
+
+static CoTask<> CoPingProc(CoFile *file)
+{
+    char c = 'x';
+    for (size_t i = 0; i < MESSAGES; ++i)
+    {
+        co_await file->CoWrite(&c, 1);
+        size_t nRead = co_await file->CoRead(&c, 1);
+        assert(nRead == 1);
+        (void)nRead;
+    }
+}
+
+/////// Readable()/Writable() ///////
+
+static CoTask<> ReadOne(CoFile *file, char *c)
+{
+    while (true)
+    {
+        ssize_t nRead = read(file->GetFileDescriptor(), c, 1);
+        if (nRead == 1)
+        {
+            co_return;
+        }
+        if (nRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            CoIoException::ThrowErrno();
+        }
+        co_await file->Readable();
+    }
+}
+
+static CoTask<> WriteOne(CoFile *file, char c)
+{
+    while (true)
+    {
+        ssize_t nWritten = write(file->GetFileDescriptor(), &c, 1);
+        if (nWritten == 1)
+        {
+            co_return;
+        }
+        if (nWritten < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            CoIoException::ThrowErrno();
+        }
+        co_await file->Writable();
+    }
+}
+
+static CoTask<> ReadyEchoProc(CoFile *file)
+{
+    char c;
+    for (size_t i = 0; i < MESSAGES; ++i)
+    {
+        co_await ReadOne(file, &c);
+        co_await WriteOne(file, c);
+    }
+}
+
+static CoTask<> ReadyPingProc(CoFile *file)
+{
+    char c = 'x';
+    for (size_t i = 0; i < MESSAGES; ++i)
+    {
+        co_await WriteOne(file, c);
+        co_await ReadOne(file, &c);
+    }
+}
+
+static double PingPong(bool readyAwaitables)
+{
+    std::unique_ptr<CoFile> ping, echo;
+    CoFile::CreateSocketPair(&ping, &echo);
+
+    auto start = Clock::now();
+    if (readyAwaitables)
+    {
+        Dispatcher().StartThread(ReadyEchoProc(echo.get()));
+        ReadyPingProc(ping.get()).GetResult();
+    }
+    else
+    {
+        Dispatcher().StartThread(CoEchoProc(echo.get()));
+        CoPingProc(ping.get()).GetResult();
+    }
+    auto elapsed = Clock::now() - start;
+    Dispatcher().PumpUntilIdle();
+
+    return MESSAGES / std::chrono::duration_cast<std::chrono::duration<double>>(elapsed).count();
+}
+
+int main(int argc, char **argv)
+{
+    cout << "                      CoRead/CoWrite (msg/s)   Readable/Writable (msg/s)" << endl;
+    for (bool foregroundIo : {false, true})
+    {
+        Dispatcher().SetForegroundIo(foregroundIo);
+        double cvRate = PingPong(false);
+        double readyRate = PingPong(true);
+        cout << setw(20) << (foregroundIo ? "foreground i/o" : "AsyncIo thread")
+             << setw(24) << fixed << setprecision(0) << cvRate
+             << setw(28) << readyRate
+             << endl;
+    }
+    Dispatcher().SetForegroundIo(false);
+    CoDispatcher::DestroyDispatcher();
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Lazy task benchmark: a 5-deep chain of nested awaits, with CoTask (eager start, precursor 
+// handshake on completion) and with LazyTask (symmetric transfer in both directions). Reports 
+// the time per chain, and the number of frames allocated per chain. The innermost step either 
+// completes synchronously, or suspends (posting itself with CoForeground()) so that the chain unwinds from the dispatcher.
+//
+// Not run as part of the test suite. Usage: lazyBenchmark
+
+#include "cotask/CoTask.h"
+#include "cotask/LazyTask.h"
+#include "cotask/CoFrameAllocator.h"
+#include <iostream>
+#include <iomanip>
+
+using namespace cotask;
+using namespace std;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t CHAINS = 200000;
+static constexpr int DEPTH = 5;
+
+static uint64_t Allocations()
+{
+    auto statistics = CoFrameAllocator::GetStatistics();
+    return statistics.hits + statistics.misses + statistics.oversize;
+}
+
+static CoTask<int> EagerChain(int depth, bool suspend)
+{
+    if (depth == 1)
+    {
+        if (suspend)
+        {
+            co_await CoForeground(); // (posts the continuation.)
+        }
+        co_return 1;
+    }
+    co_return 1 + co_await EagerChain(depth - 1, suspend);
+}
+
+static LazyTask<int> LazyChain(int depth, bool suspend)
+{
+    if (depth == 1)
+    {
+        if (suspend)
+        {
+            co_await CoForeground(); // (posts the continuation.)
+        }
+        co_return 1;
+    }
+    co_return 1 + co_await LazyChain(depth - 1, suspend);
+}
+
+template <typename CHAIN>
+static CoTask<> RunChains(CHAIN chain, bool suspend)
+{
+    int total = 0;
+    for (size_t i = 0; i < CHAINS; ++i)
+    {
+        total += co_await chain(DEPTH, suspend);
+    }
+    if (total != (int)(CHAINS * DEPTH))
+    {
+        throw std::logic_error("Wrong result.");
+    }
+}
+
+template <typename CHAIN>
+static void Benchmark(const char *name, CHAIN chain, bool suspend)
+{
+    uint64_t allocations = Allocations();
+    auto start = Clock::now();
+    RunChains(chain, suspend).GetResult();
+    auto elapsed = Clock::now() - start;
+    allocations = Allocations() - allocations;
+
+    cout << "    " << left << setw(10) << name << setw(12) << (suspend ? "suspends" : "sync") << right
+         << setw(14) << fixed << setprecision(0)
+         << std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(elapsed).count() / CHAINS
+         << setw(14) << setprecision(2) << (double)allocations / CHAINS
+         << endl;
+}
+
+int main(int argc, char **argv)
+{
+    cout << "5-deep await chains:" << endl;
+    cout << "    task      innermost   ns/chain  frames/chain" << endl;
+    for (bool suspend : {false, true})
+    {
+        Benchmark("CoTask", EagerChain, suspend);
+        Benchmark("LazyTask", LazyChain, suspend);
+    }
+    CoDispatcher::DestroyDispatcher();
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Result benchmark: counts the copies and moves made returning values through CoTask<T> 
+// (directly, through chains of coroutines that return the result of an inner coroutine, 
+// and through WhenAll()), and times returning a std::vector<std::string> through a chain.
+//
+// Not run as part of the test suite. Usage: resultBenchmark
+
+#include "cotask/CoTask.h"
+#include "cotask/CoCombinators.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+
+using namespace cotask;
+using namespace std;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t ITERATIONS = 100000;
+
+struct Counted
+{
+    static inline size_t copies = 0;
+    static inline size_t moves = 0;
+    static void Reset() { copies = moves = 0; }
+
+    Counted() {}
+    Counted(const Counted &other) : payload(other.payload) { ++copies; }
+    Counted(Counted &&other) noexcept : payload(std::move(other.payload)) { ++moves; }
+    Counted &operator=(const Counted &other)
+    {
+        payload = other.payload;
+        ++copies;
+        return *this;
+    }
+    Counted &operator=(Counted &&other) noexcept
+    {
+        payload = std::move(other.payload);
+        ++moves;
+        return *this;
+    }
+
+    std::vector<std::string> payload;
+};
+
+template <typename T>
+static T MakeValue()
+{
+    T result;
+    if constexpr (std::is_same_v<T, Counted>)
+    {
+        result.payload = std::vector<std::string>(32, "wpa_supplicant reply line");
+    }
+    else
+    {
+        result = std::vector<std::string>(32, "wpa_supplicant reply line");
+    }
+    return result;
+}
+
+template <typename T>
+static CoTask<T> Leaf()
+{
+    T result = MakeValue<T>();
+    co_return result;
+}
+
+template <typename T>
+static CoTask<T> Chain(size_t depth)
+{
+    if (depth == 0)
+    {
+        co_return co_await Leaf<T>();
+    }
+    co_return co_await Chain<T>(depth - 1);
+}
+
+static void Count(const char *name, CoTask<> (*proc)())
+{
+    Counted::Reset();
+    proc().GetResult();
+    cout << "    " << left << setw(28) << name << right
+         << setw(8) << Counted::copies
+         << setw(8) << Counted::moves << endl;
+}
+
+static CoTask<> DirectProc()
+{
+    Counted value = co_await Leaf<Counted>();
+    (void)value;
+}
+static CoTask<> Chain5Proc()
+{
+    Counted value = co_await Chain<Counted>(4);
+    (void)value;
+}
+static CoTask<> WhenAllProc()
+{
+    std::vector<CoTask<Counted>> tasks;
+    tasks.push_back(Leaf<Counted>());
+    tasks.push_back(Leaf<Counted>());
+    std::vector<Counted> values = co_await WhenAll(std::move(tasks));
+    (void)values;
+}
+
+static CoTask<size_t> TimeChainProc(size_t depth)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < ITERATIONS; ++i)
+    {
+        std::vector<std::string> value = co_await Chain<std::vector<std::string>>(depth);
+        total += value.size();
+    }
+    co_return total;
+}
+
+int main(int argc, char **argv)
+{
+    cout << "copies and moves per result:" << endl;
+    cout << "    operation                     copies   moves" << endl;
+    Count("co_await Leaf()", DirectProc);
+    Count("co_await 5-deep chain", Chain5Proc);
+    Count("WhenAll (2 tasks)", WhenAllProc);
+
+    cout << endl
+         << "std::vector<std::string>(32) through a chain:" << endl;
+    cout << "     depth       ns/result" << endl;
+    for (size_t depth : {0, 1, 4})
+    {
+        auto start = Clock::now();
+        size_t total = TimeChainProc(depth).GetResult();
+        auto elapsed = Clock::now() - start;
+        (void)total;
+        cout << setw(10) << depth + 1
+             << setw(16) << fixed << setprecision(0)
+             << std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(elapsed).count() / ITERATIONS
+             << endl;
+    }
+    CoDispatcher::DestroyDispatcher();
+    return 0;
+}
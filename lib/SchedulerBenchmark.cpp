@@ -0,0 +1,113 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Scheduler benchmark: measures background thread pool throughput as the pool grows from 1 
+// to hardware_concurrency() threads. Each task hops between pool threads with CoBackground(), 
+// doing a small amount of work between hops.
+//
+// Not run as part of the test suite. Usage: schedulerBenchmark [maxThreads]
+
+#include "cotask/CoTask.h"
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <vector>
+#include <thread>
+
+using namespace cotask;
+using namespace std;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t TASKS = 64;
+static constexpr size_t HOPS = 2000;
+static constexpr size_t WORK_PER_HOP = 200;
+
+static std::atomic<size_t> completedTasks;
+static std::atomic<uint64_t> sink;
+
+static CoTask<> HopProc(size_t seed)
+{
+    co_await CoBackground();
+    uint64_t value = seed;
+    for (size_t hop = 0; hop < HOPS; ++hop)
+    {
+        for (size_t i = 0; i < WORK_PER_HOP; ++i)
+        {
+            value = value * 6364136223846793005ull + 1442695040888963407ull;
+        }
+        co_await CoBackground();
+    }
+    sink += value;
+    ++completedTasks;
+}
+
+static void ScalingBenchmark(size_t threads)
+{
+    CoDispatcher &dispatcher = CoDispatcher::CurrentDispatcher();
+    dispatcher.SetThreadPoolSize(threads);
+    dispatcher.PumpUntilIdle(); // let the pool settle.
+
+    completedTasks = 0;
+    std::vector<CoTask<>> tasks;
+    tasks.reserve(TASKS);
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < TASKS; ++i)
+    {
+        tasks.push_back(HopProc(i));
+    }
+    dispatcher.PumpUntilIdle();
+    auto elapsed = Clock::now() - start;
+
+    if (completedTasks != TASKS)
+    {
+        cout << "Error: only " << completedTasks << " of " << TASKS << " tasks completed." << endl;
+    }
+    double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(elapsed).count();
+    cout << setw(10) << threads
+         << setw(14) << fixed << setprecision(1) << seconds * 1000
+         << setw(16) << setprecision(0) << (TASKS * HOPS) / seconds
+         << endl;
+}
+
+int main(int argc, char **argv)
+{
+    size_t maxThreads = std::thread::hardware_concurrency();
+    if (argc > 1)
+    {
+        maxThreads = (size_t)std::stoul(argv[1]);
+    }
+    if (maxThreads == 0)
+    {
+        maxThreads = 4;
+    }
+    cout << "   threads      time(ms)          hops/s" << endl;
+    for (size_t threads = 1; threads <= maxThreads; ++threads)
+    {
+        ScalingBenchmark(threads);
+    }
+    CoDispatcher::DestroyDispatcher();
+    return 0;
+}
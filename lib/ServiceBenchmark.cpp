@@ -0,0 +1,123 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// CoService contention benchmark: many background coroutines concurrently co_await the same 
+// CoService implementation type, which completes immediately on the calling pool thread. 
+// Measures the throughput of the CoService state machine when many instances are in flight
+// at once.
+//
+// Not run as part of the test suite. Usage: serviceBenchmark [threads]
+
+#include "cotask/CoTask.h"
+#include "cotask/CoService.h"
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <vector>
+#include <thread>
+
+using namespace cotask;
+using namespace std;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t TOTAL_AWAITS = 400000;
+
+static std::atomic<uint64_t> sink;
+
+static auto CoImmediate(uint64_t value)
+{
+    struct Implementation
+    {
+        using return_type = uint64_t;
+        uint64_t resultValue;
+
+        void Execute(CoServiceCallback<return_type> *pCallback)
+        {
+            pCallback->SetResult(std::move(resultValue));
+        }
+        bool CancelExecute(CoServiceCallback<return_type> *pCallback)
+        {
+            return true;
+        }
+    };
+    CoService<Implementation> awaitable;
+    awaitable.resultValue = value;
+    return awaitable;
+}
+
+static CoTask<> AwaiterProc(size_t awaits)
+{
+    co_await CoBackground();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < awaits; ++i)
+    {
+        sum += co_await CoImmediate(i);
+    }
+    sink += sum;
+}
+
+static void ServiceBenchmark(size_t awaiters)
+{
+    CoDispatcher &dispatcher = CoDispatcher::CurrentDispatcher();
+
+    std::vector<CoTask<>> tasks;
+    tasks.reserve(awaiters);
+    size_t awaitsPerTask = TOTAL_AWAITS / awaiters;
+    auto start = Clock::now();
+    for (size_t i = 0; i < awaiters; ++i)
+    {
+        tasks.push_back(AwaiterProc(awaitsPerTask));
+    }
+    dispatcher.PumpUntilIdle();
+    auto elapsed = Clock::now() - start;
+
+    double awaits = (double)(awaiters * awaitsPerTask);
+    cout << setw(10) << awaiters
+         << setw(14) << fixed << setprecision(1) << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(elapsed).count()
+         << setw(14) << setprecision(0) << std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(elapsed).count() / awaits
+         << endl;
+}
+
+int main(int argc, char **argv)
+{
+    size_t threads = std::thread::hardware_concurrency();
+    if (argc > 1)
+    {
+        threads = (size_t)std::stoul(argv[1]);
+    }
+    if (threads < 2)
+    {
+        threads = 2;
+    }
+    CoDispatcher::CurrentDispatcher().SetThreadPoolSize(threads);
+    cout << "pool threads: " << threads << endl;
+    cout << "  awaiters      time(ms)   ns/await" << endl;
+    for (size_t awaiters : {1, 4, 16, 64, 256})
+    {
+        ServiceBenchmark(awaiters);
+    }
+    CoDispatcher::DestroyDispatcher();
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Timer benchmark: measures the cost of CoDispatcher::PostDelayedFunction()/CancelDelayedFunction(),
+// and timer expiry, as the number of pending timers grows.
+//
+// Not run as part of the test suite. Usage: timerBenchmark
+
+#include "cotask/CoTask.h"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <cassert>
+
+using namespace cotask;
+using namespace std;
+
+using Clock = std::chrono::steady_clock;
+
+static double NsPerOp(Clock::duration elapsed, size_t operations)
+{
+    return std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(elapsed).count() / operations;
+}
+
+static void InsertCancelBenchmark(size_t pendingTimers)
+{
+    CoDispatcher &dispatcher = CoDispatcher::CurrentDispatcher();
+    std::mt19937 random(pendingTimers);
+    std::uniform_int_distribution<int> delays(3600 * 1000, 7200 * 1000); // 1-2 hours; never fire.
+
+    std::vector<uint64_t> pending;
+    pending.reserve(pendingTimers);
+    for (size_t i = 0; i < pendingTimers; ++i)
+    {
+        pending.push_back(dispatcher.PostDelayedFunction(std::chrono::milliseconds(delays(random)), []() {}));
+    }
+
+    constexpr size_t ITERATIONS = 200000;
+    auto start = Clock::now();
+    for (size_t i = 0; i < ITERATIONS; ++i)
+    {
+        uint64_t handle = dispatcher.PostDelayedFunction(std::chrono::milliseconds(delays(random)), []() {});
+        bool cancelled = dispatcher.CancelDelayedFunction(handle);
+        assert(cancelled);
+        (void)cancelled;
+    }
+    auto insertCancelTime = Clock::now() - start;
+
+    // cancel from the middle of the queue.
+    start = Clock::now();
+    for (size_t i = 0; i < pending.size(); ++i)
+    {
+        dispatcher.CancelDelayedFunction(pending[(i * 7919) % pending.size()]);
+    }
+    auto cancelTime = Clock::now() - start;
+
+    // expiry.
+    for (size_t i = 0; i < pendingTimers; ++i)
+    {
+        dispatcher.PostDelayedFunction(std::chrono::milliseconds(delays(random) - 3600 * 1000), []() {});
+    }
+    auto expireAt = CoDispatcher::Now() + std::chrono::hours(2);
+    start = Clock::now();
+    while (dispatcher.PumpTimerMessages(expireAt))
+    {
+    }
+    auto expireTime = Clock::now() - start;
+
+    cout << setw(10) << pendingTimers
+         << setw(18) << fixed << setprecision(1) << NsPerOp(insertCancelTime, ITERATIONS)
+         << setw(18) << NsPerOp(cancelTime, pending.size())
+         << setw(18) << NsPerOp(expireTime, pendingTimers)
+         << endl;
+}
+
+int main(int argc, char **argv)
+{
+    cout << "   pending   insert+cancel(ns)   cancel(ns)   expire(ns/timer)" << endl;
+    for (size_t pendingTimers : {10, 100, 1000, 10000, 100000})
+    {
+        InsertCancelBenchmark(pendingTimers);
+    }
+    CoDispatcher::DestroyDispatcher();
+    return 0;
+}
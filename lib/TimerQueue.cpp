@@ -0,0 +1,168 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "cotask/TimerQueue.h"
+
+using namespace cotask;
+
+TimerQueue::TimerHandle TimerQueue::Insert(Duration time, Timer &&timer)
+{
+    uint32_t slot;
+    if (freeSlots.empty())
+    {
+        slot = (uint32_t)slots.size();
+        slots.emplace_back();
+    }
+    else
+    {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    slots[slot].timer = std::move(timer);
+
+    heap.push_back(HeapEntry{time, nextSequence++, slot});
+    slots[slot].heapIndex = (uint32_t)(heap.size() - 1);
+    SiftUp(heap.size() - 1);
+
+    return (((TimerHandle)slots[slot].generation) << 32) | slot;
+}
+
+bool TimerQueue::Cancel(TimerHandle handle)
+{
+    uint32_t slot = (uint32_t)(handle & 0xFFFFFFFFu);
+    uint32_t generation = (uint32_t)(handle >> 32);
+    if (slot >= slots.size())
+    {
+        return false;
+    }
+    Slot &s = slots[slot];
+    if (s.generation != generation || s.heapIndex == INVALID_INDEX)
+    {
+        return false;
+    }
+    RemoveAt(s.heapIndex);
+    s.timer = Timer();
+    FreeSlot(slot);
+    return true;
+}
+
+bool TimerQueue::PopExpired(Duration now, Timer *pResult)
+{
+    if (heap.empty() || heap[0].time > now)
+    {
+        return false;
+    }
+    uint32_t slot = heap[0].slot;
+    RemoveAt(0);
+    *pResult = std::move(slots[slot].timer);
+    slots[slot].timer = Timer();
+    FreeSlot(slot);
+    return true;
+}
+
+void TimerQueue::FreeSlot(uint32_t slot)
+{
+    Slot &s = slots[slot];
+    s.heapIndex = INVALID_INDEX;
+    if (++s.generation == 0) // handles must never be zero.
+    {
+        s.generation = 1;
+    }
+    freeSlots.push_back(slot);
+}
+
+void TimerQueue::RemoveAt(size_t heapIndex)
+{
+    slots[heap[heapIndex].slot].heapIndex = INVALID_INDEX;
+
+    size_t last = heap.size() - 1;
+    if (heapIndex != last)
+    {
+        HeapEntry moved = heap[last];
+        heap.pop_back();
+        Place(heapIndex, moved);
+        if (heapIndex != 0 && Before(moved, heap[(heapIndex - 1) / ARITY]))
+        {
+            SiftUp(heapIndex);
+        }
+        else
+        {
+            SiftDown(heapIndex);
+        }
+    }
+    else
+    {
+        heap.pop_back();
+    }
+}
+
+void TimerQueue::SiftUp(size_t heapIndex)
+{
+    HeapEntry entry = heap[heapIndex];
+    while (heapIndex != 0)
+    {
+        size_t parent = (heapIndex - 1) / ARITY;
+        if (!Before(entry, heap[parent]))
+        {
+            break;
+        }
+        Place(heapIndex, heap[parent]);
+        heapIndex = parent;
+    }
+    Place(heapIndex, entry);
+}
+
+void TimerQueue::SiftDown(size_t heapIndex)
+{
+    HeapEntry entry = heap[heapIndex];
+    size_t size = heap.size();
+    while (true)
+    {
+        size_t firstChild = heapIndex * ARITY + 1;
+        if (firstChild >= size)
+        {
+            break;
+        }
+        size_t lastChild = firstChild + ARITY;
+        if (lastChild > size)
+        {
+            lastChild = size;
+        }
+        size_t best = firstChild;
+        for (size_t child = firstChild + 1; child < lastChild; ++child)
+        {
+            if (Before(heap[child], heap[best]))
+            {
+                best = child;
+            }
+        }
+        if (!Before(heap[best], entry))
+        {
+            break;
+        }
+        Place(heapIndex, heap[best]);
+        heapIndex = best;
+    }
+    Place(heapIndex, entry);
+}
@@ -0,0 +1,144 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#ifndef DOXYGEN
+namespace cotask
+{
+    /**
+     * @brief Chase-Lev work-stealing deque of pointers.
+     * 
+     * Private implementation used by CoTaskSchedulerPool.
+     * 
+     * The owning thread pushes at the bottom; the owning thread and any other thread 
+     * take from the top (FIFO), so that items are taken in the order they were pushed. Push() is 
+     * wait-free in the common case; Steal() is lock-free. The buffer grows as required. Retired buffers are kept until the deque is destroyed, 
+     * since a concurrent Steal() may still be reading them.
+     * 
+     * Follows Lê, Pop, Cohen & Zappa Nardelli, "Correct and Efficient Work-Stealing for 
+     * Weak Memory Models" (PPoPP 2013).
+     */
+    class WorkStealingDeque
+    {
+    public:
+        WorkStealingDeque(size_t initialCapacity = 64)
+        {
+            size_t capacity = 1;
+            while (capacity < initialCapacity)
+            {
+                capacity *= 2;
+            }
+            buffers.push_back(std::make_unique<Buffer>(capacity));
+            buffer.store(buffers.back().get(), std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Push an item onto the bottom of the deque. Owner thread only.
+         */
+        void Push(void *item)
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_acquire);
+            Buffer *a = buffer.load(std::memory_order_relaxed);
+            if (b - t > (int64_t)a->mask)
+            {
+                a = Grow(a, t, b);
+            }
+            a->Put(b, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Steal the least recently pushed item. Any thread.
+         * 
+         * @return void* The item, or nullptr if the deque is empty, or if the steal lost a race.
+         */
+        void *Steal()
+        {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+            if (t < b)
+            {
+                Buffer *a = buffer.load(std::memory_order_acquire);
+                void *result = a->Get(t);
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    return nullptr;
+                }
+                return result;
+            }
+            return nullptr;
+        }
+
+        /**
+         * @brief Approximate number of items. Any thread.
+         */
+        size_t SizeHint() const
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_relaxed);
+            return b > t ? (size_t)(b - t) : 0;
+        }
+
+    private:
+        struct Buffer
+        {
+            Buffer(size_t capacity)
+                : mask(capacity - 1), items(new std::atomic<void *>[capacity])
+            {
+            }
+            size_t mask;
+            std::unique_ptr<std::atomic<void *>[]> items;
+
+            void Put(int64_t index, void *item) { items[index & mask].store(item, std::memory_order_relaxed); }
+            void *Get(int64_t index) const { return items[index & mask].load(std::memory_order_relaxed); }
+        };
+
+        Buffer *Grow(Buffer *a, int64_t t, int64_t b)
+        {
+            buffers.push_back(std::make_unique<Buffer>((a->mask + 1) * 2));
+            Buffer *newBuffer = buffers.back().get();
+            for (int64_t i = t; i < b; ++i)
+            {
+                newBuffer->Put(i, a->Get(i));
+            }
+            buffer.store(newBuffer, std::memory_order_release);
+            return newBuffer;
+        }
+
+        alignas(64) std::atomic<int64_t> top = 0;
+        alignas(64) std::atomic<int64_t> bottom = 0;
+        std::atomic<Buffer *> buffer;
+        std::vector<std::unique_ptr<Buffer>> buffers; // owner thread only.
+    };
+} // namespace
+#endif
@@ -0,0 +1,288 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+#include "LazyTask.h"
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <type_traits>
+
+namespace cotask
+{
+    /**
+     * @brief A coroutine that produces a sequence of values asynchronously.
+     * 
+     * @tparam T The type of the values produced.
+     * 
+     * The producer is a coroutine that returns AsyncGenerator<T>. It may co_await (i/o, timers, 
+     * other tasks), and produces each value with co_yield. It doesn't start until the first value 
+     * is requested, and runs only while the consumer is waiting for the next value; control passes 
+     * between the two by symmetric transfer, without a trip through the dispatcher. (In unoptimized 
+     * and AddressSanitizer builds, where symmetric transfers grow the stack, a long run of values 
+     * produced synchronously is occasionally posted back to the foreground dispatcher or thread 
+     * pool that the consumer is running on, in order to unwind the stack.)
+     * 
+     *      AsyncGenerator<std::string> ReadNames(CoFile &file)
+     *      {
+     *          std::string name;
+     *          while (...)
+     *          {
+     *              ... co_await file.CoRead(...) ...
+     *              co_yield name;
+     *          }
+     *      }
+     * 
+     * C++20 has no `for co_await`. Consume values with Next():
+     * 
+     *      auto names = ReadNames(file);
+     *      while (co_await names.Next())
+     *      {
+     *          Use(names.Value());
+     *      }
+     * 
+     * or with iterators, whose begin() and operator++ must be co_awaited:
+     * 
+     *      for (auto i = co_await names.begin(); i != names.end(); co_await ++i)
+     *      {
+     *          Use(*i);
+     *      }
+     * 
+     * Yielded values are not copied: the consumer gets a reference to the producer's object, which 
+     * remains valid until the next value is requested. The consumer may move from it. (Yielding a 
+     * const lvalue makes a copy.)
+     * 
+     * Exceptions thrown by the producer are rethrown by Next() (or begin() and operator++), after 
+     * which the sequence has ended. Destroying the generator before the sequence ends destroys 
+     * the suspended producer, running the destructors of its locals.
+     * 
+     * If the producer switches threads (e.g. CoBackground()), the consumer continues on the thread 
+     * that produced the value.
+     */
+    template <typename T>
+    class [[nodiscard("Are you missing a co_await?")]] AsyncGenerator
+    {
+    public:
+        using value_type = std::remove_cvref_t<T>;
+
+        class promise_type
+        {
+        public:
+            // (Not an aggregate. See CoTask<T>::promise_type.)
+            promise_type() noexcept {}
+
+            // Coroutine frames come from per-thread free lists. (See CoFrameAllocator.h)
+            static void *operator new(size_t size) { return CoFrameAllocator::Allocate(size); }
+            static void operator delete(void *p, size_t size) noexcept { CoFrameAllocator::Free(p, size); }
+
+            AsyncGenerator get_return_object() noexcept
+            {
+                return AsyncGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            // Don't start until the first value is requested.
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+
+            // Transfers control back to the consumer.
+            struct YieldAwaiter
+            {
+                bool await_ready() const noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                {
+                    return detail::TransferTo(h.promise().consumer);
+                }
+                void await_resume() const noexcept {}
+            };
+
+            // (A co_yielded temporary lives until the producer is resumed.)
+            YieldAwaiter yield_value(value_type &value) noexcept
+            {
+                this->value = std::addressof(value);
+                return {};
+            }
+            YieldAwaiter yield_value(value_type &&value) noexcept
+            {
+                this->value = std::addressof(value);
+                return {};
+            }
+            YieldAwaiter yield_value(const value_type &value)
+            {
+                copy.emplace(value);
+                this->value = std::addressof(*copy);
+                return {};
+            }
+
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept
+            {
+                exception = std::current_exception();
+            }
+            YieldAwaiter final_suspend() noexcept
+            {
+                value = nullptr;
+                return {};
+            }
+
+            value_type *value = nullptr;
+            std::optional<value_type> copy;
+            std::coroutine_handle<> consumer;
+            std::exception_ptr exception;
+        };
+
+        AsyncGenerator(AsyncGenerator &&other) noexcept
+            : handle(std::exchange(other.handle, nullptr))
+        {
+        }
+        AsyncGenerator &operator=(AsyncGenerator &&other) noexcept
+        {
+            if (this != &other)
+            {
+                if (handle)
+                {
+                    handle.destroy();
+                }
+                handle = std::exchange(other.handle, nullptr);
+            }
+            return *this;
+        }
+        ~AsyncGenerator()
+        {
+            if (handle)
+            {
+                handle.destroy();
+            }
+        }
+
+        class iterator;
+
+#ifndef DOXYGEN
+        // Resumes the producer until it yields the next value, or completes.
+        struct AdvanceAwaiter
+        {
+            AsyncGenerator *generator;
+
+            bool await_ready() const noexcept { return generator->handle.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept
+            {
+                generator->handle.promise().consumer = consumer;
+                return generator->handle;
+            }
+            // Rethrows the producer's exception, if any. Returns true if there is a value.
+            bool Advanced() const
+            {
+                auto &promise = generator->handle.promise();
+                if (promise.exception)
+                {
+                    std::rethrow_exception(std::exchange(promise.exception, nullptr));
+                }
+                return promise.value != nullptr;
+            }
+        };
+        struct NextAwaiter : AdvanceAwaiter
+        {
+            bool await_resume() const { return this->Advanced(); }
+        };
+        struct BeginAwaiter : AdvanceAwaiter
+        {
+            iterator await_resume() const
+            {
+                this->Advanced();
+                return iterator(this->generator);
+            }
+        };
+        struct IncrementAwaiter : AdvanceAwaiter
+        {
+            iterator *it;
+            iterator &await_resume() const
+            {
+                this->Advanced();
+                return *it;
+            }
+        };
+#endif
+
+        /**
+         * @brief Advance to the next value.
+         * 
+         * @return (awaitable) true if there is a next value (see Value()); false at the end of the sequence.
+         * @throws Any exception thrown by the producer.
+         */
+        NextAwaiter Next() { return NextAwaiter{{this}}; }
+
+        /**
+         * @brief The current value.
+         * 
+         * Valid after Next() has returned true, until Next() is called again.
+         */
+        value_type &Value() const { return *handle.promise().value; }
+
+        /**
+         * @brief An input iterator over the values of an AsyncGenerator.
+         * 
+         * operator++ must be co_awaited.
+         */
+        class iterator
+        {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = AsyncGenerator::value_type;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() noexcept {}
+            explicit iterator(AsyncGenerator *generator) noexcept : generator(generator) {}
+
+            value_type &operator*() const { return generator->Value(); }
+            value_type *operator->() const { return &generator->Value(); }
+
+            IncrementAwaiter operator++() { return IncrementAwaiter{{generator}, this}; }
+
+            bool operator==(std::default_sentinel_t) const noexcept
+            {
+                return generator == nullptr || generator->handle.promise().value == nullptr;
+            }
+
+        private:
+            AsyncGenerator *generator = nullptr;
+        };
+
+        /**
+         * @brief Start the sequence.
+         * 
+         * @return (awaitable) An iterator referring to the first value, or equal to end() if there are none.
+         * @throws Any exception thrown by the producer.
+         */
+        BeginAwaiter begin() { return BeginAwaiter{{this}}; }
+        std::default_sentinel_t end() const noexcept { return {}; }
+
+    private:
+        explicit AsyncGenerator(std::coroutine_handle<promise_type> handle) noexcept
+            : handle(handle)
+        {
+        }
+        std::coroutine_handle<promise_type> handle;
+    };
+
+} // namespace
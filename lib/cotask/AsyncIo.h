@@ -34,6 +34,7 @@
 #include "CoService.h"
 #include "Log.h"
 #include "CoExceptions.h"
+#include "InplaceFunction.h"
 
 namespace cotask
 {
@@ -59,7 +60,7 @@ namespace cotask
             bool hup;
         };
 
-        using EventCallback = std::function<void(EventData eventdata)>;
+        using EventCallback = InplaceFunction<void(EventData eventdata)>;
         using EventHandle = uint64_t;
 
         static AsyncIo &GetInstance() { return *instance; }
@@ -70,6 +71,33 @@ namespace cotask
         virtual void Start() = 0;
         virtual void Stop() = 0;
 
+        /**
+         * @brief Deliver i/o events on the foreground dispatcher thread.
+         * 
+         * When enabled, the AsyncIo thread is stopped, and the foreground dispatcher
+         * waits for posts, timers and i/o readiness in a single call to WaitForEvents().
+         * 
+         * Private use. Call CoDispatcher::SetForegroundIo() instead.
+         */
+        virtual void SetForegroundMode(bool enabled) = 0;
+        virtual bool IsForegroundMode() const = 0;
+
+        /**
+         * @brief Wait for i/o events, and dispatch them on the calling thread.
+         * 
+         * @param timeout Absolute time at which to stop waiting (CoDispatcher::Now() time base).
+         * 
+         * Returns after dispatching one batch of events, after Wake() has been called, or after the 
+         * timeout expires. Foreground mode only.
+         */
+        virtual void WaitForEvents(CoDispatcher::Duration timeout) = 0;
+        /**
+         * @brief Wake a thread that is waiting in WaitForEvents().
+         * 
+         * Thread-safe.
+         */
+        virtual void Wake() = 0;
+
     protected:
         static AsyncIo *instance;
     };
@@ -64,7 +64,7 @@ namespace cotask {
          * by the time the object has passed through the queue should the object pass across a
          * thread boundary.
          */
-        CoTask<> Push(T *value, std::chrono::milliseconds timeout = NO_TIMEOUT);
+        CoTask<> Push(T *value, CoDispatcher::Duration timeout = NO_TIMEOUT);
 
         
         /**
@@ -85,7 +85,7 @@ namespace cotask {
          * of T*that occurred before the Push being visible after Taking the object if 
          * the object travels across a thread boundary.
          */
-        CoTask<T*> Take(std::chrono::milliseconds timeout = NO_TIMEOUT);
+        CoTask<T*> Take(CoDispatcher::Duration timeout = NO_TIMEOUT);
 
         /**
          * @brief Close the queue.
@@ -125,7 +125,7 @@ namespace cotask {
 
     /*****  CoBlockingQueue inlines ****************************/
     template <typename T>
-    CoTask<> CoBlockingQueue<T>::Push(T *value, std::chrono::milliseconds timeout)
+    CoTask<> CoBlockingQueue<T>::Push(T *value, CoDispatcher::Duration timeout)
     {
 
         co_await pushCv.Wait(
@@ -150,7 +150,7 @@ namespace cotask {
         co_return;
     }
     template <typename T>
-    CoTask<T*> CoBlockingQueue<T>::Take(std::chrono::milliseconds timeout)
+    CoTask<T*> CoBlockingQueue<T>::Take(CoDispatcher::Duration timeout)
     {
         T* value;
         co_await takeCv.Wait(
@@ -0,0 +1,258 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "CoTask.h"
+#include "CoExceptions.h"
+#include <stop_token>
+#include <optional>
+
+namespace cotask
+{
+    class CoCancellationSource;
+    template <typename CALLBACK>
+    class CoCancellationCallback;
+
+    /**
+     * @brief Observes cancellation requested through a CoCancellationSource.
+     * 
+     * Tokens are cheap to copy, and are passed by value to cancellable operations 
+     * (CoConditionVariable::Wait(), CoFile reads and writes, CoDelay()). A cancelled operation 
+     * throws CoCancelledException.
+     * 
+     * A default-constructed token can never be cancelled. Operations that are passed one behave 
+     * exactly as if they had not been passed a token at all, and pay nothing for it.
+     * 
+     * Tokens and sources are thread-safe.
+     */
+    class CoCancellationToken
+    {
+    public:
+        CoCancellationToken() noexcept {}
+
+        /**
+         * @brief Is there a source that could cancel this token?
+         */
+        bool CanBeCancelled() const noexcept { return token.stop_possible(); }
+
+        /**
+         * @brief Has cancellation been requested?
+         */
+        bool IsCancelled() const noexcept { return token.stop_requested(); }
+
+        /**
+         * @brief Throw a CoCancelledException if cancellation has been requested.
+         */
+        void ThrowIfCancelled() const
+        {
+            if (IsCancelled())
+            {
+                throw CoCancelledException();
+            }
+        }
+
+    private:
+        friend class CoCancellationSource;
+        template <typename CALLBACK>
+        friend class CoCancellationCallback;
+
+        explicit CoCancellationToken(std::stop_token token) noexcept
+            : token(std::move(token))
+        {
+        }
+        std::stop_token token;
+    };
+
+    /**
+     * @brief Calls a function when a CoCancellationToken is cancelled.
+     * 
+     * The callback is called on the thread that cancels the token; or immediately, in the 
+     * constructor, if the token has already been cancelled. The destructor unregisters the 
+     * callback, waiting for it to complete if it is running on another thread.
+     */
+    template <typename CALLBACK>
+    class CoCancellationCallback
+    {
+    public:
+        CoCancellationCallback(const CoCancellationToken &token, CALLBACK callback)
+            : callback(token.token, std::move(callback))
+        {
+        }
+        CoCancellationCallback(const CoCancellationCallback &) = delete;
+        CoCancellationCallback &operator=(const CoCancellationCallback &) = delete;
+
+    private:
+        std::stop_callback<CALLBACK> callback;
+    };
+
+    /**
+     * @brief Requests cancellation of the operations that hold its tokens.
+     * 
+     * A source may be linked to one or two parent tokens, in which case it is cancelled when
+     * either parent is. Linked sources allow cancellation to be attached to a tree of tasks: 
+     * a long-lived source (e.g. one that is cancelled on shutdown) at the root, and sources with 
+     * deadlines for individual operations below it.
+     * 
+     * Usage:
+     * 
+     *      CoCancellationSource request { shutdownToken };
+     *      request.CancelAfter(2s);
+     *      co_await file.CoRead(buffer, sizeof(buffer), NO_TIMEOUT, request.Token());
+     */
+    class CoCancellationSource
+    {
+    public:
+        CoCancellationSource() {}
+        /**
+         * @brief Construct a source that is cancelled when parent is cancelled.
+         */
+        explicit CoCancellationSource(const CoCancellationToken &parent)
+        {
+            Link(parentLink1, parent);
+        }
+        /**
+         * @brief Construct a source that is cancelled when either parent is cancelled.
+         */
+        CoCancellationSource(const CoCancellationToken &parent1, const CoCancellationToken &parent2)
+        {
+            Link(parentLink1, parent1);
+            Link(parentLink2, parent2);
+        }
+        ~CoCancellationSource()
+        {
+            CancelDeadline();
+        }
+        CoCancellationSource(const CoCancellationSource &) = delete;
+        CoCancellationSource &operator=(const CoCancellationSource &) = delete;
+
+        /**
+         * @brief A token that observes this source.
+         */
+        CoCancellationToken Token() const noexcept { return CoCancellationToken(source.get_token()); }
+
+        /**
+         * @brief Request cancellation.
+         * 
+         * @return true if this call cancelled the source; false if it had already been cancelled.
+         * 
+         * Cancellation callbacks registered against the source's tokens run on the calling thread, 
+         * before Cancel() returns.
+         */
+        bool Cancel() noexcept
+        {
+            return source.request_stop();
+        }
+
+        bool IsCancelled() const noexcept { return source.stop_requested(); }
+
+        /**
+         * @brief Cancel the source after a delay.
+         * 
+         * @param timeout The delay.
+         * 
+         * Replaces any previous deadline. The deadline timer is cancelled when the source is destroyed.
+         */
+        void CancelAfter(CoDispatcher::Duration timeout)
+        {
+            CancelDeadline();
+            // (captures the shared stop state, so a timer that fires as the source is being destroyed is harmless.)
+            deadlineTimer = CoDispatcher::CurrentDispatcher().PostDelayedFunction(
+                timeout,
+                [source = this->source]() mutable {
+                    source.request_stop();
+                });
+            hasDeadline = true;
+        }
+
+    private:
+        struct ParentLink
+        {
+            std::stop_source *source;
+            void operator()() const noexcept { source->request_stop(); }
+        };
+        using ParentCallback = std::stop_callback<ParentLink>;
+
+        void Link(std::optional<ParentCallback> &link, const CoCancellationToken &parent)
+        {
+            if (parent.CanBeCancelled())
+            {
+                link.emplace(parent.token, ParentLink{&source});
+            }
+        }
+        void CancelDeadline()
+        {
+            if (hasDeadline)
+            {
+                hasDeadline = false;
+                CoDispatcher::ForegroundDispatcher().CancelTimer(deadlineTimer);
+            }
+        }
+
+        std::stop_source source;
+        std::optional<ParentCallback> parentLink1;
+        std::optional<ParentCallback> parentLink2;
+        bool hasDeadline = false;
+        CoDispatcher::TimerHandle deadlineTimer = 0;
+    };
+
+    /**
+     * @brief Non-throwing CoDelay().
+     * 
+     * @param delay The time to wait.
+     * @param cancellationToken A token that ends the delay early.
+     * @return CoStatus::Ok if the delay elapsed; CoStatus::Cancelled if it was cancelled.
+     */
+    inline CoTask<CoStatus> TryDelay(CoDispatcher::Duration delay, CoCancellationToken cancellationToken)
+    {
+        if (!cancellationToken.CanBeCancelled())
+        {
+            co_await CoDelay(delay);
+            co_return CoStatus::Ok;
+        }
+        if (cancellationToken.IsCancelled())
+        {
+            co_return CoStatus::Cancelled;
+        }
+        CoTimer timer;
+        bool completed;
+        {
+            CoCancellationCallback cancel{cancellationToken, [&timer]() { timer.Cancel(); }};
+            completed = co_await timer.Delay(delay);
+        }
+        co_return completed ? CoStatus::Ok : CoStatus::Cancelled;
+    }
+
+    /**
+     * @brief Suspend the current coroutine for the specified time, or until cancelled.
+     * 
+     * @param delay The time to wait.
+     * @param cancellationToken A token that ends the delay early.
+     * @throws CoCancelledException if the delay was cancelled.
+     */
+    inline CoTask<> CoDelay(CoDispatcher::Duration delay, CoCancellationToken cancellationToken)
+    {
+        ThrowIfFailed(co_await TryDelay(delay, std::move(cancellationToken)));
+    }
+}
@@ -0,0 +1,496 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "CoEvent.h"
+#include "Fifo.h"
+#include <atomic>
+#include <mutex>
+#include <span>
+#include <optional>
+#include <memory>
+#include <new>
+
+namespace cotask
+{
+    /**
+     * @brief Selects the CoChannel implementation.
+     * 
+     * Mpmc channels may be used by any number of producers and consumers. Spsc channels may be 
+     * used by at most one producing coroutine and one consuming coroutine at a time, and 
+     * transfer values without taking a lock unless one side has to wait.
+     */
+    enum class ChannelKind
+    {
+        Mpmc,
+        Spsc
+    };
+
+#ifndef DOXYGEN
+    namespace detail
+    {
+        template <typename T, ChannelKind KIND>
+        class ChannelBuffer;
+
+        // Mutex-protected fixed-capacity ring.
+        template <typename T>
+        class ChannelBuffer<T, ChannelKind::Mpmc>
+        {
+        public:
+            ChannelBuffer(size_t capacity) : ring(capacity, capacity) {}
+
+            size_t Capacity() const { return ring.capacity(); }
+
+            // Moves up to count values into the ring. Throws CoIoClosedException if closed.
+            size_t TryPush(T *values, size_t count)
+            {
+                std::lock_guard lock{mutex};
+                if (closed)
+                {
+                    throw CoIoClosedException();
+                }
+                size_t n = 0;
+                while (n < count && ring.size() < ring.capacity())
+                {
+                    ring.push(std::move(values[n++]));
+                }
+                return n;
+            }
+            // Calls sink(T&&) for up to maxCount values.
+            template <typename SINK>
+            size_t TryTake(size_t maxCount, SINK &&sink)
+            {
+                std::lock_guard lock{mutex};
+                size_t n = 0;
+                while (n < maxCount && !ring.empty())
+                {
+                    sink(ring.pop());
+                    ++n;
+                }
+                return n;
+            }
+            void Close()
+            {
+                std::lock_guard lock{mutex};
+                closed = true;
+            }
+            bool IsClosed()
+            {
+                std::lock_guard lock{mutex};
+                return closed;
+            }
+            size_t Size()
+            {
+                std::lock_guard lock{mutex};
+                return ring.size();
+            }
+
+        private:
+            std::mutex mutex;
+            Fifo<T> ring;
+            bool closed = false;
+        };
+
+        // Lock-free single-producer/single-consumer ring. head is only written by the consumer; 
+        // tail is only written by the producer. Accesses to the other side's index are seq_cst,
+        // so that they are ordered with respect to CoChannel's counts of waiting coroutines.
+        template <typename T>
+        class ChannelBuffer<T, ChannelKind::Spsc>
+        {
+        public:
+            ChannelBuffer(size_t capacity)
+            {
+                capacity_ = 1;
+                while (capacity_ < capacity)
+                {
+                    capacity_ *= 2;
+                }
+                slots = (T *)::operator new(capacity_ * sizeof(T), std::align_val_t(alignof(T)));
+            }
+            ~ChannelBuffer()
+            {
+                for (size_t i = head.load(); i != tail.load(); ++i)
+                {
+                    Slot(i)->~T();
+                }
+                ::operator delete(slots, std::align_val_t(alignof(T)));
+            }
+            size_t Capacity() const { return capacity_; }
+
+            size_t TryPush(T *values, size_t count)
+            {
+                if (closed.load(std::memory_order_acquire))
+                {
+                    throw CoIoClosedException();
+                }
+                size_t t = tail.load(std::memory_order_relaxed);
+                size_t available = capacity_ - (t - head.load(std::memory_order_seq_cst));
+                size_t n = std::min(count, available);
+                for (size_t i = 0; i < n; ++i)
+                {
+                    new (Slot(t + i)) T(std::move(values[i]));
+                }
+                if (n != 0)
+                {
+                    tail.store(t + n, std::memory_order_seq_cst);
+                }
+                return n;
+            }
+            template <typename SINK>
+            size_t TryTake(size_t maxCount, SINK &&sink)
+            {
+                size_t h = head.load(std::memory_order_relaxed);
+                size_t n = std::min(maxCount, tail.load(std::memory_order_seq_cst) - h);
+                for (size_t i = 0; i < n; ++i)
+                {
+                    T *slot = Slot(h + i);
+                    sink(std::move(*slot));
+                    slot->~T();
+                }
+                if (n != 0)
+                {
+                    head.store(h + n, std::memory_order_seq_cst);
+                }
+                return n;
+            }
+            void Close() { closed.store(true, std::memory_order_seq_cst); }
+            bool IsClosed() { return closed.load(std::memory_order_acquire); }
+            size_t Size() { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+
+        private:
+            T *Slot(size_t index) { return &slots[index & (capacity_ - 1)]; }
+
+            T *slots = nullptr;
+            size_t capacity_;
+            alignas(64) std::atomic<size_t> head = 0;
+            alignas(64) std::atomic<size_t> tail = 0;
+            std::atomic<bool> closed = false;
+        };
+    }
+#endif
+
+    /**
+     * @brief A bounded, thread-safe coroutine channel that transfers values of type T.
+     * 
+     * @tparam T The type of values in the channel. Must be move-constructible.
+     * @tparam KIND ChannelKind::Mpmc (the default) or ChannelKind::Spsc.
+     * 
+     * Values are moved into and out of a fixed-capacity ring that is allocated when the channel 
+     * is constructed, so transferring a value never allocates. PushMany() and TakeMany() transfer 
+     * batches of values with a single resume of a waiting coroutine.
+     * 
+     * Producers and consumers only touch the internal condition variables when they have to wait, 
+     * or when the other side is known to be waiting.
+     * 
+     * Pushing a value is a std::memory_order_release operation, and taking a value is a 
+     * std::memory_order_acquire operation.
+     */
+    template <typename T, ChannelKind KIND = ChannelKind::Mpmc>
+    class CoChannel
+    {
+    public:
+        using item_type = T;
+
+        /**
+         * @brief Constructor.
+         * 
+         * @param capacity The maximum number of values in the channel. Rounded up to a power of two.
+         */
+        CoChannel(size_t capacity) : buffer(capacity) {}
+        CoChannel(const CoChannel &) = delete;
+        CoChannel &operator=(const CoChannel &) = delete;
+
+        /**
+         * @brief Move a value into the channel.
+         * 
+         * @param value The value.
+         * @param timeout (optional) Time to wait for space in the channel.
+         * @throws CoTimedOutException on timeout.
+         * @throws CoIoClosedException if Close() has been called.
+         * 
+         * The current coroutine is suspended if the channel is full.
+         */
+        [[nodiscard]] CoTask<> Push(T value, CoDispatcher::Duration timeout = NO_TIMEOUT);
+
+        /**
+         * @brief Move values into the channel.
+         * 
+         * @param values Values to push.
+         * @param timeout (optional) Time to wait for space in the channel.
+         * @return The number of values that were pushed (at least one, if values is not empty).
+         * @throws CoTimedOutException on timeout.
+         * @throws CoIoClosedException if Close() has been called.
+         * 
+         * Suspends the current coroutine until there is space in the channel, and then pushes 
+         * as many values as will fit. values [0,result) are moved from. 
+         */
+        [[nodiscard]] CoTask<size_t> PushMany(std::span<T> values, CoDispatcher::Duration timeout = NO_TIMEOUT);
+
+        /**
+         * @brief Take a value from the channel.
+         * 
+         * @param timeout (optional) How long to wait for a value.
+         * @return CoTask<T> The value.
+         * @throws CoTimedOutException on timeout.
+         * @throws CoIoClosedException if Close() has been called, and the channel is empty.
+         */
+        [[nodiscard]] CoTask<T> Take(CoDispatcher::Duration timeout = NO_TIMEOUT);
+
+        /**
+         * @brief Take all available values from the channel, up to the size of the supplied buffer.
+         * 
+         * @param values Buffer that receives the values (by move-assignment).
+         * @param timeout (optional) How long to wait for a value.
+         * @return The number of values taken (at least one, if values is not empty).
+         * @throws CoTimedOutException on timeout.
+         * @throws CoIoClosedException if Close() has been called, and the channel is empty.
+         * 
+         * Suspends the current coroutine until at least one value is available.
+         */
+        [[nodiscard]] CoTask<size_t> TakeMany(std::span<T> values, CoDispatcher::Duration timeout = NO_TIMEOUT);
+
+        /**
+         * @brief Close the channel.
+         * 
+         * Subsequent attempts to Push() into the channel will throw a CoIoClosedException.
+         * Consumers may Take() any values that are in the channel already, and will receive 
+         * a CoIoClosedException once the channel has emptied.
+         */
+        void Close();
+
+        /**
+         * @brief Has the channel been closed?
+         */
+        bool IsClosed() { return buffer.IsClosed(); }
+
+        /**
+         * @brief Is the channel empty?
+         */
+        bool IsEmpty() { return buffer.Size() == 0; }
+
+        /**
+         * @brief The number of values in the channel.
+         */
+        size_t Size() { return buffer.Size(); }
+
+        /**
+         * @brief The maximum number of values in the channel.
+         */
+        size_t Capacity() const { return buffer.Capacity(); }
+
+    private:
+        size_t TryTakeMany(std::span<T> values)
+        {
+            size_t i = 0;
+            return buffer.TryTake(values.size(), [&values, &i](T &&value) { values[i++] = std::move(value); });
+        }
+        void OnPushed(size_t count)
+        {
+            if (count != 0 && waitingTakers.load(std::memory_order_seq_cst) != 0)
+            {
+                if (count == 1)
+                    takeCv.Notify();
+                else
+                    takeCv.NotifyAll([] {});
+            }
+        }
+        void OnTaken(size_t count)
+        {
+            if (count != 0 && waitingPushers.load(std::memory_order_seq_cst) != 0)
+            {
+                if (count == 1)
+                    pushCv.Notify();
+                else
+                    pushCv.NotifyAll([] {});
+            }
+        }
+
+        detail::ChannelBuffer<T, KIND> buffer;
+        CoConditionVariable pushCv;
+        CoConditionVariable takeCv;
+
+        // Coroutines that are (or are about to be) suspended in pushCv or takeCv. Counted before 
+        // the buffer is re-tested, so that the other side sees the count if it missed the re-test.
+        std::atomic<int> waitingPushers = 0;
+        std::atomic<int> waitingTakers = 0;
+    };
+
+    /*****  CoChannel inlines ****************************/
+
+    template <typename T, ChannelKind KIND>
+    CoTask<> CoChannel<T, KIND>::Push(T value, CoDispatcher::Duration timeout)
+    {
+        size_t pushed = co_await PushMany(std::span<T>(&value, 1), timeout);
+        (void)pushed;
+        co_return;
+    }
+
+    template <typename T, ChannelKind KIND>
+    CoTask<size_t> CoChannel<T, KIND>::PushMany(std::span<T> values, CoDispatcher::Duration timeout)
+    {
+        if (values.empty())
+        {
+            co_return 0;
+        }
+        size_t pushed = buffer.TryPush(values.data(), values.size());
+        if (pushed == 0)
+        {
+            bool counted = false;
+            try
+            {
+                co_await pushCv.Wait(
+                    timeout,
+                    [this, &values, &pushed, &counted]() {
+                        if (!counted)
+                        {
+                            counted = true;
+                            waitingPushers.fetch_add(1, std::memory_order_seq_cst);
+                        }
+                        pushed = buffer.TryPush(values.data(), values.size());
+                        if (pushed == 0)
+                        {
+                            return false; // suspend.
+                        }
+                        counted = false;
+                        waitingPushers.fetch_sub(1, std::memory_order_seq_cst);
+                        return true;
+                    });
+            }
+            catch (...)
+            {
+                if (counted)
+                {
+                    waitingPushers.fetch_sub(1, std::memory_order_seq_cst);
+                }
+                throw;
+            }
+        }
+        OnPushed(pushed);
+        co_return pushed;
+    }
+
+    template <typename T, ChannelKind KIND>
+    CoTask<T> CoChannel<T, KIND>::Take(CoDispatcher::Duration timeout)
+    {
+        std::optional<T> value;
+        auto sink = [&value](T &&v) { value.emplace(std::move(v)); };
+        if (buffer.TryTake(1, sink) == 0)
+        {
+            bool counted = false;
+            try
+            {
+                co_await takeCv.Wait(
+                    timeout,
+                    [this, &sink, &counted]() {
+                        if (!counted)
+                        {
+                            counted = true;
+                            waitingTakers.fetch_add(1, std::memory_order_seq_cst);
+                        }
+                        // (values pushed before Close() are visible once closed is observed.)
+                        bool closed = buffer.IsClosed();
+                        if (buffer.TryTake(1, sink) == 0)
+                        {
+                            if (closed)
+                            {
+                                throw CoIoClosedException();
+                            }
+                            return false; // suspend.
+                        }
+                        counted = false;
+                        waitingTakers.fetch_sub(1, std::memory_order_seq_cst);
+                        return true;
+                    });
+            }
+            catch (...)
+            {
+                if (counted)
+                {
+                    waitingTakers.fetch_sub(1, std::memory_order_seq_cst);
+                }
+                throw;
+            }
+        }
+        OnTaken(1);
+        co_return std::move(*value);
+    }
+
+    template <typename T, ChannelKind KIND>
+    CoTask<size_t> CoChannel<T, KIND>::TakeMany(std::span<T> values, CoDispatcher::Duration timeout)
+    {
+        if (values.empty())
+        {
+            co_return 0;
+        }
+        size_t taken = TryTakeMany(values);
+        if (taken == 0)
+        {
+            bool counted = false;
+            try
+            {
+                co_await takeCv.Wait(
+                    timeout,
+                    [this, &values, &taken, &counted]() {
+                        if (!counted)
+                        {
+                            counted = true;
+                            waitingTakers.fetch_add(1, std::memory_order_seq_cst);
+                        }
+                        bool closed = buffer.IsClosed();
+                        taken = TryTakeMany(values);
+                        if (taken == 0)
+                        {
+                            if (closed)
+                            {
+                                throw CoIoClosedException();
+                            }
+                            return false; // suspend.
+                        }
+                        counted = false;
+                        waitingTakers.fetch_sub(1, std::memory_order_seq_cst);
+                        return true;
+                    });
+            }
+            catch (...)
+            {
+                if (counted)
+                {
+                    waitingTakers.fetch_sub(1, std::memory_order_seq_cst);
+                }
+                throw;
+            }
+        }
+        OnTaken(taken);
+        co_return taken;
+    }
+
+    template <typename T, ChannelKind KIND>
+    void CoChannel<T, KIND>::Close()
+    {
+        buffer.Close();
+        takeCv.NotifyAll([] {});
+        pushCv.NotifyAll([] {});
+    }
+} // namespace
@@ -0,0 +1,56 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <chrono>
+
+namespace cotask
+{
+    /**
+     * @brief The clock used by CoDispatcher timers.
+     * 
+     */
+    using CoClock = std::chrono::steady_clock;
+
+    /**
+     * @brief The duration type used by CoDispatcher timers, delays and timeouts.
+     * 
+     * The resolution is selected at build time by the COTASK_TIMER_RESOLUTION cmake 
+     * option (ms, us or ns). Defaults to microseconds.
+     * 
+     * Time values are durations since the CoClock epoch (see CoDispatcher::Now()).
+     */
+#if defined(COTASK_TIMER_RESOLUTION_MS)
+    using CoDuration = std::chrono::milliseconds;
+#elif defined(COTASK_TIMER_RESOLUTION_NS)
+    using CoDuration = std::chrono::nanoseconds;
+#else
+    using CoDuration = std::chrono::microseconds;
+#endif
+
+    using CoTimePoint = std::chrono::time_point<CoClock, CoDuration>;
+
+} // namespace
@@ -0,0 +1,478 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "CoTask.h"
+#include "CoCancellation.h"
+#include <vector>
+#include <tuple>
+#include <variant>
+#include <optional>
+#include <memory>
+#include <atomic>
+#include <stdexcept>
+#include <cassert>
+
+namespace cotask
+{
+    /**
+     * @brief The result of WhenAny().
+     * 
+     * @tparam T The result type of the tasks.
+     */
+    template <typename T>
+    struct WhenAnyResult
+    {
+        /**
+         * @brief The index of the first task to complete.
+         */
+        size_t index = 0;
+        /**
+         * @brief The value returned by that task.
+         */
+        T value{};
+    };
+
+#ifndef DOXYGEN
+    namespace detail
+    {
+        template <typename TASK>
+        struct TaskResult;
+        template <typename T>
+        struct TaskResult<CoTask<T>>
+        {
+            using type = T;
+        };
+        template <>
+        struct TaskResult<CoTask<>>
+        {
+            using type = std::monostate;
+        };
+
+        template <typename TASK>
+        concept IsCoTask = requires { typename TaskResult<TASK>::type; };
+
+        // Awaits completion of a task without retrieving its result or rethrowing its exception.
+        template <typename TASK>
+        struct SettleAwaiter
+        {
+            TASK &task;
+
+            bool await_ready() const noexcept { return task.await_ready(); }
+            bool await_suspend(std::coroutine_handle<> coroutine) const noexcept { return task.await_suspend(coroutine); }
+            void await_resume() const noexcept {}
+        };
+        template <typename TASK>
+        SettleAwaiter<TASK> Settle(TASK &task)
+        {
+            assert(task.handle != nullptr);
+            return SettleAwaiter<TASK>{task};
+        }
+
+        // Append the exception of a completed task (if any) to exceptions.
+        template <typename TASK>
+        void CollectException(TASK &task, std::vector<std::exception_ptr> &exceptions)
+        {
+            auto &promise = task.handle.promise();
+            if (promise.unhandledException)
+            {
+                exceptions.push_back(promise.unhandledException);
+            }
+        }
+
+        // Move the result out of a task that completed without throwing.
+        template <typename TASK>
+        typename TaskResult<TASK>::type TakeResult(TASK &task)
+        {
+            if constexpr (std::is_same_v<TASK, CoTask<>>)
+            {
+                return std::monostate();
+            }
+            else
+            {
+                return task.handle.promise().TakeValue();
+            }
+        }
+
+        inline void ThrowExceptions(std::vector<std::exception_ptr> &&exceptions)
+        {
+            if (exceptions.size() == 1)
+            {
+                std::rethrow_exception(exceptions[0]);
+            }
+            if (exceptions.size() > 1)
+            {
+                throw CoAggregateException(std::move(exceptions));
+            }
+        }
+
+        template <typename T>
+        struct WhenAnyState
+        {
+            // Set by the first task to complete.
+            std::atomic<bool> claimed = false;
+            size_t index = 0;
+            std::optional<T> value;
+            std::exception_ptr exception;
+            // Cancelled by the first task to complete. (WhenAny() with task factories only.)
+            std::optional<CoCancellationSource> cancellation;
+
+            // The awaiting WhenAny() coroutine; or the address of this object, once the
+            // winner's result has been stored. (The same protocol as CoTask's precursor.)
+            std::atomic<void *> continuation = nullptr;
+
+            std::coroutine_handle<> Complete() noexcept
+            {
+                void *precursor = continuation.exchange(this, std::memory_order_acq_rel);
+                if (precursor)
+                {
+                    return std::coroutine_handle<>::from_address(precursor);
+                }
+                return std::noop_coroutine();
+            }
+
+            struct Awaiter
+            {
+                WhenAnyState *state;
+
+                bool await_ready() const noexcept
+                {
+                    return state->continuation.load(std::memory_order_acquire) == state;
+                }
+                bool await_suspend(std::coroutine_handle<> coroutine) const noexcept
+                {
+                    void *expected = nullptr;
+                    return state->continuation.compare_exchange_strong(expected, coroutine.address(), std::memory_order_acq_rel);
+                }
+                void await_resume() const noexcept {}
+            };
+        };
+
+        // A self-destroying coroutine that owns one of the tasks passed to WhenAny().
+        struct WhenAnyWatcher
+        {
+            struct promise_type
+            {
+                static void *operator new(size_t size) { return CoFrameAllocator::Allocate(size); }
+                static void operator delete(void *p, size_t size) noexcept { CoFrameAllocator::Free(p, size); }
+
+                WhenAnyWatcher get_return_object() noexcept { return {}; }
+                std::suspend_never initial_suspend() const noexcept { return {}; }
+                std::suspend_never final_suspend() const noexcept { return {}; }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept { std::terminate(); }
+            };
+        };
+
+        template <typename TASK>
+        WhenAnyWatcher WatchTask(std::shared_ptr<WhenAnyState<typename TaskResult<TASK>::type>> state, size_t index, TASK task)
+        {
+            co_await Settle(task);
+            if (!state->claimed.exchange(true, std::memory_order_acq_rel))
+            {
+                state->index = index;
+                auto &promise = task.handle.promise();
+                if (promise.unhandledException)
+                {
+                    state->exception = promise.unhandledException;
+                }
+                else
+                {
+                    try
+                    {
+                        if constexpr (std::is_same_v<TASK, CoTask<>>)
+                        {
+                            state->value.emplace();
+                        }
+                        else
+                        {
+                            state->value.emplace(promise.TakeValue());
+                        }
+                    }
+                    catch (...)
+                    {
+                        state->exception = std::current_exception();
+                    }
+                }
+                if (state->cancellation)
+                {
+                    state->cancellation->Cancel(); // the losers.
+                }
+                state->Complete().resume();
+            }
+        }
+
+        template <typename TASK>
+        std::shared_ptr<WhenAnyState<typename TaskResult<TASK>::type>> WatchTasks(std::vector<TASK> &tasks)
+        {
+            if (tasks.empty())
+            {
+                throw std::invalid_argument("WhenAny: no tasks.");
+            }
+            auto state = std::make_shared<WhenAnyState<typename TaskResult<TASK>::type>>();
+            for (size_t i = 0; i < tasks.size(); ++i)
+            {
+                WatchTask(state, i, std::move(tasks[i]));
+            }
+            return state;
+        }
+
+        template <typename FACTORY>
+        using FactoryTask = std::invoke_result_t<FACTORY &, CoCancellationToken>;
+
+        // Start the tasks returned by factories, passing each a token that the first task to complete cancels.
+        template <typename TASK, typename... FACTORIES>
+        std::shared_ptr<WhenAnyState<typename TaskResult<TASK>::type>> StartTasks(const CoCancellationToken &cancellationToken, FACTORIES &...factories)
+        {
+            auto state = std::make_shared<WhenAnyState<typename TaskResult<TASK>::type>>();
+            state->cancellation.emplace(cancellationToken);
+            CoCancellationToken token = state->cancellation->Token();
+            size_t index = 0;
+            (WatchTask(state, index++, TASK(factories(token))), ...);
+            return state;
+        }
+
+        template <typename T>
+        CoTask<WhenAnyResult<T>> AwaitAny(std::shared_ptr<WhenAnyState<T>> state)
+        {
+            co_await typename WhenAnyState<T>::Awaiter{state.get()};
+            if (state->exception)
+            {
+                std::rethrow_exception(state->exception);
+            }
+            co_return WhenAnyResult<T>{state->index, std::move(*(state->value))};
+        }
+        inline CoTask<size_t> AwaitAny(std::shared_ptr<WhenAnyState<std::monostate>> state)
+        {
+            co_await WhenAnyState<std::monostate>::Awaiter{state.get()};
+            if (state->exception)
+            {
+                std::rethrow_exception(state->exception);
+            }
+            co_return state->index;
+        }
+    }
+#endif
+
+    /**
+     * @brief Wait for all of a group of tasks to complete.
+     * 
+     * @param tasks The tasks to wait for.
+     * @return CoTask<std::vector<T>> (awaitable) The results of the tasks, in the same order as tasks.
+     * 
+     * CoTasks start running as soon as they are called, so tasks that suspend (waiting for i/o, 
+     * timers, or background threads) run concurrently, and the latency of the group is that of the 
+     * slowest task instead of the sum of all of them.
+     * 
+     * All tasks are awaited, even if some of them fail. If a single task throws, its exception is 
+     * rethrown. If more than one task throws, a CoAggregateException containing all of the 
+     * exceptions is thrown.
+     * 
+     * Usage:
+     * 
+     *      std::vector<CoTask<int>> tasks;
+     *      for (auto &name: names) {
+     *          tasks.push_back(GetValue(name));
+     *      }
+     *      std::vector<int> values = co_await WhenAll(std::move(tasks));
+     */
+    template <typename T>
+    CoTask<std::vector<T>> WhenAll(std::vector<CoTask<T>> tasks)
+    {
+        for (auto &task : tasks)
+        {
+            co_await detail::Settle(task);
+        }
+        std::vector<std::exception_ptr> exceptions;
+        for (auto &task : tasks)
+        {
+            detail::CollectException(task, exceptions);
+        }
+        detail::ThrowExceptions(std::move(exceptions));
+
+        std::vector<T> results;
+        results.reserve(tasks.size());
+        for (auto &task : tasks)
+        {
+            results.push_back(detail::TakeResult(task));
+        }
+        co_return std::move(results);
+    }
+
+    /**
+     * @brief Wait for all of a group of CoTask<> tasks to complete.
+     * 
+     * @param tasks The tasks to wait for.
+     * 
+     * See WhenAll(std::vector<CoTask<T>>).
+     */
+    inline CoTask<> WhenAll(std::vector<CoTask<>> tasks)
+    {
+        for (auto &task : tasks)
+        {
+            co_await detail::Settle(task);
+        }
+        std::vector<std::exception_ptr> exceptions;
+        for (auto &task : tasks)
+        {
+            detail::CollectException(task, exceptions);
+        }
+        detail::ThrowExceptions(std::move(exceptions));
+    }
+
+    /**
+     * @brief Wait for all of a set of tasks of differing types to complete.
+     * 
+     * @param tasks The tasks to wait for.
+     * @return (awaitable) A std::tuple containing the result of each task. The results of CoTask<> 
+     * tasks are std::monostate.
+     * 
+     * Exceptions are handled as for WhenAll(std::vector<CoTask<T>>).
+     * 
+     * Usage:
+     * 
+     *      auto [stations, _] = co_await WhenAll(ListSta(), SetWpaProperty("name", "value"));
+     */
+    template <typename... TASKS>
+        requires(sizeof...(TASKS) > 0 && (detail::IsCoTask<TASKS> && ...))
+    CoTask<std::tuple<typename detail::TaskResult<TASKS>::type...>> WhenAll(TASKS... tasks)
+    {
+        (co_await detail::Settle(tasks), ...);
+
+        std::vector<std::exception_ptr> exceptions;
+        (detail::CollectException(tasks, exceptions), ...);
+        detail::ThrowExceptions(std::move(exceptions));
+
+        co_return std::tuple<typename detail::TaskResult<TASKS>::type...>{detail::TakeResult(tasks)...};
+    }
+
+    /**
+     * @brief Wait for the first of a group of tasks to complete.
+     * 
+     * @param tasks The tasks to wait for.
+     * @return CoTask<WhenAnyResult<T>> (awaitable) The index and result of the first task to complete.
+     * @throws The exception thrown by the first task to complete, if it failed.
+     * @throws std::invalid_argument if tasks is empty.
+     * 
+     * WhenAny() takes ownership of the tasks. The remaining tasks are not awaited: they continue to 
+     * run, and are destroyed when they complete; their results and exceptions are discarded. Tasks must 
+     * not reference objects that might be destroyed before they complete. To cancel the remaining 
+     * tasks, use WhenAny(CoCancellationToken, FIRST, MORE...).
+     * 
+     * If the first task to complete is running on a background thread, the awaiting coroutine resumes
+     * on that thread, as it would if it had awaited the task directly.
+     */
+    template <typename T>
+    CoTask<WhenAnyResult<T>> WhenAny(std::vector<CoTask<T>> tasks)
+    {
+        return detail::AwaitAny(detail::WatchTasks(tasks));
+    }
+
+    /**
+     * @brief Wait for the first of a group of CoTask<> tasks to complete.
+     * 
+     * @param tasks The tasks to wait for.
+     * @return CoTask<size_t> (awaitable) The index of the first task to complete.
+     * 
+     * See WhenAny(std::vector<CoTask<T>>).
+     */
+    inline CoTask<size_t> WhenAny(std::vector<CoTask<>> tasks)
+    {
+        return detail::AwaitAny(detail::WatchTasks(tasks));
+    }
+
+    /**
+     * @brief Wait for the first of a set of tasks to complete.
+     * 
+     * Equivalent to WhenAny(std::vector<CoTask<T>>) with the supplied tasks.
+     */
+    template <typename T, typename... MORE>
+        requires(std::is_same_v<MORE, CoTask<T>> && ...)
+    CoTask<WhenAnyResult<T>> WhenAny(CoTask<T> first, MORE... more)
+    {
+        std::vector<CoTask<T>> tasks;
+        tasks.reserve(1 + sizeof...(MORE));
+        tasks.push_back(std::move(first));
+        (tasks.push_back(std::move(more)), ...);
+        return WhenAny(std::move(tasks));
+    }
+
+    /**
+     * @brief Wait for the first of a set of CoTask<> tasks to complete.
+     * 
+     * Equivalent to WhenAny(std::vector<CoTask<>>) with the supplied tasks.
+     */
+    template <typename... MORE>
+        requires(std::is_same_v<MORE, CoTask<>> && ...)
+    CoTask<size_t> WhenAny(CoTask<> first, MORE... more)
+    {
+        std::vector<CoTask<>> tasks;
+        tasks.reserve(1 + sizeof...(MORE));
+        tasks.push_back(std::move(first));
+        (tasks.push_back(std::move(more)), ...);
+        return WhenAny(std::move(tasks));
+    }
+
+    /**
+     * @brief Wait for the first of a set of tasks to complete, and cancel the others.
+     * 
+     * @param cancellationToken Cancels all of the tasks.
+     * @param first,more Callables that take a CoCancellationToken, and return the task to run. All 
+     * must return the same CoTask type.
+     * @return (awaitable) As for WhenAny(std::vector<CoTask<T>>): a WhenAnyResult<T>, or the index 
+     * of the first task to complete for CoTask<> tasks.
+     * 
+     * The factories are called in order before WhenAny() returns. Each is passed a token that is 
+     * cancelled as soon as the first task completes, or when cancellationToken is cancelled. The 
+     * losing tasks are not awaited, but cancellable operations that they are waiting for 
+     * (CoDelay(), CoConditionVariable::Wait(), CoFile i/o) end early, typically with a 
+     * CoCancelledException, which is discarded along with the rest of their results.
+     * 
+     *      auto [index, line] = co_await WhenAny(
+     *          shutdownToken,
+     *          [&file](CoCancellationToken token) { return ReadRequest(file, token); },
+     *          [](CoCancellationToken token) { return ReadTimeout(5s, token); });
+     */
+    template <typename FIRST, typename... MORE>
+        requires(detail::IsCoTask<detail::FactoryTask<FIRST>> &&
+                 (std::is_same_v<detail::FactoryTask<MORE>, detail::FactoryTask<FIRST>> && ...))
+    auto WhenAny(CoCancellationToken cancellationToken, FIRST first, MORE... more)
+    {
+        return detail::AwaitAny(detail::StartTasks<detail::FactoryTask<FIRST>>(cancellationToken, first, more...));
+    }
+
+    /**
+     * @brief Wait for the first of a set of tasks to complete, and cancel the others.
+     * 
+     * Equivalent to WhenAny(CoCancellationToken, FIRST, MORE...) with a token that is never cancelled.
+     */
+    template <typename FIRST, typename... MORE>
+        requires(detail::IsCoTask<detail::FactoryTask<FIRST>> &&
+                 (std::is_same_v<detail::FactoryTask<MORE>, detail::FactoryTask<FIRST>> && ...))
+    auto WhenAny(FIRST first, MORE... more)
+    {
+        return WhenAny(CoCancellationToken(), std::move(first), std::move(more)...);
+    }
+}
@@ -28,8 +28,12 @@
 #include <vector>
 #include <functional>
 #include <mutex>
+#include <type_traits>
+#include <optional>
 #include "CoService.h"
 #include "AsyncIo.h"
+#include "InplaceFunction.h"
+#include "CoCancellation.h"
 
 namespace cotask
 {
@@ -95,14 +99,21 @@ namespace cotask
         friend class detail::CoConditionaVariableImplementation;
 
     public:
+        /**
+         * @brief Type of the conditionTest argument of Wait().
+         */
+        using ConditionTest = InplaceFunction<bool(void)>;
+
         ~CoConditionVariable();
         /**
          * @brief Suspend execution until conditionTest returns true.
          * 
          * @param conditionTest An optional condition check (see remarks).
          * @param timeout An optional timeout. 
+         * @param cancellationToken An optional cancellation token.
          * @return Task<> 
          * @throws CoTimedOutException on timeout.
+         * @throws CoCancelledException if the token is cancelled while the coroutine is suspended.
          * 
          * The conditionTest callback returns a boolean, indicating whether the 
          * current coroutine should be allowed to procede, or whether it should be suspended.
@@ -125,8 +136,9 @@ namespace cotask
 
          */
         [[nodiscard]] CoTask<> Wait(
-            std::chrono::milliseconds timeout,
-            std::function<bool(void)> conditionTest = nullptr);
+            CoDispatcher::Duration timeout,
+            ConditionTest conditionTest = nullptr,
+            CoCancellationToken cancellationToken = CoCancellationToken());
 
         /**
          * @brief Suspend execution until conditionTest returns true.
@@ -154,10 +166,42 @@ namespace cotask
          * 
          * Used as the basis of other synchronization methods, such as CoMutex.
          */
-        [[nodiscard]] CoTask<> Wait(std::function<bool(void)> conditionTest)
+        [[nodiscard]] CoTask<> Wait(ConditionTest conditionTest)
         {
-            co_await Wait(NO_TIMEOUT, conditionTest);
-            co_return;
+            return Wait(NO_TIMEOUT, std::move(conditionTest));
+        }
+
+        /**
+         * @brief Suspend execution until conditionTest returns true.
+         * 
+         * @param timeout A timeout, or NO_TIMEOUT.
+         * @param conditionTest A callable object returning bool (see remarks).
+         * @param cancellationToken An optional cancellation token.
+         * @throws CoTimedOutException on timeout.
+         * @throws CoCancelledException if the token is cancelled while the coroutine is suspended.
+         * 
+         * Behaves like Wait(timeout,ConditionTest); but conditionTest is stored by value, 
+         * without type erasure, so lambdas with large captures don't allocate, and the 
+         * body of the test can be inlined into the (per-type) function that calls it 
+         * while the internal mutex is held.
+         */
+        template <typename PRED>
+        requires(!std::is_same_v<PRED, ConditionTest> && std::is_invocable_r_v<bool, PRED &>)
+        [[nodiscard]] CoTask<> Wait(CoDispatcher::Duration timeout, PRED conditionTest, CoCancellationToken cancellationToken = CoCancellationToken());
+
+        /**
+         * @brief Suspend execution until conditionTest returns true.
+         * 
+         * @param conditionTest A callable object returning bool.
+         * 
+         * Behaves like Wait(ConditionTest); but conditionTest is stored by value, without
+         * type erasure.
+         */
+        template <typename PRED>
+        requires(!std::is_same_v<std::decay_t<PRED>, ConditionTest> && std::is_invocable_r_v<bool, std::decay_t<PRED> &>)
+        [[nodiscard]] CoTask<> Wait(PRED &&conditionTest)
+        {
+            return Wait<std::decay_t<PRED>>(NO_TIMEOUT, std::forward<PRED>(conditionTest));
         }
         /**
          * @brief Suspend execution of a courinte until a call to Notify() is made.
@@ -175,14 +219,48 @@ namespace cotask
 
         [[nodiscard]] CoTask<> Wait()
         {
-            co_await Wait(std::chrono::milliseconds(NO_TIMEOUT), nullptr);
-            co_return;
+            return Wait(NO_TIMEOUT, nullptr);
         }
 
         /**
-         * @brief Wake up one waiters.
+         * @brief Non-throwing Wait().
+         * 
+         * @param timeout A timeout, or NO_TIMEOUT.
+         * @param conditionTest An optional condition check (see Wait()).
+         * @param cancellationToken An optional cancellation token.
+         * @return CoStatus::Ok if conditionTest succeeded; CoStatus::TimedOut, CoStatus::Cancelled, 
+         * or CoStatus::Closed (if the condition variable was destroyed) otherwise.
+         * 
+         * Behaves like Wait(), but reports timeouts, cancellation and closing as a return value 
+         * instead of throwing. Exceptions thrown by conditionTest are still propagated.
+         */
+        [[nodiscard]] CoTask<CoStatus> TryWait(
+            CoDispatcher::Duration timeout,
+            ConditionTest conditionTest = nullptr,
+            CoCancellationToken cancellationToken = CoCancellationToken());
+
+        /**
+         * @brief Non-throwing Wait().
          * 
-         * @param notifyAction An optional function to perform in protected context (see remarks)
+         * Behaves like TryWait(timeout,ConditionTest); but conditionTest is stored by value, 
+         * without type erasure.
+         */
+        template <typename PRED>
+        requires(!std::is_same_v<PRED, ConditionTest> && std::is_invocable_r_v<bool, PRED &>)
+        [[nodiscard]] CoTask<CoStatus> TryWait(CoDispatcher::Duration timeout, PRED conditionTest, CoCancellationToken cancellationToken = CoCancellationToken());
+
+        /**
+         * @brief Wake up one waiter.
+         * 
+         * Wakes the first awaiter whose condition test succeeds; or, if there are no 
+         * awaiters, sets the ready flag tested by the default conditionTest.
+         */
+        void Notify();
+
+        /**
+         * @brief Wake up one waiter.
+         * 
+         * @param notifyAction A function to perform in protected context (see remarks)
          * 
          * notifyAction is called while the internal condition variable mutex is held. Operations performed in the 
          * notifyAction call are guaranteed to be thread-safe with respect to Wait() calls, other
@@ -192,8 +270,17 @@ namespace cotask
          * 
          *     [] () { this->ready = true; }
          * 
+         * notifyAction is called directly, without being converted to a std::function, 
+         * so capturing lambdas don't allocate.
          */
-        void Notify(function<void(void)> notifyAction = nullptr);
+        template <typename ACTION>
+        void Notify(ACTION &&notifyAction)
+        {
+            CheckUseAfterFree();
+            std::unique_lock lock{mutex};
+            notifyAction();
+            NotifyOne(lock);
+        }
 
         /**
          * @brief Wake up all watiers.
@@ -207,7 +294,14 @@ namespace cotask
          * Note that NotifyAll() only makes sense when used with non-default notify- and conditionTest 
          * parameters.
          */
-        void NotifyAll(function<void(void)> notifyAction);
+        template <typename ACTION>
+        void NotifyAll(ACTION &&notifyAction)
+        {
+            CheckUseAfterFree();
+            std::unique_lock lock{mutex};
+            notifyAction();
+            NotifyAll(lock);
+        }
         /**
          * @brief Execute a function synchronously while the wait mutex is held.
          * 
@@ -223,13 +317,18 @@ namespace cotask
          * 
          * 
          */
-        void Execute(function<void(void)> executeAction);
+        template <typename ACTION>
+        void Execute(ACTION &&executeAction)
+        {
+            std::lock_guard lock{mutex};
+            executeAction();
+        }
         /**
          * @brief Execute a function synchronously while the internal wait mutex is held, and return a value.
          * 
-         * @tparam T 
+         * @tparam T The return type. Defaults to the return type of testAction.
          * @param testAction 
-         * @return T The value returned by testAction.
+         * @return The value returned by testAction.
          * 
          * testAction is called while protected by the internal mutex; but, unlike Notify(), no attempt is made to 
          * resume awaiting coroutines. Test() returns the value returned by executeAction.
@@ -240,8 +339,12 @@ namespace cotask
          *             cv.Test([] { return queue.empty(); });
          *      }
          */
-        template <class T>
-        T Test(function<T(void)> testAction);
+        template <typename T = void, typename ACTION>
+        std::conditional_t<std::is_void_v<T>, std::invoke_result_t<ACTION &>, T> Test(ACTION &&testAction)
+        {
+            std::lock_guard lock{mutex};
+            return testAction();
+        }
 
 
         std::mutex&Mutex() { return mutex; }
@@ -251,6 +354,8 @@ namespace cotask
         uint32_t deleted = 0;
 
         void CheckUseAfterFree();
+        void NotifyOne(std::unique_lock<std::mutex> &lock);
+        void NotifyAll(std::unique_lock<std::mutex> &lock);
 
         struct Awaiter
         {
@@ -258,15 +363,67 @@ namespace cotask
             bool closed = false;
             CoConditionVariable *this_ = nullptr;
             std::exception_ptr exceptionPtr;
-            std::function<bool(void)> conditionTest;
-            std::chrono::milliseconds timeout;
+            // The condition test (or nullptr for the default test), called with conditionContext. 
+            bool (*conditionTest)(void *conditionContext) = nullptr;
+            void *conditionContext = nullptr;
+            CoDispatcher::Duration timeout;
             CoServiceCallback<void> *pCallback = nullptr;
+
+            // Cancellation is delivered like a Notify(): the cancellation callback unlinks the 
+            // awaiter under the mutex and completes it with CoStatus::Cancelled, so it races 
+            // notifies, timeouts and closing in exactly the same way that they race each other.
+            // The callback is unregistered as soon as the awaiter has been completed, so it never 
+            // outlives the condition variable.
+
+            // How the wait ended, if it wasn't notified. Closing and cancellation are reported here, 
+            // rather than through exceptionPtr, so that TryWait() never throws for them.
+            CoStatus status = CoStatus::Ok;
+
+            // The condition variable being waited on. (Unlike this_, not cleared when unlinked.)
+            CoConditionVariable *owner = nullptr;
+            CoCancellationToken cancellationToken;
+            // Set (under the mutex) if cancellation arrives before the awaiter has been linked.
+            bool cancelRequested = false;
+            bool inCancellationCallback = false;
+            struct CancellationCallback
+            {
+                Awaiter *awaiter;
+                void operator()() const noexcept { awaiter->OnCancelled(); }
+            };
+            std::optional<CoCancellationCallback<CancellationCallback>> cancellationCallback;
+            void OnCancelled() noexcept;
+            void ReleaseCancellation()
+            {
+                // (a callback may not unregister itself.)
+                if (!inCancellationCallback)
+                {
+                    cancellationCallback.reset();
+                }
+            }
+
+            // Intrusive links in the condition variable's awaiter list. After an awaiter is 
+            // unlinked, next is reused to chain it onto a (stack-rooted) list of awaiters to complete.
+            Awaiter *prev = nullptr;
+            Awaiter *next = nullptr;
+            template <typename PRED>
+            void SetConditionTest(PRED *pConditionTest)
+            {
+                conditionTest = [](void *context) -> bool {
+                    return (*static_cast<PRED *>(context))();
+                };
+                conditionContext = pConditionTest;
+            }
+            bool TestCondition()
+            {
+                return conditionTest(conditionContext);
+            }
             void UnhandledException()
             {
                 exceptionPtr = std::current_exception();
             }
             void SetComplete()
             {
+                ReleaseCancellation();
                 auto t = pCallback;
                 pCallback = nullptr;
                 if (exceptionPtr)
@@ -277,12 +434,79 @@ namespace cotask
                 }
             }
         };
-        std::vector<Awaiter *> awaiters;
+        Awaiter *awaitersHead = nullptr;
+        Awaiter *awaitersTail = nullptr;
 
         void AddAwaiter(Awaiter *awaiter);
         bool RemoveAwaiter(Awaiter *awaiter);
+        void UnlinkAwaiter(Awaiter *awaiter);
     };
 
+#ifndef DOXYGEN
+    namespace detail
+    {
+        // friend of CoConditionaVariable
+        class CoConditionaVariableImplementation
+        {
+        public:
+            struct Implementation : CoConditionVariable::Awaiter
+            {
+                ~Implementation();
+
+                using return_type = void;
+
+                void Execute(CoServiceCallback<void> *pCallback);
+                bool CancelExecute(CoServiceCallback<void> *pCallback);
+            };
+            // Not copyable (the condition test lives in the calling coroutine's frame), so Wait() constructs it in place.
+            using WaitService = CoService<Implementation>;
+
+            // Awaits a WaitService, returning a CoStatus instead of throwing.
+            struct TryAwaiter
+            {
+                WaitService &service;
+
+                bool await_ready() const noexcept { return service.await_ready(); }
+                bool await_suspend(std::coroutine_handle<> coroutine) noexcept { return service.await_suspend(coroutine); }
+                CoStatus await_resume() const
+                {
+                    CoStatus result = service.TryResume();
+                    return result == CoStatus::Ok ? service.status : result;
+                }
+            };
+        };
+    }
+#endif
+
+    template <typename PRED>
+    requires(!std::is_same_v<PRED, CoConditionVariable::ConditionTest> && std::is_invocable_r_v<bool, PRED &>)
+    CoTask<> CoConditionVariable::Wait(CoDispatcher::Duration timeout, PRED conditionTest, CoCancellationToken cancellationToken)
+    {
+        CheckUseAfterFree();
+        detail::CoConditionaVariableImplementation::WaitService awaiter;
+        awaiter.this_ = this;
+        awaiter.owner = this;
+        awaiter.SetConditionTest(&conditionTest);
+        awaiter.timeout = timeout;
+        awaiter.cancellationToken = std::move(cancellationToken);
+        ThrowIfFailed(co_await detail::CoConditionaVariableImplementation::TryAwaiter{awaiter});
+        co_return;
+    }
+
+    template <typename PRED>
+    requires(!std::is_same_v<PRED, CoConditionVariable::ConditionTest> && std::is_invocable_r_v<bool, PRED &>)
+    CoTask<CoStatus> CoConditionVariable::TryWait(CoDispatcher::Duration timeout, PRED conditionTest, CoCancellationToken cancellationToken)
+    {
+        CheckUseAfterFree();
+        detail::CoConditionaVariableImplementation::WaitService awaiter;
+        awaiter.this_ = this;
+        awaiter.owner = this;
+        awaiter.SetConditionTest(&conditionTest);
+        awaiter.timeout = timeout;
+        awaiter.cancellationToken = std::move(cancellationToken);
+        co_return co_await detail::CoConditionaVariableImplementation::TryAwaiter{awaiter};
+    }
+
     /**
      * @brief Prevents simultaneous execution of code or resources.
      * 
@@ -366,20 +590,4 @@ namespace cotask
     };
 
 
-    /******* CoConditionVariable inlines ***************/
-
-    template <class T>
-    T CoConditionVariable::Test(function<T(void)> testAction)
-    {
-        std::lock_guard lock{mutex};
-        return testAction();
-    }
-
-    inline void CoConditionVariable::Execute(std::function<void()> executeAction)
-    {
-        std::lock_guard lock { mutex};
-        executeAction();
-    }
-
-
 } // namespace
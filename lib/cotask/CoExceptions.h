@@ -24,6 +24,8 @@
 
 #pragma once
 #include <string>
+#include <vector>
+#include <exception>
 
 namespace cotask {
 
@@ -61,6 +63,49 @@ namespace cotask {
         }
     };
 
+    /**
+     * @brief More than one of a group of concurrent operations failed.
+     * 
+     * Thrown by WhenAll() when more than one of the awaited tasks threw an exception. 
+     * Exceptions() contains the exceptions in the order in which the tasks were supplied.
+     */
+    class CoAggregateException : public CoException
+    {
+    public:
+        using base = CoException;
+
+        CoAggregateException(std::vector<std::exception_ptr> &&exceptions)
+            : exceptions_(std::move(exceptions))
+        {
+            what_ = std::to_string(exceptions_.size()) + " operations failed.";
+            try
+            {
+                if (!exceptions_.empty())
+                {
+                    std::rethrow_exception(exceptions_[0]);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                what_ += std::string(" (") + e.what() + ")";
+            }
+            catch (...)
+            {
+            }
+        }
+
+        virtual const char *what() const noexcept
+        {
+            return what_.c_str();
+        }
+
+        const std::vector<std::exception_ptr> &Exceptions() const { return exceptions_; }
+
+    private:
+        std::string what_;
+        std::vector<std::exception_ptr> exceptions_;
+    };
+
     /**
      * @brief An i/o exception.
      * 
@@ -146,5 +191,61 @@ namespace cotask {
         }
     };
 
+    /**
+     * @brief The outcome of a non-throwing wait (TryWait(), TryRead(), TryDelay(), &c).
+     * 
+     * Timeouts, cancellation and closing are expected outcomes in loops that poll or 
+     * shut down; the Try... methods report them as a CoStatus instead of throwing. 
+     * Genuine errors (i/o errors, exceptions thrown by condition tests) are still thrown.
+     */
+    enum class CoStatus
+    {
+        /** @brief The operation completed. */
+        Ok,
+        /** @brief The operation timed out (CoTimedOutException). */
+        TimedOut,
+        /** @brief The operation was cancelled (CoCancelledException). */
+        Cancelled,
+        /** @brief The condition variable or file was closed (CoIoClosedException). */
+        Closed
+    };
+
+    /**
+     * @brief Throw the exception that the throwing equivalent of a Try... method would have thrown.
+     * 
+     * @param status The status returned by a Try... method. Does nothing if CoStatus::Ok.
+     */
+    inline void ThrowIfFailed(CoStatus status)
+    {
+        switch (status)
+        {
+        case CoStatus::Ok:
+            return;
+        case CoStatus::TimedOut:
+            throw CoTimedOutException();
+        case CoStatus::Cancelled:
+            throw CoCancelledException();
+        case CoStatus::Closed:
+            throw CoIoClosedException();
+        }
+    }
+
+    /**
+     * @brief A value, or the reason that there isn't one.
+     * 
+     * Returned by Try... methods that produce a value. value is only meaningful if 
+     * status is CoStatus::Ok.
+     */
+    template <typename T>
+    struct CoResult
+    {
+        CoStatus status = CoStatus::Ok;
+        T value{};
+
+        /** @brief Did the operation complete? */
+        bool Ok() const noexcept { return status == CoStatus::Ok; }
+        explicit operator bool() const noexcept { return Ok(); }
+    };
+
 
 } // namespace.
\ No newline at end of file
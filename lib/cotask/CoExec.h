@@ -110,7 +110,7 @@ namespace cotask
         /**
          * @brief Syncrhonously wait for the child process to terminate.
          * 
-         * @param timeoutMs (Optional) How long to wait.
+         * @param timeout (Optional) How long to wait.
          * @return true if the process terminated normally.
          * @return false if the process terminated abnormally.
          * @throws CoTimeoutException if a timeout occurs.
@@ -123,13 +123,13 @@ namespace cotask
          * Wait() returns immediately if no process was started.
          * 
          */
-        bool Wait(std::chrono::milliseconds timeoutMs = NO_TIMEOUT);
+        bool Wait(CoDispatcher::Duration timeout = NO_TIMEOUT);
 
  
         /**
          * @brief Wait for the child process to terminate.
          * 
-         * @param timeoutMs (Optional) How long to wait.
+         * @param timeout (Optional) How long to wait.
          * @return true if the process terminated normally.
          * @return false if the process terminated abnormally.
          * @throws CoTimeoutException if a timeout occurs.
@@ -141,7 +141,7 @@ namespace cotask
          * Wait() returns immediately if no process was started.
          * 
          */
-        CoTask<bool> CoWait(std::chrono::milliseconds timeoutMs = NO_TIMEOUT);
+        CoTask<bool> CoWait(CoDispatcher::Duration timeout = NO_TIMEOUT);
         
         /**
          * @brief Discard all present and future output on Stdout and Stderr.
@@ -185,7 +185,7 @@ namespace cotask
          * @param gracePeriod the time to wait for the process to respond to Kill(SignalType::Interrupt. (Default 3000ms).
 
          */
-        CoTask<> CoKill(std::chrono::milliseconds gracePeriod = std::chrono::milliseconds(3000));
+        CoTask<> CoKill(CoDispatcher::Duration gracePeriod = std::chrono::milliseconds(3000));
 
         /**
          * @brief The urgency with which Signal() should be handled by the child process.
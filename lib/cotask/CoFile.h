@@ -28,6 +28,8 @@
 #include <string>
 #include <sstream>
 #include "CoEvent.h"
+#include "AsyncGenerator.h"
+#include <atomic>
 
 
 namespace cotask {
@@ -39,6 +41,67 @@ namespace cotask {
     class CoFile
     {
     private:
+        class ReadyAwaiter;
+
+        /**
+         * @brief Readiness state for one direction of a file.
+         * 
+         * Holds NOT_READY, READY, or the address of a suspended ReadyAwaiter. The 
+         * epoll callback hands readiness directly to a waiting coroutine with a 
+         * single atomic operation.
+         */
+        class ReadySlot
+        {
+        public:
+            static constexpr uintptr_t NOT_READY = 0;
+            static constexpr uintptr_t READY = 1;
+
+            /**
+             * @brief Mark the slot as ready, and post the waiter to its dispatcher if there is one.
+             * 
+             * The waiter is never resumed inline, since it may close or destroy the CoFile.
+             */
+            void Signal();
+            void Reset(uintptr_t value) { state.store(value, std::memory_order_release); }
+
+        private:
+            friend class ReadyAwaiter;
+            std::atomic<uintptr_t> state = READY;
+        };
+
+        class ReadyAwaiter
+        {
+        public:
+            ReadyAwaiter(ReadySlot *pSlot) : pSlot(pSlot) {}
+
+            bool await_ready() noexcept
+            {
+                uintptr_t expected = ReadySlot::READY;
+                return pSlot->state.compare_exchange_strong(expected, ReadySlot::NOT_READY, std::memory_order_acq_rel);
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                this->handle = handle;
+                this->pDispatcher = &CoDispatcher::CurrentDispatcher();
+                uintptr_t expected = ReadySlot::NOT_READY;
+                if (pSlot->state.compare_exchange_strong(expected, (uintptr_t)this, std::memory_order_acq_rel))
+                {
+                    return true;
+                }
+                // became ready in the meantime.
+                pSlot->state.store(ReadySlot::NOT_READY, std::memory_order_release);
+                return false;
+            }
+            void await_resume() noexcept { detail::currentPriority = priority; }
+
+        private:
+            friend class ReadySlot;
+            ReadySlot *pSlot;
+            std::coroutine_handle<> handle;
+            CoDispatcher *pDispatcher = nullptr;
+            CoPriority priority = CoDispatcher::CurrentPriority();
+        };
+
         int file_fd = -1;
         AsyncIo::EventHandle eventHandle = -1;
         
@@ -112,12 +175,56 @@ namespace cotask {
          * @return false  if the file is closed.
          */
         bool IsOpen() const { return this->file_fd != -1; }
+        /**
+         * @brief The underlying file descriptor.
+         * 
+         * @return int The file descriptor, or -1 if the file is not open. The CoFile retains ownership.
+         */
+        int GetFileDescriptor() const { return this->file_fd; }
+
+        /**
+         * @brief Wait until the file is readable.
+         * 
+         * @return (awaitable) 
+         * 
+         * A lightweight alternative to CoRead(). The waiting coroutine is recorded directly in
+         * the file's i/o registration, and is posted to its dispatcher when the file becomes 
+         * readable, or when the file is closed.
+         * 
+         * Readiness is edge-triggered: read from GetFileDescriptor() until read() returns EAGAIN 
+         * before waiting again. Wakeups may be spurious. 
+         * 
+         * At most one coroutine may wait for readability at a time. Don't mix with CoRead(). No timeout.
+         * 
+         * Usage:
+         * 
+         *     while (true) {
+         *         ssize_t n = read(file.GetFileDescriptor(), buffer, sizeof(buffer));
+         *         if (n < 0 && errno == EAGAIN) {
+         *             co_await file.Readable();
+         *             continue;
+         *         }
+         *         ...
+         *     }
+         */
+        ReadyAwaiter Readable() { return ReadyAwaiter(&readSlot); }
+
+        /**
+         * @brief Wait until the file is writable.
+         * 
+         * @return (awaitable) 
+         * 
+         * The write counterpart of Readable(). Same restrictions apply.
+         */
+        ReadyAwaiter Writable() { return ReadyAwaiter(&writeSlot); }
+
         /**
          * @brief Read a buffer of data.
          * 
          * @param data The buffer into which to read.
          * @param length The maximum number of bytes to read.
-         * @param timeout Timeout in milliseconds.
+         * @param timeout Timeout, or NO_TIMEOUT.
+         * @param cancellationToken (optional) Cancels the operation, which then throws CoCancelledException.
          * @return Task<int> The number of bytes read. 0 on end of file.
          * 
          * The return value indicates how many bytes were read. Generally, this method does not return a full buffer; if there is any
@@ -127,14 +234,15 @@ namespace cotask {
          * will be returned before the exception is thrown.
          * 
          */
-        CoTask<size_t> CoRead(void *data, size_t length, std::chrono::milliseconds timeout = -1ms);
+        CoTask<size_t> CoRead(void *data, size_t length, CoDispatcher::Duration timeout = NO_TIMEOUT, CoCancellationToken cancellationToken = CoCancellationToken());
 
         /**
          * @brief Receive a datagram of data.
          * 
          * @param data The buffer into which to read.
          * @param length The maximum number of bytes to read.
-         * @param timeout Timeout in milliseconds.
+         * @param timeout Timeout, or NO_TIMEOUT.
+         * @param cancellationToken (optional) Cancels the operation, which then throws CoCancelledException.
          * @return Task<int> The number of bytes read. 0 on end of file.
          * 
          * The return value indicates how many bytes were read. Generally, this method does not return a full buffer; if there is any
@@ -150,7 +258,23 @@ namespace cotask {
          * safe, use CoRecv for datagram sockets.
          * 
          */
-        CoTask<size_t> CoRecv(void *data, size_t length, std::chrono::milliseconds timeout = NO_TIMEOUT);
+        CoTask<size_t> CoRecv(void *data, size_t length, CoDispatcher::Duration timeout = NO_TIMEOUT, CoCancellationToken cancellationToken = CoCancellationToken());
+
+        /**
+         * @brief Non-throwing CoRead().
+         * 
+         * Behaves like CoRead(), but reports timeouts, cancellation and closing of the file through 
+         * the status of the result instead of throwing. I/O errors are still thrown.
+         */
+        CoTask<CoResult<size_t>> TryRead(void *data, size_t length, CoDispatcher::Duration timeout = NO_TIMEOUT, CoCancellationToken cancellationToken = CoCancellationToken());
+
+        /**
+         * @brief Non-throwing CoRecv().
+         * 
+         * Behaves like CoRecv(), but reports timeouts, cancellation and closing of the file through 
+         * the status of the result instead of throwing. I/O errors are still thrown.
+         */
+        CoTask<CoResult<size_t>> TryRecv(void *data, size_t length, CoDispatcher::Duration timeout = NO_TIMEOUT, CoCancellationToken cancellationToken = CoCancellationToken());
 
         /**
          * @brief Read a line of data.
@@ -161,12 +285,29 @@ namespace cotask {
          */
         CoTask<bool> CoReadLine(std::string*result);
 
+        /**
+         * @brief The lines of the file.
+         * 
+         * @return AsyncGenerator<std::string> The lines of the file, not including the trailing '\n'. 
+         * 
+         * Streams the remaining lines of the file until end of file. Shares its buffer with 
+         * CoReadLine(), so the two can be used one after the other (but not concurrently).
+         * 
+         *     auto lines = file.Lines();
+         *     while (co_await lines.Next())
+         *     {
+         *         Process(lines.Value());
+         *     }
+         */
+        AsyncGenerator<std::string> Lines();
+
         /**
          * @brief Write a buffer of data.
          * 
          * @param data The buffer of data to write.
          * @param length The number of bytes to write.
          * @param timeout (optional) Maximum time to wait for the write to complete.
+         * @param cancellationToken (optional) Cancels the operation, which then throws CoCancelledException.
          * @return Task<> 
          * @throws CoTimeoutException
          * 
@@ -174,7 +315,7 @@ namespace cotask {
          * is indeterminate.
          * 
          */
-        CoTask<> CoWrite(const void *data, size_t length, std::chrono::milliseconds timeout = -1ms);
+        CoTask<> CoWrite(const void *data, size_t length, CoDispatcher::Duration timeout = NO_TIMEOUT, CoCancellationToken cancellationToken = CoCancellationToken());
 
         /**
          * @brief Send data on a socket.
@@ -182,6 +323,7 @@ namespace cotask {
          * @param data The buffer of data to write.
          * @param length The number of bytes to write (may be zero).
          * @param timeout (optional) Maximum time to wait for the write to complete.
+         * @param cancellationToken (optional) Cancels the operation, which then throws CoCancelledException.
          * @return Task<> 
          * @throws CoTimeoutException
          * 
@@ -196,7 +338,7 @@ namespace cotask {
          * 
          * On linux, CoWrite calls write(), whereas CoSend() calls send().
          */
-        CoTask<> CoSend(const void *data, size_t length, std::chrono::milliseconds timeout = -1ms);
+        CoTask<> CoSend(const void *data, size_t length, CoDispatcher::Duration timeout = NO_TIMEOUT, CoCancellationToken cancellationToken = CoCancellationToken());
 
 
 
@@ -205,15 +347,16 @@ namespace cotask {
          * 
          * @param text The string to write.
          * @param timeout (optiona) Maximum time to wait for the write to complete.
+         * @param cancellationToken (optional) Cancels the operation, which then throws CoCancelledException.
          * @return Task<> 
          * @throws CoTimeoutException
          * 
          * If a timeout occurs, a CoTimeoutException is thrown. After a timeout, the amount of data written 
          * is indeterminate.
          */
-        CoTask<> CoWrite(const std::string & text, std::chrono::milliseconds timeout = NO_TIMEOUT)
+        CoTask<> CoWrite(const std::string & text, CoDispatcher::Duration timeout = NO_TIMEOUT, CoCancellationToken cancellationToken = CoCancellationToken())
         {
-            co_await CoWrite(text.c_str(),text.length(), timeout);
+            co_await CoWrite(text.c_str(),text.length(), timeout, std::move(cancellationToken));
             co_return;
         }
         /**
@@ -221,13 +364,14 @@ namespace cotask {
          * 
          * @param text The string to write.
          * @param timeout (optional) Maximum time to wait for the write to complete.
+         * @param cancellationToken (optional) Cancels the operation, which then throws CoCancelledException.
          * @return Task<> 
          * @throws CoTimeoutException
          * 
          * If a timeout occurs, a CoTimeoutException is thrown. After a timeout, the amount of data written 
          * is indeterminate.
          */
-        CoTask<> CoWriteLine(const std::string &text, std::chrono::milliseconds timeout = NO_TIMEOUT);
+        CoTask<> CoWriteLine(const std::string &text, CoDispatcher::Duration timeout = NO_TIMEOUT, CoCancellationToken cancellationToken = CoCancellationToken());
 
         /**
          * @brief Open the supplied AsyncFiles as a pair of connected anonymous pipes.
@@ -279,6 +423,9 @@ namespace cotask {
         bool readReady = false;
         bool writeReady = false;
 
+        ReadySlot readSlot;
+        ReadySlot writeSlot;
+
         CoConditionVariable readCv;
         CoConditionVariable writeCv;
 
@@ -0,0 +1,92 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define COTASK_POOLED_FRAMES 0
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define COTASK_POOLED_FRAMES 0
+#endif
+#endif
+#ifndef COTASK_POOLED_FRAMES
+#define COTASK_POOLED_FRAMES 1
+#endif
+
+namespace cotask
+{
+    /**
+     * @brief Allocator for coroutine frames.
+     * 
+     * CoTask frames are allocated from per-thread free lists, in power-of-two size classes 
+     * (64 bytes to 4KB). Frames freed on the thread that allocated them go straight back onto 
+     * that thread's free lists. Frames freed on other threads are returned to the owning thread 
+     * through a lock-free list, and picked up the next time the owning thread runs out of 
+     * frames of that size. Larger frames are allocated with global operator new.
+     * 
+     * Memory is retained by each thread's free lists until the thread exits.
+     * 
+     * In AddressSanitizer builds, frames are allocated and freed with global operator new and delete 
+     * instead, so that use of a destroyed coroutine frame is detected rather than hidden by reuse. 
+     * (See POOLED.)
+     */
+    class CoFrameAllocator
+    {
+    public:
+        static void *Allocate(size_t size);
+        static void Free(void *p, size_t size) noexcept;
+
+        struct Statistics
+        {
+            /** @brief Allocations satisfied from a free list. */
+            uint64_t hits = 0;
+            /** @brief Allocations that required a new block from the heap. */
+            uint64_t misses = 0;
+            /** @brief Frees on a thread other than the allocating thread. */
+            uint64_t remoteFrees = 0;
+            /** @brief Frames too large for a size class. */
+            uint64_t oversize = 0;
+        };
+        /**
+         * @brief Allocation counters, summed across all threads.
+         * 
+         * Counters of running threads are read without synchronization, so the result is approximate.
+         */
+        static Statistics GetStatistics();
+
+        /**
+         * @brief Are frames allocated from the per-thread free lists?
+         * 
+         * false in AddressSanitizer builds, in which case all statistics are zero.
+         */
+        static constexpr bool POOLED = COTASK_POOLED_FRAMES != 0;
+
+        static constexpr size_t MIN_SIZE_CLASS = 64;
+        static constexpr size_t MAX_SIZE_CLASS = 4096;
+    };
+} // namespace
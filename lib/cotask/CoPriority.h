@@ -0,0 +1,69 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cotask
+{
+    /**
+     * @brief Dispatch priority of foreground work.
+     * 
+     * The foreground dispatcher keeps a separate queue ("lane") of posted coroutines for each 
+     * priority, and runs higher-priority lanes first. A lane that has been passed over 
+     * repeatedly while it had work gets a turn regardless (see CoDispatcher::STARVATION_LIMIT), 
+     * so a steady stream of higher-priority work delays lower-priority work, but can't stall it.
+     * 
+     * Priority is inherited. While a coroutine runs, CoDispatcher::CurrentPriority() is the priority 
+     * it was resumed at; and whenever it suspends (posts, delays, i/o, events, CoBackground()), it 
+     * is resumed at the same priority. So everything a task does, and every task it starts 
+     * or awaits, runs at the priority the task was started at. 
+     * 
+     * See CoDispatcher::StartThread(CoPriority,...), and CoForeground(CoPriority).
+     */
+    enum class CoPriority : uint8_t
+    {
+        /** Latency-sensitive work. */
+        High = 0,
+        /** The default. */
+        Normal = 1,
+        /** Housekeeping that can wait until the dispatcher has nothing better to do. */
+        Idle = 2
+    };
+
+    constexpr size_t CO_PRIORITY_LANES = 3;
+
+#ifndef DOXYGEN
+    namespace detail
+    {
+        // The priority of the work item that the calling thread is running. Set by whoever resumes 
+        // a coroutine: the foreground dispatcher (for posts and timers), and the awaiters of 
+        // operations that resume on other threads.
+        inline thread_local CoPriority currentPriority = CoPriority::Normal;
+    }
+#endif
+
+} // namespace
@@ -28,6 +28,7 @@
 #include <coroutine>
 #include <functional>
 #include <exception>
+#include <atomic>
 #include "CoTask.h"
 #include <sstream>
 
@@ -216,6 +217,19 @@ has been given.
 
 ***********************************************/
 
+    /*
+     * State transitions of a CoService are driven by three events which may arrive on 
+     * different threads: Execute() returning (OnExecuted), the implementation calling back 
+     * with a result (OnResume), and the timeout timer firing (OnTimedOut). Each event 
+     * makes a CAS transition on a per-instance atomic state. Exactly one event makes the 
+     * transition to Resuming, and that thread resumes the suspended coroutine. If that 
+     * happens in await_suspend() (i.e. the service completed synchronously in Execute()), 
+     * the coroutine continues without being suspended at all.
+     * 
+     * When a result and a timeout race after Execute() has returned, the winner tries to
+     * cancel the loser (CancelTimeout() or CancelResume()). If cancelling fails, the loser
+     * is already in flight, and whichever of the two finishes last resumes the coroutine.
+     */
     enum class ServiceState
     {
         Idle,
@@ -225,8 +239,11 @@ has been given.
         ExecutingTimedOutAndResumed,
         Executed,
         ResumedCancellingTimeout, // call made to cancel the timeout
-        ResumedTimeoutInFlight,   // cancelling the timeout failed, so Cancel must be in flight.
-        TimedOutResumeInFlight,   // cancelling the resume failed, so the resume must be in flight/
+        ResumedCancellingTimeoutTimedOut, // the timeout arrived while it was being cancelled.
+        ResumedTimeoutInFlight,   // cancelling the timeout failed, so the timeout must be in flight.
+        TimedOutCancellingResume, // call made to cancel the resume.
+        TimedOutCancellingResumeResumed, // the resume arrived while it was being cancelled.
+        TimedOutResumeInFlight,   // cancelling the resume failed, so the resume must be in flight.
 
         Resuming,
         Resumed,
@@ -241,7 +258,7 @@ has been given.
     public:
         virtual void SetResult(T &&value) = 0;
         virtual void SetException(std::exception_ptr exceptionPtr) = 0;
-        virtual void RequestTimeout(std::chrono::milliseconds timeout) = 0;
+        virtual void RequestTimeout(CoDispatcher::Duration timeout) = 0;
     };
 
     template <>
@@ -250,7 +267,7 @@ has been given.
     public:
         virtual void SetComplete() = 0;
         virtual void SetException(std::exception_ptr exceptionPtr) = 0;
-        virtual void RequestTimeout(std::chrono::milliseconds timeout) = 0;
+        virtual void RequestTimeout(CoDispatcher::Duration timeout) = 0;
     };
 
     // template <typename T>
@@ -292,29 +309,27 @@ has been given.
     protected:
         using service_implementation = SERVICE_IMPLEMENTATION;
 
-        static std::mutex serviceStateMutex;
-        ServiceState serviceState = ServiceState::Idle;
+        std::atomic<ServiceState> serviceState = ServiceState::Idle;
         void SetServiceState(ServiceState serviceState)
         {
-            std::unique_lock lock{serviceStateMutex};
-            this->serviceState = serviceState;
+            this->serviceState.store(serviceState, std::memory_order_release);
         }
         ServiceState GetServiceState()
         {
-            std::unique_lock lock{serviceStateMutex};
-            return serviceState;
+            return serviceState.load(std::memory_order_acquire);
         }
 
         void throwInvalidState(const char *action)
         {
             std::stringstream s;
-            s << "ERROR: CoService Not in a valid state. (" << action << "," << ((int)serviceState) << ")";
+            s << "ERROR: CoService Not in a valid state. (" << action << "," << ((int)GetServiceState()) << ")";
             Terminate(s.str());
         }
 
-        void OnRequestTimeout(std::chrono::milliseconds timeout)
+        void OnRequestTimeout(CoDispatcher::Duration timeout)
         {
-            if (serviceState != ServiceState::Executing && serviceState != ServiceState::ExecutingResumed)
+            ServiceState state = GetServiceState();
+            if (state != ServiceState::Executing && state != ServiceState::ExecutingResumed)
             {
                 throwInvalidState("OnRequestTimeout must be called in Execute()");
             }
@@ -349,15 +364,13 @@ has been given.
         virtual bool CancelResume() = 0;
 
     private:
-        void Resume()
+        bool Transition(ServiceState &expected, ServiceState newState)
         {
-            std::unique_lock lock{serviceStateMutex};
-            if (serviceState != ServiceState::Resuming)
-            {
-                throwInvalidState("Resume");
-            }
-            serviceState = ServiceState::Resumed;
+            return serviceState.compare_exchange_weak(expected, newState, std::memory_order_acq_rel, std::memory_order_acquire);
+        }
 
+        void Resume()
+        {
             // prepare to lose *this...
             auto handle = this->suspendedHandle;
             auto dispatcher = this->foregroundDispatcher;
@@ -366,10 +379,16 @@ has been given.
             this->suspendedHandle = 0;
             this->foregroundDispatcher = nullptr;
 
+            ServiceState expected = ServiceState::Resuming;
+            if (!serviceState.compare_exchange_strong(expected, ServiceState::Resumed, std::memory_order_acq_rel))
+            {
+                throwInvalidState("Resume");
+            }
+
             // From this point on, *this is no longer valid.
             if (isForeground)
             {
-                dispatcher->Post(handle);
+                dispatcher->Post(handle, priority);
             }
             else
             {
@@ -377,140 +396,193 @@ has been given.
             }
         }
 
-    protected:
-        void OnResume()
+        // Complete the transition from Resuming. In await_suspend(), the awaiting coroutine 
+        // continues without suspending; anywhere else, it gets posted.
+        // Returns true if the awaiting coroutine should stay suspended.
+        bool Complete(bool inAwaitSuspend)
         {
-            std::unique_lock lock{serviceStateMutex};
-
-            switch (serviceState)
+            if (!inAwaitSuspend)
+            {
+                Resume();
+                return true;
+            }
+            this->suspendedHandle = 0;
+            this->foregroundDispatcher = nullptr;
+            ServiceState expected = ServiceState::Resuming;
+            if (!serviceState.compare_exchange_strong(expected, ServiceState::Resumed, std::memory_order_acq_rel))
             {
-            case ServiceState::Executing:
-                serviceState = ServiceState::ExecutingResumed;
-                break;
-            case ServiceState::ExecutingTimedOut:
-                serviceState = ServiceState::ExecutingTimedOutAndResumed;
-                break;
-            case ServiceState::Executed:
+                throwInvalidState("Complete");
+            }
+            return false;
+        }
+
+        // Called by the thread that made the transition to ResumedCancellingTimeout.
+        bool CancelTimeoutAndResume(bool inAwaitSuspend)
+        {
+            if (!CancelTimeout())
             {
-                bool cancelledTimeout = CancelTimeout();
-                if (cancelledTimeout)
+                // The timeout is in flight. Whichever of this thread and OnTimedOut() gets there last resumes.
+                ServiceState expected = ServiceState::ResumedCancellingTimeout;
+                if (serviceState.compare_exchange_strong(expected, ServiceState::ResumedTimeoutInFlight, std::memory_order_acq_rel))
                 {
-                    serviceState = ServiceState::Resuming;
-                    lock.unlock();
-                    Resume();
-                    return;
+                    return true;
                 }
-                else
+                if (expected != ServiceState::ResumedCancellingTimeoutTimedOut)
                 {
-                    serviceState = ServiceState::ResumedTimeoutInFlight;
+                    throwInvalidState("CancelTimeout");
                 }
             }
-            break;
-            case ServiceState::TimedOutResumeInFlight:
-                this->hasTimeout = false; // let the resume win!
-                this->serviceState = ServiceState::Resuming;
-                lock.unlock();
-                Resume();
-                return;
-            default:
-                throwInvalidState("OnResume");
-            }
+            SetServiceState(ServiceState::Resuming);
+            return Complete(inAwaitSuspend);
         }
 
-        void OnExecuted()
+        // Called by the thread that made the transition to TimedOutCancellingResume.
+        bool CancelResumeAndResume(bool inAwaitSuspend)
         {
-            std::unique_lock lock{serviceStateMutex};
-            switch (serviceState)
-            {
-            case ServiceState::Executing:
-                serviceState = ServiceState::Executed;
-                break;
-            case ServiceState::ExecutingTimedOut:
+            if (!CancelResume())
             {
-                bool canceledResume = CancelResume();
-                if (canceledResume)
+                // The resume is in flight. Whichever of this thread and OnResume() gets there last resumes.
+                ServiceState expected = ServiceState::TimedOutCancellingResume;
+                if (serviceState.compare_exchange_strong(expected, ServiceState::TimedOutResumeInFlight, std::memory_order_acq_rel))
                 {
-                    serviceState = ServiceState::Resuming;
-                    lock.unlock();
-                    Resume();
-                    return;
+                    return true;
                 }
-                else
+                if (expected != ServiceState::TimedOutCancellingResumeResumed)
                 {
-                    serviceState = ServiceState::TimedOutResumeInFlight;
+                    throwInvalidState("CancelResume");
                 }
+                this->hasTimeout = false; // let the resume win!
             }
-            break;
-            case ServiceState::ExecutingResumed:
+            SetServiceState(ServiceState::Resuming);
+            return Complete(inAwaitSuspend);
+        }
+
+    protected:
+        void OnResume()
+        {
+            ServiceState state = GetServiceState();
+            while (true)
             {
-                bool cancelledTimeout = CancelTimeout();
-                if (cancelledTimeout)
+                switch (state)
                 {
-                    serviceState = ServiceState::Resuming;
-                    lock.unlock();
-                    Resume();
-                    return;
+                case ServiceState::Executing:
+                    if (Transition(state, ServiceState::ExecutingResumed))
+                        return;
+                    break;
+                case ServiceState::ExecutingTimedOut:
+                    if (Transition(state, ServiceState::ExecutingTimedOutAndResumed))
+                        return;
+                    break;
+                case ServiceState::Executed:
+                    if (Transition(state, ServiceState::ResumedCancellingTimeout))
+                    {
+                        CancelTimeoutAndResume(false);
+                        return;
+                    }
+                    break;
+                case ServiceState::TimedOutCancellingResume:
+                    if (Transition(state, ServiceState::TimedOutCancellingResumeResumed))
+                        return;
+                    break;
+                case ServiceState::TimedOutResumeInFlight:
+                    if (Transition(state, ServiceState::Resuming))
+                    {
+                        this->hasTimeout = false; // let the resume win!
+                        Resume();
+                        return;
+                    }
+                    break;
+                default:
+                    throwInvalidState("OnResume");
                 }
-                else
+            }
+        }
+
+        // Called from await_suspend() after Execute() returns. Returns true if the awaiting coroutine should suspend.
+        bool OnExecuted()
+        {
+            ServiceState state = GetServiceState();
+            while (true)
+            {
+                switch (state)
                 {
-                    serviceState = ServiceState::ResumedTimeoutInFlight;
+                case ServiceState::Executing:
+                    if (Transition(state, ServiceState::Executed))
+                        return true;
+                    break;
+                case ServiceState::ExecutingTimedOut:
+                    if (Transition(state, ServiceState::TimedOutCancellingResume))
+                    {
+                        return CancelResumeAndResume(true);
+                    }
+                    break;
+                case ServiceState::ExecutingResumed:
+                    if (Transition(state, ServiceState::ResumedCancellingTimeout))
+                    {
+                        return CancelTimeoutAndResume(true);
+                    }
+                    break;
+                case ServiceState::ExecutingTimedOutAndResumed:
+                    if (Transition(state, ServiceState::Resuming))
+                    {
+                        return Complete(true);
+                    }
+                    break;
+                default:
+                    throwInvalidState("OnExecuted");
+                    return true;
                 }
             }
-            break;
-            case ServiceState::ExecutingTimedOutAndResumed:
-                serviceState = ServiceState::Resuming;
-                lock.unlock();
-                Resume();
-                return;
-            default:
-                throwInvalidState("OnExecuted");
-            }
         }
         void OnTimedOut()
         {
-            std::unique_lock lock{serviceStateMutex};
-            switch (serviceState)
+            ServiceState state = GetServiceState();
+            while (true)
             {
-            case ServiceState::Executing:
-                this->hasError = true;
-                this->hasTimeout = true;
-                this->serviceState = ServiceState::ExecutingTimedOut;
-                break;
-            case ServiceState::ExecutingResumed:
-                this->serviceState = ServiceState::ExecutingTimedOutAndResumed;
-                break;
-            case ServiceState::Executed:
-            {
-                this->hasError = true;
-                this->hasTimeout = true;
-                bool resumeCancelled = CancelResume();
-                if (resumeCancelled)
-                {
-                    this->serviceState = ServiceState::Resuming;
-                    lock.unlock();
-                    Resume();
-                    return;
-                }
-                else
+                // hasTimeout is only written on this thread until the transition succeeds.
+                switch (state)
                 {
-                    this->serviceState = ServiceState::TimedOutResumeInFlight;
+                case ServiceState::Executing:
+                    this->hasTimeout = true;
+                    if (Transition(state, ServiceState::ExecutingTimedOut))
+                        return;
+                    break;
+                case ServiceState::ExecutingResumed:
+                    this->hasTimeout = false;
+                    if (Transition(state, ServiceState::ExecutingTimedOutAndResumed))
+                        return;
+                    break;
+                case ServiceState::Executed:
+                    this->hasTimeout = true;
+                    if (Transition(state, ServiceState::TimedOutCancellingResume))
+                    {
+                        CancelResumeAndResume(false);
+                        return;
+                    }
+                    break;
+                case ServiceState::ResumedCancellingTimeout:
+                    this->hasTimeout = false;
+                    if (Transition(state, ServiceState::ResumedCancellingTimeoutTimedOut))
+                        return;
+                    break;
+                case ServiceState::ResumedTimeoutInFlight:
+                    this->hasTimeout = false;
+                    if (Transition(state, ServiceState::Resuming))
+                    {
+                        Resume();
+                        return;
+                    }
+                    break;
+                default:
+                    throwInvalidState("onTimedout");
                 }
             }
-            break;
-            case ServiceState::ResumedTimeoutInFlight:
-            {
-                this->serviceState = ServiceState::Resuming;
-                lock.unlock();
-                Resume();
-                return;
-            }
-            default:
-                throwInvalidState("onTimedout");
-            }
         }
 
     public:
         CoServiceBase();
+        // Services may only be copied before they are awaited.
+        CoServiceBase(const CoServiceBase &other);
         virtual ~CoServiceBase();
 
         // coroutine contract implementation
@@ -531,6 +603,10 @@ has been given.
 
         bool isForeground = true;
         CoDispatcher *foregroundDispatcher = nullptr;
+        // The awaiting coroutine's priority. Foreground resumes are posted at this priority; the thread 
+        // pool doesn't have priorities, so background resumes restore it in await_resume().
+        CoPriority priority = CoPriority::Normal;
+        void RestorePriority() const { detail::currentPriority = priority; }
     };
 
     template <typename SERVICE_IMPLEMENTATION>
@@ -550,17 +626,26 @@ has been given.
 
         void await_resume() const;
 
+        /**
+         * @brief Non-throwing alternative to await_resume().
+         * 
+         * Reports timeouts and cancellation as a CoStatus, instead of throwing. Exceptions 
+         * delivered through SetException() are still rethrown.
+         */
+        CoStatus TryResume() const;
+
         virtual bool CancelResume()
         {
             return SERVICE_IMPLEMENTATION::CancelExecute((CoServiceCallback<void> *)this);
         }
-        void await_suspend(std::coroutine_handle<> coroutine) noexcept
+        // Returns false (and continues without suspending) if Execute() completed synchronously.
+        bool await_suspend(std::coroutine_handle<> coroutine) noexcept
         {
             service_base::suspended = true;
             service_base::suspendedHandle = coroutine;
             service_base::SetServiceState(ServiceState::Executing);
             service_implementation::Execute((CoServiceCallback<void> *)this);
-            service_base::OnExecuted();
+            return service_base::OnExecuted();
         }
     };
 
@@ -581,7 +666,8 @@ has been given.
             return SERVICE_IMPLEMENTATION::CancelExecute(static_cast<CoServiceCallback<RETURN_TYPE> *>(this));
         }
 
-        void await_suspend(std::coroutine_handle<> coroutine) noexcept
+        // Returns false (and continues without suspending) if Execute() completed synchronously.
+        bool await_suspend(std::coroutine_handle<> coroutine) noexcept
         {
             service_base::suspended = true;
             service_base::suspendedHandle = coroutine;
@@ -589,7 +675,7 @@ has been given.
 
             service_implementation::Execute(static_cast<CoServiceCallback<RETURN_TYPE> *>(this));
 
-            service_base::OnExecuted();
+            return service_base::OnExecuted();
         }
 
     private:
@@ -613,7 +699,7 @@ has been given.
         }
         virtual ~CoService();
 
-        void RequestTimeout(std::chrono::milliseconds timeout)
+        void RequestTimeout(CoDispatcher::Duration timeout)
         {
             CoServiceBase<SERVICE_IMPLEMENTATION>::OnRequestTimeout(timeout);
         }
@@ -640,7 +726,7 @@ has been given.
         }
         virtual ~CoService();
 
-        void RequestTimeout(std::chrono::milliseconds timeout)
+        void RequestTimeout(CoDispatcher::Duration timeout)
         {
             CoServiceBase<SERVICE_IMPLEMENTATION>::OnRequestTimeout(timeout);
         }
@@ -664,12 +750,13 @@ has been given.
 
         this->foregroundDispatcher = dispatcher.GetForegroundDispatcher();
         this->isForeground = dispatcher.IsForeground();
+        this->priority = CoDispatcher::CurrentPriority();
     }
 
     template <typename SERVICE_IMPLEMENTATION, typename RETURN_TYPE>
     void TypedCoServiceBase<SERVICE_IMPLEMENTATION, RETURN_TYPE>::SetResult(RETURN_TYPE &&value)
     {
-        value = std::move(value);
+        this->value = std::move(value);
         CoServiceBase<SERVICE_IMPLEMENTATION>::OnResume();
     }
 
@@ -693,7 +780,8 @@ has been given.
     template <typename SERVICE_IMPLEMENTATION>
     void VoidCoServiceBase<SERVICE_IMPLEMENTATION>::await_resume() const
     {
-        if (CoServiceBase<SERVICE_IMPLEMENTATION>::hasError)
+        CoServiceBase<SERVICE_IMPLEMENTATION>::RestorePriority();
+        if (CoServiceBase<SERVICE_IMPLEMENTATION>::hasError || CoServiceBase<SERVICE_IMPLEMENTATION>::hasTimeout)
         {
             if (CoServiceBase<SERVICE_IMPLEMENTATION>::exceptionPtr)
             {
@@ -711,10 +799,33 @@ has been given.
         return;
     }
 
+    template <typename SERVICE_IMPLEMENTATION>
+    CoStatus VoidCoServiceBase<SERVICE_IMPLEMENTATION>::TryResume() const
+    {
+        CoServiceBase<SERVICE_IMPLEMENTATION>::RestorePriority();
+        if (CoServiceBase<SERVICE_IMPLEMENTATION>::hasError || CoServiceBase<SERVICE_IMPLEMENTATION>::hasTimeout)
+        {
+            if (CoServiceBase<SERVICE_IMPLEMENTATION>::exceptionPtr)
+            {
+                std::rethrow_exception(CoServiceBase<SERVICE_IMPLEMENTATION>::exceptionPtr);
+            }
+            if (CoServiceBase<SERVICE_IMPLEMENTATION>::hasTimeout)
+            {
+                return CoStatus::TimedOut;
+            }
+            if (CoServiceBase<SERVICE_IMPLEMENTATION>::cancelled)
+            {
+                return CoStatus::Cancelled;
+            }
+        }
+        return CoStatus::Ok;
+    }
+
     template <typename SERVICE_IMPLEMENTATION, typename RETURN_TYPE>
     RETURN_TYPE TypedCoServiceBase<SERVICE_IMPLEMENTATION, RETURN_TYPE>::await_resume() const
     {
-        if (CoServiceBase<SERVICE_IMPLEMENTATION>::hasError)
+        CoServiceBase<SERVICE_IMPLEMENTATION>::RestorePriority();
+        if (CoServiceBase<SERVICE_IMPLEMENTATION>::hasError || CoServiceBase<SERVICE_IMPLEMENTATION>::hasTimeout)
         {
             if (CoServiceBase<SERVICE_IMPLEMENTATION>::exceptionPtr)
             {
@@ -732,6 +843,19 @@ has been given.
         return value;
     }
 
+    template <typename SERVICE_IMPLEMENTATION>
+    CoServiceBase<SERVICE_IMPLEMENTATION>::CoServiceBase(const CoServiceBase &other)
+        : SERVICE_IMPLEMENTATION(other),
+          isForeground(other.isForeground),
+          foregroundDispatcher(other.foregroundDispatcher),
+          priority(other.priority)
+    {
+        if (other.serviceState.load(std::memory_order_relaxed) != ServiceState::Idle)
+        {
+            Terminate("Can't copy a CoService that has been awaited.");
+        }
+    }
+
     template <typename SERVICE_IMPLEMENTATION>
     CoServiceBase<SERVICE_IMPLEMENTATION>::~CoServiceBase()
     {
@@ -740,8 +864,8 @@ has been given.
     template <IsVoidCoServiceImplementation SERVICE_IMPLEMENTATION>
     CoService<SERVICE_IMPLEMENTATION>::~CoService()
     {
-        if (CoServiceBase<SERVICE_IMPLEMENTATION>::serviceState != ServiceState::Resumed 
-        && CoServiceBase<SERVICE_IMPLEMENTATION>::serviceState != ServiceState::Idle)
+        ServiceState state = CoServiceBase<SERVICE_IMPLEMENTATION>::GetServiceState();
+        if (state != ServiceState::Resumed && state != ServiceState::Idle)
         {
             CoServiceBase<SERVICE_IMPLEMENTATION>::throwInvalidState("Destroyed in invalid state.");
             std::terminate();
@@ -750,15 +874,12 @@ has been given.
     template <IsTypedCoServiceImplementation SERVICE_IMPLEMENTATION>
     CoService<SERVICE_IMPLEMENTATION>::~CoService()
     {
-        if (CoServiceBase<SERVICE_IMPLEMENTATION>::serviceState != ServiceState::Resumed 
-        && CoServiceBase<SERVICE_IMPLEMENTATION>::serviceState != ServiceState::Idle)
+        ServiceState state = CoServiceBase<SERVICE_IMPLEMENTATION>::GetServiceState();
+        if (state != ServiceState::Resumed && state != ServiceState::Idle)
         {
             CoServiceBase<SERVICE_IMPLEMENTATION>::throwInvalidState("Destroyed in invalid state. ");
             std::terminate();
         }
     }
 
-    template <typename SERVICE_IMPLEMENTATION>
-    std::mutex CoServiceBase<SERVICE_IMPLEMENTATION>::serviceStateMutex;
-
 } // namespace
\ No newline at end of file
@@ -34,8 +34,16 @@
 #include <memory>
 #include "Log.h"
 #include "Fifo.h"
+#include "MpscQueue.h"
+#include "CoClock.h"
+#include "CoPriority.h"
+#include "CoFrameAllocator.h"
+#include "TimerQueue.h"
+#include "InplaceFunction.h"
 #include <functional>
 #include <condition_variable>
+#include <semaphore>
+#include <atomic>
 #include <list>
 #include "CoExceptions.h"
 
@@ -68,7 +76,18 @@ namespace cotask
     template <>
     struct CoTask<>;
 
-    constexpr std::chrono::milliseconds NO_TIMEOUT = std::chrono::milliseconds(-1);
+#ifndef DOXYGEN
+    namespace detail
+    {
+        struct DetachedThread;
+
+        // The number of symmetric transfers on the calling thread's stack since a dispatcher last 
+        // resumed a coroutine. (See TransferTo() in LazyTask.h)
+        inline thread_local unsigned transferDepth = 0;
+    }
+#endif
+
+    constexpr CoDuration NO_TIMEOUT = CoDuration(-1);
 
     template <typename T, typename RETURN_TYPE>
     concept Awaitable = requires(T a, std::coroutine_handle<> h)
@@ -87,12 +106,20 @@ namespace cotask
     // Forward declarations.
     class CoTaskSchedulerPool;
     class CoTaskSchedulerThread;
+    class AsyncIo;
 
     // CoDispatcher
     class CoDispatcher
     {
     public:
-        using TimeMs = std::chrono::milliseconds;
+        /**
+         * @brief Duration type for timers, delays and timeouts.
+         * 
+         * Resolution is configurable at build time. See CoClock.h.
+         */
+        using Duration = CoDuration;
+        using TimeMs = Duration; // historical name; no longer neccessarily milliseconds.
+        using TimerHandle = TimerQueue::TimerHandle;
 
     private:
         static CoDispatcher *CreateMainDispatcher();
@@ -109,20 +136,79 @@ namespace cotask
 
         CoDispatcher *GetForegroundDispatcher() { return pForegroundDispatcher; }
 
-        static TimeMs Now();
+        /**
+         * @brief The current time.
+         * 
+         * @return Duration The time since the CoClock (steady_clock) epoch.
+         */
+        static Duration Now();
 
-        void Post(std::coroutine_handle<> handle);
+        /**
+         * @brief Resume a coroutine on the foreground thread.
+         * 
+         * @param handle The coroutine to resume.
+         * @param priority The lane to post to. By default, the priority of the caller. (See CoPriority.)
+         * 
+         * Safe to call from any thread. Lock-free and non-allocating (unless more than POST_QUEUE_SIZE 
+         * posts are pending), so it can be called from realtime threads. The only syscall made is to wake 
+         * the foreground thread if it is sleeping.
+         */
+        void Post(std::coroutine_handle<> handle, CoPriority priority = CurrentPriority());
         void PostBackground(std::coroutine_handle<> handle);
-        void PostDelayed(TimeMs delay, const std::coroutine_handle<> &handle);
-        uint64_t PostDelayedFunction(TimeMs delay, std::function<void(void)> fn);
-        bool CancelDelayedFunction(uint64_t timerHandle);
+        TimerHandle PostDelayed(Duration delay, const std::coroutine_handle<> &handle, CoPriority priority = CurrentPriority());
+        TimerHandle PostDelayedFunction(Duration delay, InplaceFunction<void(void)> fn, CoPriority priority = CurrentPriority());
+
+        /**
+         * @brief The priority of the calling coroutine.
+         * 
+         * The priority at which the work item that the calling thread is running was posted. 
+         * Normal on threads that aren't running dispatcher work.
+         */
+        static CoPriority CurrentPriority() noexcept { return detail::currentPriority; }
 
-        bool GetNextTimer(CoDispatcher::TimeMs *pResult) const;
-        void SleepFor(TimeMs delay);
-        void SleepUntil(TimeMs time);
+        /**
+         * @brief How many times in a row a lane with pending work can be passed over in favour of 
+         * higher-priority lanes before it gets a turn.
+         */
+        static constexpr unsigned STARVATION_LIMIT = 16;
+
+        /**
+         * @brief Cancel a timer posted with PostDelayed() or PostDelayedFunction().
+         * 
+         * @param timerHandle The handle of the timer.
+         * @return true if the timer was cancelled.
+         * @return false if the timer has already fired, or is about to fire.
+         * 
+         * If the timer was posted with PostDelayed(), the coroutine is not resumed, and the caller 
+         * becomes responsible for resuming it. (See CoTimer, which does this for you.)
+         */
+        bool CancelTimer(TimerHandle timerHandle);
+        bool CancelDelayedFunction(TimerHandle timerHandle) { return CancelTimer(timerHandle); }
+
+        bool GetNextTimer(CoDispatcher::Duration *pResult) const;
+        void SleepFor(Duration delay);
+        void SleepUntil(Duration time);
 
+        /**
+         * @brief Is there no outstanding work?
+         * 
+         * @return true if there are no pending posts or timers, and no background coroutines are 
+         * queued or running.
+         * 
+         * O(1): a single load of a counter of outstanding work items. The work item that the 
+         * caller is running on the foreground thread (if any) doesn't count.
+         */
         bool IsDone() const;
 
+        /**
+         * @brief Block until IsDone() is true.
+         * 
+         * On the foreground thread, equivalent to PumpUntilIdle(). On other threads, sleeps until 
+         * the dispatcher becomes idle, without polling. Must not be called from a coroutine running 
+         * on a background (thread pool) thread, which would itself be outstanding work.
+         */
+        void WaitUntilIdle();
+
         bool PumpMessages();
         bool PumpMessages(bool waitForTimers);
 
@@ -134,8 +220,13 @@ namespace cotask
          * @param timeout how long to wait for a message to pump.
          * @throws CoTimedOutException if the timeout occurs before any messages are pumped.
          */
-        void PumpMessages(std::chrono::milliseconds timeout);
+        void PumpMessages(Duration timeout);
 
+        /**
+         * @brief Pump messages until IsDone() is true.
+         * 
+         * Sleeps while waiting for background work to complete. Foreground thread only.
+         */
         void PumpUntilIdle();
 
         void MessageLoop();
@@ -145,11 +236,36 @@ namespace cotask
 
         void SetThreadPoolSize(size_t threads);
 
+        /**
+         * @brief Wait for i/o events on the foreground thread.
+         * 
+         * @param enabled true to enable.
+         * 
+         * When enabled, the foreground dispatcher waits for posted messages, timers, and file readiness 
+         * in a single epoll wait, and i/o events are delivered directly on the foreground thread, rather 
+         * than through the AsyncIo thread. Posts from other threads wake the dispatcher through an eventfd, 
+         * and timers through a timerfd.
+         * 
+         * Must be called on the foreground thread. Disabled by default.
+         */
+        void SetForegroundIo(bool enabled);
+        bool IsForegroundIo() const { return foregroundIo; }
+
         bool IsForeground() const
         {
             return this == pForegroundDispatcher;
         }
 
+        /**
+         * @brief Is this the dispatcher for the calling thread?
+         * 
+         * Unlike CurrentDispatcher(), safe to call on threads that don't have a dispatcher.
+         */
+        bool IsCurrentThread() const
+        {
+            return this == pInstance;
+        }
+
         ILog &Log() const { return *(log.get()); }
 
         void SetLog(const std::shared_ptr<ILog> &log)
@@ -159,7 +275,7 @@ namespace cotask
         }
 
     public:
-        bool PumpTimerMessages(TimeMs time);
+        bool PumpTimerMessages(Duration time);
         // Test Instrumetnation
         class Instrumentation
         {
@@ -170,25 +286,71 @@ namespace cotask
 
         void StartThread(CoTask<> &&task);
 
+        /**
+         * @brief Start a task at the specified priority.
+         * 
+         * @param priority The priority of the task.
+         * @param threadMain A callable that returns the CoTask<> to start.
+         * 
+         * CoTasks start running as soon as they are called, so the priority has to be in effect before 
+         * the task is created: threadMain is called with CurrentPriority() set to priority. The task, and 
+         * everything it awaits, then inherits it.
+         * 
+         *      Dispatcher().StartThread(CoPriority::Idle, [this] { return CopyLogProc(); });
+         */
+        template <typename THREAD_MAIN>
+        void StartThread(CoPriority priority, THREAD_MAIN &&threadMain)
+        {
+            CoPriority savedPriority = std::exchange(detail::currentPriority, priority);
+            try
+            {
+                auto task = threadMain();
+                detail::currentPriority = savedPriority;
+                StartThread(std::move(task));
+            }
+            catch (...)
+            {
+                detail::currentPriority = savedPriority;
+                throw;
+            }
+        }
+
     private:
-        std::list<CoTask<>> coroutineThreads;
-        void ScavengeTasks();
+        friend struct CoTask<>;
+
+        // Tasks started with StartThread(), in a doubly-linked list. Only accessed on this dispatcher's thread.
+        detail::DetachedThread *detachedThreads = nullptr;
+        // Detached tasks that have completed, pushed (from any thread) by the task's final_suspend. 
+        std::atomic<detail::DetachedThread *> completedThreads = nullptr;
+        void ReapCompletedThreads();
+
+        // Posts, timers and background handles that have not yet completed. (Foreground dispatcher only.)
+        // Incremented when work is queued; decremented after it has run (or been cancelled).
+        std::atomic<int64_t> outstandingWork = 0;
+        // The number of work items the foreground thread is running (recursive pumps nest).
+        int foregroundDispatchDepth = 0;
+        void OnWorkCompleted();
+        void ReapThread(detail::DetachedThread *thread);
+        static void OnDetachedThreadCompleted(void *taggedPrecursor) noexcept;
         bool inMessageLoop = false;
         bool quit = false;
 
-        bool messagePosted = false;
+        // Posts are signalled through messagePosted, and only wake the foreground thread 
+        // (wakeSemaphore, or AsyncIo::Wake() in foreground i/o mode) if it is sleeping.
+        std::atomic<bool> messagePosted = false;
+        std::atomic<bool> sleeping = false;
+        std::atomic<bool> foregroundIo = false;
+        std::atomic<AsyncIo *> pAsyncIo = nullptr;
+        std::counting_semaphore<> wakeSemaphore{0};
         void PumpMessageNotifyOne();
         void PumpMessageWaitOne();
-        uint64_t nextTimerHandle = 0;
+        void PumpMessageWaitUntil(Duration time);
         static std::mutex gLogMutex;
         std::shared_ptr<ILog> log = std::make_shared<ConsoleLog>();
         friend class CoTaskSchedulerPool;
         friend class CoTaskSchedulerThread;
         static void RemoveThreadDispatcher();
 
-        std::mutex pumpMessageMutex;
-        std::condition_variable pumpMessageConditionVariable;
-
         std::mutex schedulerMutex;
         static std::mutex creationMutex;
 
@@ -196,46 +358,21 @@ namespace cotask
         CoDispatcher *pForegroundDispatcher;
         CoTaskSchedulerPool *pSchedulerPool;
 
-        struct CoroutineTimerEntry
-        {
-            TimeMs time;
-            std::coroutine_handle<> handle;
-        };
-        struct TimerFunctionEntry
-        {
-            TimeMs time;
-            std::function<void(void)> fn;
-            uint64_t timerHandle;
-        };
-
-        struct TeLess
-        {
-            bool
-            operator()(const struct CoroutineTimerEntry &__x, const struct CoroutineTimerEntry &__y) const
-            {
-                return __x.time > __y.time;
-            }
-        };
-
-        std::priority_queue<CoroutineTimerEntry, std::vector<CoroutineTimerEntry>, TeLess> coroutineTimerQueue;
+        // delayed coroutines and delayed functions.
+        // 4-ary heap with O(log N) insert and cancel. (see TimerQueue.h)
+        TimerQueue timerQueue;
 
-        struct TeFnLess
+        // Posted coroutines, one queue per CoPriority. Lock-free, so that realtime threads can Post().
+        // Only the foreground dispatcher has them: thread pool dispatchers forward posts to it.
+        static constexpr size_t POST_QUEUE_SIZE = 4096;
+        struct PostQueues
         {
-            bool
-            operator()(const struct TimerFunctionEntry &__x, const struct TimerFunctionEntry &__y) const
-            {
-                return __x.time > __y.time;
-            }
+            MpscQueue<std::coroutine_handle<>> lanes[CO_PRIORITY_LANES]{POST_QUEUE_SIZE, POST_QUEUE_SIZE, POST_QUEUE_SIZE};
+            // How many times in a row each lane has been passed over while it had work. (Foreground thread only.)
+            unsigned passedOver[CO_PRIORITY_LANES] = {};
         };
-        std::mutex delayedFunctionMutex;
-
-        // Order N^+N insertion+delete. Priority queue is N log(N) insert, but still N^2+N delete.
-        // The priority isn't really faster, and rebalancing after erase() is awkwardly difficult.
-
-        std::list<TimerFunctionEntry> functionTimerQueue;
-
-        static constexpr size_t DEFAULT_BUFFER_SIZE = 1024;
-        Fifo<std::coroutine_handle<>> queue;
+        std::unique_ptr<PostQueues> postQueues;
+        bool PopPosted(std::coroutine_handle<> *pHandle, CoPriority *pPriority);
     };
 
     template <typename... Dummy>
@@ -251,17 +388,55 @@ namespace cotask
         struct promise_type
 
         {
+            // (Not an aggregate. Otherwise the compiler would initialize the promise from the 
+            // coroutine's arguments, if they happened to convert to the first member.)
+            promise_type() noexcept
+            {
+            }
             ~promise_type()
             {
+                if (hasData)
+                {
+                    std::destroy_at(&data);
+                }
             }
+            // Coroutine frames come from per-thread free lists. (See CoFrameAllocator.h)
+            static void *operator new(size_t size) { return CoFrameAllocator::Allocate(size); }
+            static void operator delete(void *p, size_t size) noexcept { CoFrameAllocator::Free(p, size); }
+
             /********************DATA ************************/
             // Keep a coroutine handle referring to the parent coroutine if any. That is, if we
             // co_await a coroutine within another coroutine, this handle will be used to continue
             // working from where we left off.
-            std::coroutine_handle<> precursor;
+            // 
+            // The address of the awaiting coroutine; or this coroutine's own address, once it has 
+            // completed. The task may complete on another thread while it's being awaited, so
+            // the awaiter and final_suspend race to exchange it, and whichever is second resumes
+            // the awaiting coroutine.
+            std::atomic<void *> precursor = nullptr;
+
+            // Place to hold the results produced by the coroutine. Constructed in place by 
+            // return_value(), so T needn't be default-constructible or assignable, and a
+            // co_returned temporary is moved exactly once. References are stored as pointers.
+            using storage_type = std::conditional_t<std::is_reference_v<T>, std::remove_reference_t<T> *, T>;
+            union
+            {
+                storage_type data;
+            };
+            bool hasData = false;
 
-            // Place to hold the results produced by the coroutine
-            T data;
+            // Move the result out of the promise. (Only valid if the coroutine co_returned a value.)
+            T TakeValue()
+            {
+                if constexpr (std::is_reference_v<T>)
+                {
+                    return static_cast<T>(*data);
+                }
+                else
+                {
+                    return std::move(data);
+                }
+            }
 
             // Invoked when we first enter a coroutine. We initialize the precursor handle
             // with a resume point from where the task is ultimately suspended
@@ -301,10 +476,10 @@ namespace cotask
                     // instead of immediately resuming it by enqueuing it and returning void.
                     std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
                     {
-                        auto precursor = h.promise().precursor;
+                        void *precursor = h.promise().precursor.exchange(h.address(), std::memory_order_acq_rel);
                         if (precursor)
                         {
-                            return precursor;
+                            return std::coroutine_handle<>::from_address(precursor);
                         }
                         return std::noop_coroutine();
                     }
@@ -312,14 +487,22 @@ namespace cotask
                 return awaiter{};
             }
 
-            // When the coroutine co_returns a value, this method is used to publish the result
-            void return_value(T &&value) noexcept
-            {
-                data = std::move(value);
-            }
-            void return_value(const T &value) noexcept
+            // When the coroutine co_returns a value, this method is used to publish the result.
+            // (U defaults to T, so that braced initializers work: co_return {a, b};)
+            template <typename U = T>
+                requires std::is_convertible_v<U &&, T>
+            void return_value(U &&value) noexcept(std::is_reference_v<T> || std::is_nothrow_constructible_v<T, U &&>)
             {
-                data = std::move(value);
+                if constexpr (std::is_reference_v<T>)
+                {
+                    T ref = std::forward<U>(value);
+                    std::construct_at(&data, std::addressof(ref));
+                }
+                else
+                {
+                    std::construct_at(&data, std::forward<U>(value));
+                }
+                hasData = true;
             }
         };
 
@@ -328,8 +511,10 @@ namespace cotask
 
         bool await_ready() const noexcept
         {
-            // No need to suspend if this task has no outstanding work
-            return handle.done();
+            // No need to suspend if this task has completed. (Not handle.done(): the task may be 
+            // completing on another thread. final_suspend publishes the result with a release 
+            // exchange on precursor.)
+            return handle.promise().precursor.load(std::memory_order_acquire) == handle.address();
         }
 
         T await_resume() const
@@ -340,15 +525,17 @@ namespace cotask
                 std::rethrow_exception(promise.unhandledException);
             }
             // The returned value here is what `co_await our_task` evaluates to
-            return std::move(promise.data);
+            return promise.TakeValue();
         }
 
-        void await_suspend(std::coroutine_handle<> coroutine) const noexcept
+        bool await_suspend(std::coroutine_handle<> coroutine) const noexcept
         {
             // The coroutine itself is being suspended (async work can beget other async work)
             // Record the argument as the continuation point when this is resumed later. See
-            // the final_suspend awaiter on the promise_type above for where this gets used
-            handle.promise().precursor = coroutine;
+            // the final_suspend awaiter on the promise_type above for where this gets used.
+            // If the task completed (on another thread) since await_ready(), don't suspend.
+            void *expected = nullptr;
+            return handle.promise().precursor.compare_exchange_strong(expected, coroutine.address(), std::memory_order_acq_rel);
         }
         // This handle is assigned to when the coroutine itself is suspended (see await_suspend above)
         std::coroutine_handle<promise_type> handle = nullptr;
@@ -393,14 +580,33 @@ namespace cotask
         // The return type of a coroutine must contain a nested struct or type alias called `promise_type`
         struct promise_type
         {
+            // (Not an aggregate. Otherwise the compiler would initialize the promise from the 
+            // coroutine's arguments, if they happened to convert to the first member.)
+            promise_type() noexcept
+            {
+            }
             ~promise_type()
             {
             }
+            // Coroutine frames come from per-thread free lists. (See CoFrameAllocator.h)
+            static void *operator new(size_t size) { return CoFrameAllocator::Allocate(size); }
+            static void operator delete(void *p, size_t size) noexcept { CoFrameAllocator::Free(p, size); }
             
             // Keep a coroutine handle referring to the parent coroutine if any. That is, if we
             // co_await a coroutine within another coroutine, this handle will be used to continue
             // working from where we left off.
-            std::coroutine_handle<> precursor;
+            // 
+            // The address of the awaiting coroutine; or this coroutine's own address, once it has 
+            // completed. The task may complete on another thread while it's being awaited, so
+            // the awaiter and final_suspend race to exchange it, and whichever is second resumes
+            // the awaiting coroutine.
+            // 
+            // Tasks started with CoDispatcher::StartThread() have no awaiter. Their precursor is the
+            // address of the dispatcher's bookkeeping record, with the low bit set.
+            std::atomic<void *> precursor = nullptr;
+
+            static constexpr uintptr_t DETACHED_TAG = 1;
+            static bool IsDetachedTag(void *precursor) { return (((uintptr_t)precursor) & DETACHED_TAG) != 0; }
 
             // Invoked when we first enter a coroutine. We initialize the precursor handle
             // with a resume point from where the task is ultimately suspended
@@ -436,10 +642,16 @@ namespace cotask
                     // instead of immediately resuming it by enqueuing it and returning void.
                     std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) const noexcept
                     {
-                        auto precursor = h.promise().precursor;
+                        void *precursor = h.promise().precursor.exchange(h.address(), std::memory_order_acq_rel);
                         if (precursor)
                         {
-                            return precursor;
+                            if (IsDetachedTag(precursor))
+                            {
+                                // started with StartThread(). Queue for reaping by the owning dispatcher.
+                                CoDispatcher::OnDetachedThreadCompleted(precursor);
+                                return std::noop_coroutine();
+                            }
+                            return std::coroutine_handle<>::from_address(precursor);
                         }
                         return std::noop_coroutine();
                     }
@@ -458,8 +670,10 @@ namespace cotask
 
         bool await_ready() const noexcept
         {
-            // No need to suspend if this task has no outstanding wiork
-            return handle.done();
+            // No need to suspend if this task has completed. (Not handle.done(): the task may be 
+            // completing on another thread. final_suspend publishes the result with a release 
+            // exchange on precursor.)
+            return handle.promise().precursor.load(std::memory_order_acquire) == handle.address();
         }
 
         void await_resume() const
@@ -471,17 +685,19 @@ namespace cotask
             }
         }
 
-        void await_suspend(std::coroutine_handle<> coroutine) const noexcept
+        bool await_suspend(std::coroutine_handle<> coroutine) const noexcept
         {
             // The coroutine itself is being suspended (async work can beget other async work)
             // Record the argument as the continuation point when this is resumed later. See
-            // the final_suspend awaiter on the promise_type above for where this gets used
-            handle.promise().precursor = coroutine;
+            // the final_suspend awaiter on the promise_type above for where this gets used.
+            // If the task completed (on another thread) since await_ready(), don't suspend.
+            void *expected = nullptr;
+            return handle.promise().precursor.compare_exchange_strong(expected, coroutine.address(), std::memory_order_acq_rel);
         }
 
         void GetResult()
         {
-            while (!handle.done())
+            while (!await_ready())
             {
                 CoDispatcher::CurrentDispatcher().PumpMessages(true);
             }
@@ -554,54 +770,156 @@ namespace cotask
     };
 
     //***************************************************************
-    inline auto CoDelay(CoDispatcher::TimeMs delayMs) noexcept
+    inline auto CoDelay(CoDispatcher::Duration delay) noexcept
     {
         struct awaiter
         {
             ~awaiter() {
 
             }
-            CoDispatcher::TimeMs delayMs;
-            awaiter(CoDispatcher::TimeMs delayMs)
+            CoDispatcher::Duration delay;
+            awaiter(CoDispatcher::Duration delay)
             {
-                this->delayMs = delayMs;
+                this->delay = delay;
             }
             bool await_ready() const noexcept { return false; }
 
             void await_suspend(std::coroutine_handle<> coroutine) noexcept
             {
-                    CoDispatcher::CurrentDispatcher().PostDelayed(delayMs, coroutine);
+                    CoDispatcher::CurrentDispatcher().PostDelayed(delay, coroutine);
             }
 
             void await_resume() const noexcept
             {
             }
         };
-        return awaiter{delayMs};
+        return awaiter{delay};
     }
 
-    inline auto CoForeground() noexcept
+    /**
+     * @brief A source of cancellable delays.
+     * 
+     * CoTimer::Delay() behaves like CoDelay(), except that pending delays can be 
+     * ended early by calling Cancel(). 
+     * 
+     * Cancellation is sticky: once Cancel() has been called, pending delays 
+     * resume immediately, and subsequent delays complete without waiting.
+     * 
+     * Cancel() may be called from any thread. The CoTimer must outlive any delays 
+     * that are waiting on it.
+     * 
+     * Usage:
+     * 
+     *      CoTimer timer;
+     * 
+     *      if (!co_await timer.Delay(10s)) {
+     *          // cancelled.
+     *      }
+     */
+    class CoTimer
+    {
+    public:
+        CoTimer() {}
+        CoTimer(const CoTimer &) = delete;
+        CoTimer &operator=(const CoTimer &) = delete;
+
+    private:
+        struct DelayAwaiter
+        {
+            DelayAwaiter(CoTimer *pTimer, CoDispatcher::Duration delay)
+                : pTimer(pTimer), delay(delay)
+            {
+            }
+            CoTimer *pTimer;
+            CoDispatcher::Duration delay;
+            std::coroutine_handle<> coroutine;
+            CoDispatcher::TimerHandle timerHandle = 0;
+            CoPriority priority = CoPriority::Normal;
+            bool cancelled = false;
+
+            bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> coroutine)
+            {
+                this->coroutine = coroutine;
+                this->priority = CoDispatcher::CurrentPriority();
+                return pTimer->AddDelay(this);
+            }
+            bool await_resume()
+            {
+                pTimer->RemoveDelay(this);
+                return !cancelled;
+            }
+        };
+
+    public:
+        /**
+         * @brief Suspend the current coroutine for the specified time.
+         * 
+         * @param delay The time to wait.
+         * @return (awaitable) true if the delay completed; false if the delay was cancelled.
+         */
+        DelayAwaiter Delay(CoDispatcher::Duration delay) { return DelayAwaiter(this, delay); }
+
+        /**
+         * @brief Cancel all pending and future delays.
+         * 
+         */
+        void Cancel();
+
+        /**
+         * @brief Has Cancel() been called?
+         * 
+         */
+        bool IsCancelled()
+        {
+            std::lock_guard lock{mutex};
+            return cancelled;
+        }
+
+    private:
+        bool AddDelay(DelayAwaiter *pAwaiter);
+        void RemoveDelay(DelayAwaiter *pAwaiter);
+
+        std::mutex mutex;
+        bool cancelled = false;
+        std::vector<DelayAwaiter *> pendingDelays;
+    };
+
+    /**
+     * @brief Continue on the foreground thread.
+     * 
+     * @param priority (optional) The priority at which to continue. By default, the current priority. The 
+     * coroutine keeps the new priority from then on. (See CoPriority.)
+     * 
+     * Always suspends, so it also yields to other foreground work of the same or higher priority.
+     */
+    inline auto CoForeground(CoPriority priority = CoDispatcher::CurrentPriority()) noexcept
     {
         struct awaiter
         {
+            CoPriority priority;
 
             bool await_ready() const noexcept { return false; }
 
             void await_suspend(std::coroutine_handle<> coroutine) noexcept
             {
-                CoDispatcher::CurrentDispatcher().Post(coroutine);
+                CoDispatcher::CurrentDispatcher().Post(coroutine, priority);
             }
 
             void await_resume() const noexcept
             {
             }
         };
-        return awaiter{};
+        return awaiter{priority};
     }
     inline auto CoBackground() noexcept
     {
         struct awaiter
         {
+            // The thread pool doesn't have priorities, but continuations posted back to the foreground do.
+            CoPriority priority = CoDispatcher::CurrentPriority();
+
             bool await_ready() const noexcept { return false; }
 
             void await_suspend(std::coroutine_handle<> coroutine) noexcept
@@ -611,6 +929,7 @@ namespace cotask
 
             void await_resume() const noexcept
             {
+                detail::currentPriority = priority;
             }
         };
         return awaiter{};
@@ -642,7 +961,7 @@ namespace cotask
     template <typename T>
     T CoTask<T>::GetResult()
     {
-        while (!handle.done())
+        while (!await_ready())
         {
             CoDispatcher::CurrentDispatcher().PumpMessages(true);
         }
@@ -24,149 +24,430 @@
 
 #pragma once
 
-#include <vector>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <limits>
+#include <utility>
+#include <type_traits>
 #include <exception>
 #include <stdexcept>
 
 namespace cotask
 {
+    /**
+     * @brief FIFO queue, implemented as a power-of-two ring buffer.
+     * 
+     * Supports move-only element types. The buffer grows by doubling, up to maxCapacity. 
+     * Trivially copyable elements are grown in place (realloc, and a memcpy of the wrapped segment); 
+     * other element types are move-constructed into a new buffer.
+     * 
+     * When maxCapacity is reached, push() throws std::length_error, and try_push() returns false, 
+     * allowing producers to apply backpressure. A Fifo constructed with initialCapacity == maxCapacity 
+     * never allocates after construction.
+     * 
+     * @tparam T The element type.
+     */
     template <typename T>
     class Fifo
     {
     public:
-        Fifo(int initialCapacity = 100);
+        static constexpr size_t UNBOUNDED = std::numeric_limits<size_t>::max();
+
+        /**
+         * @brief Constructor.
+         * 
+         * @param initialCapacity Initial capacity. Rounded up to a power of two.
+         * @param maxCapacity Maximum capacity. Rounded up to a power of two. 
+         */
+        Fifo(size_t initialCapacity = 16, size_t maxCapacity = UNBOUNDED);
+        Fifo(const Fifo &other);
+        /**
+         * @brief Move constructor.
+         * 
+         * other is left empty, without a buffer. It remains usable: the next push allocates.
+         */
+        Fifo(Fifo &&other) noexcept;
+        ~Fifo();
+
+        Fifo &operator=(const Fifo &other);
+        Fifo &operator=(Fifo &&other) noexcept;
+
         void push(const T &value);
         void push(T &&value);
+        template <typename... ARGS>
+        T &emplace(ARGS &&...args);
+
+        /**
+         * @brief Push, unless the Fifo is full and at its maximum capacity.
+         * 
+         * @return false if the Fifo is full.
+         */
+        bool try_push(const T &value);
+        bool try_push(T &&value);
+
         T pop();
-        size_t size() const;
-        bool empty() const;
+        T &front();
+        const T &front() const;
+        T &back();
+        const T &back() const;
+
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        bool full() const { return size_ == capacity_ && capacity_ >= maxCapacity_; }
         T &operator[](size_t index);
         const T &operator[](size_t index) const;
         void erase(size_t index);
         void clear();
         void reserve(size_t size);
-        size_t capacity() const;
+        size_t capacity() const { return capacity_; }
+        size_t max_capacity() const { return maxCapacity_; }
 
     private:
+        // trivially copyable types are relocated with realloc/memcpy.
+        static constexpr bool RELOCATABLE = std::is_trivially_copyable_v<T> && alignof(T) <= alignof(std::max_align_t);
+
+        static size_t RoundUp(size_t value);
+        T *Allocate(size_t capacity);
+        void Free(T *buffer);
+        void Grow(size_t newCapacity);
+        bool EnsureSpace(bool throwIfFull);
+        T *Slot(size_t index) const { return &buffer[(head_ + index) & (capacity_ - 1)]; }
+
+        T *buffer = nullptr;
         size_t head_ = 0;
-        size_t tail_ = 0;
         size_t size_ = 0;
-        std::vector<T> storage;
+        size_t capacity_ = 0;
+        size_t maxCapacity_ = UNBOUNDED;
     };
 
     /*****/
     template <typename T>
-    Fifo<T>::Fifo(int initialCapacity)
+    size_t Fifo<T>::RoundUp(size_t value)
     {
-        storage.resize(initialCapacity);
+        size_t result = 1;
+        while (result < value)
+        {
+            if (result > std::numeric_limits<size_t>::max() / 2)
+            {
+                return std::numeric_limits<size_t>::max();
+            }
+            result *= 2;
+        }
+        return result;
     }
+
     template <typename T>
-    void Fifo<T>::push(const T &value)
+    T *Fifo<T>::Allocate(size_t capacity)
     {
-        if (size_ == storage.size())
+        if (capacity > std::numeric_limits<size_t>::max() / sizeof(T))
         {
-            reserve(storage.size() * 2);
+            throw std::length_error("Fifo too large.");
         }
-        storage[tail_] = value;
-        ++tail_;
-        if (tail_ == storage.size())
+        if constexpr (RELOCATABLE)
         {
-            tail_ = 0;
+            void *p = std::malloc(capacity * sizeof(T));
+            if (p == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            return (T *)p;
+        }
+        else
+        {
+            return (T *)::operator new(capacity * sizeof(T), std::align_val_t(alignof(T)));
         }
-        ++size_;
     }
+
     template <typename T>
-    T &Fifo<T>::operator[](size_t index)
+    void Fifo<T>::Free(T *buffer)
     {
-        if (index > size_)
+        if constexpr (RELOCATABLE)
+        {
+            std::free(buffer);
+        }
+        else
         {
-            throw std::invalid_argument();
+            ::operator delete(buffer, std::align_val_t(alignof(T)));
         }
-        index += head_;
-        if (index < storage.size())
-            index -= storage.size();
-        return storage[index];
     }
+
     template <typename T>
-    const T &Fifo<T>::operator[](size_t index) const
+    Fifo<T>::Fifo(size_t initialCapacity, size_t maxCapacity)
     {
-        if (index > size_)
+        if (initialCapacity == 0)
+        {
+            initialCapacity = 1;
+        }
+        maxCapacity_ = maxCapacity == UNBOUNDED ? UNBOUNDED : RoundUp(maxCapacity);
+        capacity_ = RoundUp(initialCapacity);
+        if (capacity_ > maxCapacity_)
         {
-            throw std::invalid_argument();
+            throw std::invalid_argument("initialCapacity > maxCapacity");
         }
-        index += head_;
-        if (index < storage.size())
-            index -= storage.size();
-        return storage[index];
+        buffer = Allocate(capacity_);
     }
 
+    template <typename T>
+    Fifo<T>::Fifo(const Fifo &other)
+        : Fifo(other.capacity_, other.maxCapacity_)
+    {
+        for (size_t i = 0; i < other.size_; ++i)
+        {
+            new (Slot(i)) T(*other.Slot(i));
+            ++size_;
+        }
+    }
 
     template <typename T>
-    void Fifo<T>::clear()
+    Fifo<T>::Fifo(Fifo &&other) noexcept
+        : buffer(other.buffer), head_(other.head_), size_(other.size_), capacity_(other.capacity_), maxCapacity_(other.maxCapacity_)
     {
-        while (size_)
+        other.buffer = nullptr;
+        other.head_ = 0;
+        other.size_ = 0;
+        other.capacity_ = 0;
+    }
+
+    template <typename T>
+    Fifo<T>::~Fifo()
+    {
+        clear();
+        Free(buffer);
+    }
+
+    template <typename T>
+    Fifo<T> &Fifo<T>::operator=(const Fifo &other)
+    {
+        if (this != &other)
         {
-            pop();
+            Fifo copy{other};
+            *this = std::move(copy);
         }
+        return *this;
     }
 
     template <typename T>
-    void Fifo<T>::push(T &&value)
+    Fifo<T> &Fifo<T>::operator=(Fifo &&other) noexcept
+    {
+        if (this != &other)
+        {
+            clear();
+            Free(buffer);
+            buffer = other.buffer;
+            head_ = other.head_;
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+            maxCapacity_ = other.maxCapacity_;
+            other.buffer = nullptr;
+            other.head_ = 0;
+            other.size_ = 0;
+            other.capacity_ = 0;
+        }
+        return *this;
+    }
+
+    template <typename T>
+    void Fifo<T>::Grow(size_t newCapacity)
     {
-        if (size_ == storage.size)
+        size_t oldCapacity = capacity_;
+        // the two segments of the ring: [head_, head_+firstCount), and [0, size_-firstCount)
+        size_t firstCount = size_ < oldCapacity - head_ ? size_ : oldCapacity - head_;
+        size_t secondCount = size_ - firstCount;
+        if constexpr (RELOCATABLE)
         {
-            resize(storage.size() * 2);
+            if (newCapacity > std::numeric_limits<size_t>::max() / sizeof(T))
+            {
+                throw std::length_error("Fifo too large.");
+            }
+            T *newBuffer = (T *)std::realloc((void *)buffer, newCapacity * sizeof(T));
+            if (newBuffer == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            buffer = newBuffer;
+            // unwrap: the wrapped segment goes immediately after the old end of the buffer.
+            std::memcpy((void *)(buffer + oldCapacity), (void *)buffer, secondCount * sizeof(T));
         }
-        storage[tail_] = std::move(value);
-        ++tail_;
-        if (tail_ == storage.size())
+        else
         {
+            T *newBuffer = Allocate(newCapacity);
+            for (size_t i = 0; i < size_; ++i)
+            {
+                T *p = Slot(i);
+                new (newBuffer + i) T(std::move(*p));
+                p->~T();
+            }
+            Free(buffer);
+            buffer = newBuffer;
             head_ = 0;
         }
+        capacity_ = newCapacity;
+    }
+
+    template <typename T>
+    bool Fifo<T>::EnsureSpace(bool throwIfFull)
+    {
+        if (size_ == capacity_)
+        {
+            if (capacity_ >= maxCapacity_ || capacity_ > std::numeric_limits<size_t>::max() / 2)
+            {
+                if (throwIfFull)
+                {
+                    throw std::length_error("Fifo is full.");
+                }
+                return false;
+            }
+            Grow(capacity_ == 0 ? 1 : capacity_ * 2); // (a moved-from Fifo has no buffer.)
+        }
+        return true;
+    }
+
+    template <typename T>
+    void Fifo<T>::push(const T &value)
+    {
+        EnsureSpace(true);
+        new (Slot(size_)) T(value);
         ++size_;
     }
 
+    template <typename T>
+    void Fifo<T>::push(T &&value)
+    {
+        EnsureSpace(true);
+        new (Slot(size_)) T(std::move(value));
+        ++size_;
+    }
+
+    template <typename T>
+    template <typename... ARGS>
+    T &Fifo<T>::emplace(ARGS &&...args)
+    {
+        EnsureSpace(true);
+        T *p = new (Slot(size_)) T(std::forward<ARGS>(args)...);
+        ++size_;
+        return *p;
+    }
+
+    template <typename T>
+    bool Fifo<T>::try_push(const T &value)
+    {
+        if (!EnsureSpace(false))
+        {
+            return false;
+        }
+        new (Slot(size_)) T(value);
+        ++size_;
+        return true;
+    }
+
+    template <typename T>
+    bool Fifo<T>::try_push(T &&value)
+    {
+        if (!EnsureSpace(false))
+        {
+            return false;
+        }
+        new (Slot(size_)) T(std::move(value));
+        ++size_;
+        return true;
+    }
+
     template <typename T>
     T Fifo<T>::pop()
     {
         if (size_ == 0)
             throw std::out_of_range("Index out of range.");
-        T result = std::move(storage[head_]);
-        ++head_;
-        if (head_ == storage.size())
-            head_ = 0;
+        T *p = Slot(0);
+        T result = std::move(*p);
+        p->~T();
+        head_ = (head_ + 1) & (capacity_ - 1);
         --size_;
         return result;
     }
+
+    template <typename T>
+    T &Fifo<T>::front()
+    {
+        return (*this)[0];
+    }
     template <typename T>
-    bool Fifo<T>::empty() const
+    const T &Fifo<T>::front() const
     {
-        return size_ == 0;
+        return (*this)[0];
     }
     template <typename T>
-    size_t Fifo<T>::size() const
+    T &Fifo<T>::back()
     {
-        return size_;
+        return (*this)[size_ - 1];
     }
     template <typename T>
-    void Fifo<T>::reserve(size_t size)
+    const T &Fifo<T>::back() const
     {
-        std::vector<T> t;
-        t.resize(size_);
-        for (size_t i = 0; size_ != 0; ++i)
+        return (*this)[size_ - 1];
+    }
+
+    template <typename T>
+    T &Fifo<T>::operator[](size_t index)
+    {
+        if (index >= size_)
         {
-            t[i] = pop();
+            throw std::out_of_range("Index out of range.");
         }
-        head_ = 0;
-        tail_ = 0;
-        storage.resize(t.size() * 2);
-        for (size_t i = 0; i < t.size(); ++i)
+        return *Slot(index);
+    }
+    template <typename T>
+    const T &Fifo<T>::operator[](size_t index) const
+    {
+        if (index >= size_)
+        {
+            throw std::out_of_range("Index out of range.");
+        }
+        return *Slot(index);
+    }
+
+    template <typename T>
+    void Fifo<T>::erase(size_t index)
+    {
+        if (index >= size_)
+        {
+            throw std::out_of_range("Index out of range.");
+        }
+        for (size_t i = index; i + 1 < size_; ++i)
         {
-            push(t[i]);
+            *Slot(i) = std::move(*Slot(i + 1));
         }
+        Slot(size_ - 1)->~T();
+        --size_;
     }
-    template <typename T> 
-    size_t Fifo<T>::capacity() const {
-        return size_;
+
+    template <typename T>
+    void Fifo<T>::clear()
+    {
+        if constexpr (!std::is_trivially_destructible_v<T>)
+        {
+            for (size_t i = 0; i < size_; ++i)
+            {
+                Slot(i)->~T();
+            }
+        }
+        head_ = 0;
+        size_ = 0;
+    }
+
+    template <typename T>
+    void Fifo<T>::reserve(size_t size)
+    {
+        if (size <= capacity_)
+        {
+            return;
+        }
+        size_t newCapacity = RoundUp(size);
+        if (newCapacity > maxCapacity_)
+        {
+            throw std::length_error("Fifo reserve exceeds maximum capacity.");
+        }
+        Grow(newCapacity);
     }
-} // namespace
\ No newline at end of file
+} // namespace
@@ -0,0 +1,185 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+namespace cotask
+{
+    template <typename SIGNATURE, size_t CAPACITY = 4 * sizeof(void *)>
+    class InplaceFunction;
+
+    /**
+     * @brief Move-only replacement for std::function, with in-place storage.
+     * 
+     * Callables of up to CAPACITY bytes (by default, a lambda with up to four captured 
+     * pointers) are stored inside the InplaceFunction itself, so constructing, moving 
+     * and invoking one never allocates. Larger callables, and callables that can throw
+     * while being moved, are allocated on the heap, as they would be by std::function.
+     * 
+     * Unlike std::function, callables don't need to be copyable, and InplaceFunction 
+     * can't be copied.
+     * 
+     * Invoking an empty InplaceFunction throws std::bad_function_call.
+     * 
+     * @tparam R Return type.
+     * @tparam ARGS Argument types.
+     * @tparam CAPACITY Size of in-place storage, in bytes.
+     */
+    template <typename R, typename... ARGS, size_t CAPACITY>
+    class InplaceFunction<R(ARGS...), CAPACITY>
+    {
+    public:
+        /**
+         * @brief True if a callable of type F is stored in place, without allocating.
+         */
+        template <typename F>
+        static constexpr bool is_inplace =
+            sizeof(F) <= CAPACITY &&
+            alignof(F) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible_v<F>;
+
+        InplaceFunction() noexcept {}
+        InplaceFunction(std::nullptr_t) noexcept {}
+
+        template <typename F, typename FN = std::decay_t<F>>
+            requires(!std::is_same_v<FN, InplaceFunction> && std::is_invocable_r_v<R, FN &, ARGS...>)
+        InplaceFunction(F &&fn)
+        {
+            if constexpr (std::is_pointer_v<FN> || std::is_member_pointer_v<FN> || requires(const FN &f) { f == nullptr; })
+            {
+                if (fn == nullptr)
+                {
+                    return; // (e.g. an empty std::function)
+                }
+            }
+            if constexpr (is_inplace<FN>)
+            {
+                new (storage) FN(std::forward<F>(fn));
+                ops = &inplaceOps<FN>;
+            }
+            else
+            {
+                *reinterpret_cast<FN **>(storage) = new FN(std::forward<F>(fn));
+                ops = &heapOps<FN>;
+            }
+        }
+
+        InplaceFunction(InplaceFunction &&other) noexcept
+        {
+            MoveFrom(other);
+        }
+        InplaceFunction &operator=(InplaceFunction &&other) noexcept
+        {
+            if (this != &other)
+            {
+                Reset();
+                MoveFrom(other);
+            }
+            return *this;
+        }
+        InplaceFunction &operator=(std::nullptr_t) noexcept
+        {
+            Reset();
+            return *this;
+        }
+        InplaceFunction(const InplaceFunction &) = delete;
+        InplaceFunction &operator=(const InplaceFunction &) = delete;
+
+        ~InplaceFunction() { Reset(); }
+
+        R operator()(ARGS... args)
+        {
+            if (!ops)
+            {
+                throw std::bad_function_call();
+            }
+            return ops->invoke(storage, std::forward<ARGS>(args)...);
+        }
+
+        explicit operator bool() const noexcept { return ops != nullptr; }
+        bool operator==(std::nullptr_t) const noexcept { return ops == nullptr; }
+
+    private:
+        struct Ops
+        {
+            R (*invoke)(void *storage, ARGS &&...args);
+            // move-construct into an uninitialized target, and destroy the source.
+            void (*relocate)(void *target, void *source) noexcept;
+            void (*destroy)(void *storage) noexcept;
+        };
+
+        template <typename FN>
+        static constexpr Ops inplaceOps{
+            [](void *storage, ARGS &&...args) -> R {
+                return std::invoke(*static_cast<FN *>(storage), std::forward<ARGS>(args)...);
+            },
+            [](void *target, void *source) noexcept {
+                FN *p = static_cast<FN *>(source);
+                new (target) FN(std::move(*p));
+                p->~FN();
+            },
+            [](void *storage) noexcept {
+                static_cast<FN *>(storage)->~FN();
+            }};
+
+        template <typename FN>
+        static constexpr Ops heapOps{
+            [](void *storage, ARGS &&...args) -> R {
+                return std::invoke(**static_cast<FN **>(storage), std::forward<ARGS>(args)...);
+            },
+            [](void *target, void *source) noexcept {
+                *static_cast<FN **>(target) = *static_cast<FN **>(source);
+            },
+            [](void *storage) noexcept {
+                delete *static_cast<FN **>(storage);
+            }};
+
+        void MoveFrom(InplaceFunction &other) noexcept
+        {
+            if (other.ops)
+            {
+                other.ops->relocate(storage, other.storage);
+                ops = other.ops;
+                other.ops = nullptr;
+            }
+        }
+        void Reset() noexcept
+        {
+            if (ops)
+            {
+                ops->destroy(storage);
+                ops = nullptr;
+            }
+        }
+
+        const Ops *ops = nullptr;
+        alignas(std::max_align_t) unsigned char storage[CAPACITY];
+    };
+} // namespace
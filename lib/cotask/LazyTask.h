@@ -0,0 +1,334 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+#include "CoTask.h"
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <type_traits>
+
+#if !defined(__OPTIMIZE__) || defined(__SANITIZE_ADDRESS__)
+#define COTASK_BOUNDED_TRANSFERS 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define COTASK_BOUNDED_TRANSFERS 1
+#endif
+#endif
+#ifndef COTASK_BOUNDED_TRANSFERS
+#define COTASK_BOUNDED_TRANSFERS 0
+#endif
+
+namespace cotask
+{
+    template <typename T = void>
+    class LazyTask;
+
+#ifndef DOXYGEN
+    namespace detail
+    {
+        // Symmetric transfers are tail calls in optimized builds. Unoptimized (and sanitized) 
+        // builds grow the stack with each one, so a loop that repeatedly awaits LazyTasks that 
+        // complete synchronously would eventually overflow it. In those builds, once 
+        // MAX_TRANSFER_DEPTH transfers have piled up since the dispatcher resumed the current 
+        // coroutine, the continuation is posted back to the executor it's running on instead, 
+        // which unwinds the stack.
+        constexpr unsigned MAX_TRANSFER_DEPTH = 128;
+
+        // The handle to return from await_suspend() in order to resume continuation.
+        inline std::coroutine_handle<> TransferTo(std::coroutine_handle<> continuation) noexcept
+        {
+            if (!continuation)
+            {
+                return std::noop_coroutine();
+            }
+#if COTASK_BOUNDED_TRANSFERS
+            if (++transferDepth >= MAX_TRANSFER_DEPTH)
+            {
+                CoDispatcher &dispatcher = CoDispatcher::CurrentDispatcher();
+                if (dispatcher.IsForeground())
+                {
+                    dispatcher.Post(continuation);
+                }
+                else
+                {
+                    dispatcher.PostBackground(continuation);
+                }
+                return std::noop_coroutine();
+            }
+#endif
+            return continuation;
+        }
+
+        class LazyPromiseBase
+        {
+        public:
+            // Coroutine frames come from per-thread free lists. (See CoFrameAllocator.h)
+            static void *operator new(size_t size) { return CoFrameAllocator::Allocate(size); }
+            static void operator delete(void *p, size_t size) noexcept { CoFrameAllocator::Free(p, size); }
+
+            // Don't start until awaited.
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+
+            struct FinalAwaiter
+            {
+                bool await_ready() const noexcept { return false; }
+                void await_resume() const noexcept {}
+
+                // Symmetric transfer back to the awaiting coroutine. The awaiter is always linked 
+                // before the task starts, so there is nothing to race.
+                template <typename PROMISE>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<PROMISE> h) noexcept
+                {
+                    return TransferTo(h.promise().continuation);
+                }
+            };
+            FinalAwaiter final_suspend() const noexcept { return {}; }
+
+            void unhandled_exception() noexcept
+            {
+                unhandledException = std::current_exception();
+            }
+
+            std::coroutine_handle<> continuation;
+            std::exception_ptr unhandledException;
+        };
+
+        template <typename T>
+        class LazyPromise : public LazyPromiseBase
+        {
+        public:
+            // (Not an aggregate. See CoTask<T>::promise_type.)
+            LazyPromise() noexcept {}
+            ~LazyPromise()
+            {
+                if (hasData)
+                {
+                    std::destroy_at(&data);
+                }
+            }
+
+            LazyTask<T> get_return_object() noexcept;
+
+            // Result storage, as for CoTask<T>.
+            template <typename U = T>
+                requires std::is_convertible_v<U &&, T>
+            void return_value(U &&value) noexcept(std::is_reference_v<T> || std::is_nothrow_constructible_v<T, U &&>)
+            {
+                if constexpr (std::is_reference_v<T>)
+                {
+                    T ref = std::forward<U>(value);
+                    std::construct_at(&data, std::addressof(ref));
+                }
+                else
+                {
+                    std::construct_at(&data, std::forward<U>(value));
+                }
+                hasData = true;
+            }
+            T TakeValue()
+            {
+                if constexpr (std::is_reference_v<T>)
+                {
+                    return static_cast<T>(*data);
+                }
+                else
+                {
+                    return std::move(data);
+                }
+            }
+
+        private:
+            using storage_type = std::conditional_t<std::is_reference_v<T>, std::remove_reference_t<T> *, T>;
+            union
+            {
+                storage_type data;
+            };
+            bool hasData = false;
+        };
+
+        template <>
+        class LazyPromise<void> : public LazyPromiseBase
+        {
+        public:
+            LazyPromise() noexcept {}
+
+            LazyTask<void> get_return_object() noexcept;
+
+            void return_void() noexcept {}
+            void TakeValue() noexcept {}
+        };
+
+        template <typename T>
+        using EagerTask = std::conditional_t<std::is_void_v<T>, CoTask<>, CoTask<T>>;
+    }
+#endif
+
+    /**
+     * @brief A coroutine task that doesn't start until it is awaited.
+     * 
+     * @tparam T The type of the value returned by the coroutine, or void.
+     * 
+     * CoTasks start running as soon as they are called, and are linked to their awaiter 
+     * afterwards, which requires an atomic handshake when they complete. A LazyTask is suspended 
+     * when it is called, and starts when it is co_awaited, by symmetric transfer from the awaiting 
+     * coroutine; when it completes, it transfers straight back. Chains of nested LazyTasks 
+     * therefore run as tail calls, without atomic operations, and without growing the stack.
+     * 
+     * LazyTasks must be co_awaited exactly once, from a coroutine; a LazyTask that is destroyed 
+     * without being awaited never runs. Use Start() (or the conversion to CoTask) to run one 
+     * from non-coroutine code, or to run it concurrently, e.g. with CoDispatcher::StartThread() 
+     * or WhenAll(). Use ToLazyTask() to await a CoTask where a LazyTask is required.
+     * 
+     * Suited to private helpers that are always immediately awaited:
+     * 
+     *      LazyTask<size_t> ReadReply(char *buffer, size_t length);
+     *      ...
+     *      size_t length = co_await ReadReply(buffer, sizeof(buffer));
+     * 
+     * Frames come from CoFrameAllocator. Compilers are permitted to elide the frame allocation 
+     * of a LazyTask that is awaited immediately (HALO), which is impossible for an eager task.
+     */
+    template <typename T>
+    class [[nodiscard("Are you missing a co_await?")]] LazyTask
+    {
+    public:
+        using promise_type = detail::LazyPromise<T>;
+
+        LazyTask(LazyTask &&other) noexcept
+            : handle(std::exchange(other.handle, nullptr))
+        {
+        }
+        LazyTask &operator=(LazyTask &&other) noexcept
+        {
+            if (this != &other)
+            {
+                if (handle)
+                {
+                    handle.destroy();
+                }
+                handle = std::exchange(other.handle, nullptr);
+            }
+            return *this;
+        }
+        ~LazyTask()
+        {
+            if (handle)
+            {
+                handle.destroy();
+            }
+        }
+
+        bool await_ready() const noexcept { return handle.done(); }
+
+        // Start the task, by symmetric transfer.
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> coroutine) noexcept
+        {
+            handle.promise().continuation = coroutine;
+            return handle;
+        }
+
+        T await_resume()
+        {
+            auto &promise = handle.promise();
+            if (promise.unhandledException)
+            {
+                std::rethrow_exception(promise.unhandledException);
+            }
+            return promise.TakeValue();
+        }
+
+        /**
+         * @brief Start the task, and return an (eager) CoTask that completes when it does.
+         */
+        detail::EagerTask<T> Start() &&
+        {
+            return Run(std::move(*this));
+        }
+        /**
+         * @brief Start the task. See Start().
+         */
+        operator detail::EagerTask<T>() &&
+        {
+            return Run(std::move(*this));
+        }
+
+    private:
+        friend promise_type;
+        explicit LazyTask(std::coroutine_handle<promise_type> handle)
+            : handle(handle)
+        {
+        }
+
+        static detail::EagerTask<T> Run(LazyTask task)
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                co_await task;
+            }
+            else
+            {
+                co_return co_await task;
+            }
+        }
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+#ifndef DOXYGEN
+    namespace detail
+    {
+        template <typename T>
+        LazyTask<T> LazyPromise<T>::get_return_object() noexcept
+        {
+            return LazyTask<T>(std::coroutine_handle<LazyPromise<T>>::from_promise(*this));
+        }
+        inline LazyTask<void> LazyPromise<void>::get_return_object() noexcept
+        {
+            return LazyTask<void>(std::coroutine_handle<LazyPromise<void>>::from_promise(*this));
+        }
+    }
+#endif
+
+    /**
+     * @brief Await a CoTask as a LazyTask.
+     * 
+     * @param task The task. (Already running, since CoTasks start eagerly.)
+     * @return LazyTask<T> A task that completes with the result of task.
+     */
+    template <typename T>
+    LazyTask<T> ToLazyTask(CoTask<T> task)
+    {
+        co_return co_await task;
+    }
+
+    /**
+     * @brief Await a CoTask<> as a LazyTask<>.
+     */
+    inline LazyTask<> ToLazyTask(CoTask<> task)
+    {
+        co_await task;
+    }
+
+} // namespace
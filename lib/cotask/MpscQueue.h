@@ -0,0 +1,187 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <type_traits>
+#include "Fifo.h"
+
+namespace cotask
+{
+    /**
+     * @brief Multi-producer, single-consumer queue.
+     * 
+     * A fixed-capacity ring (Vyukov's bounded queue), allocated once at construction. push() is 
+     * lock-free and doesn't allocate, so it is safe to call from a realtime thread, as long as the 
+     * ring doesn't fill up. If the ring is full, push() falls back to a mutex-protected overflow 
+     * queue, which may allocate. Items pushed by any one thread are popped in the order in which 
+     * they were pushed.
+     * 
+     * pop() and empty() may only be called by the consumer thread.
+     * 
+     * @tparam T Item type. Must be trivially copyable.
+     */
+    template <typename T>
+    class MpscQueue
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable.");
+
+    public:
+        /**
+         * @brief Constructor.
+         * 
+         * @param capacity Capacity of the ring. Rounded up to a power of 2.
+         */
+        MpscQueue(size_t capacity = 4096)
+        {
+            size_t size = 2;
+            while (size < capacity)
+            {
+                size *= 2;
+            }
+            mask = size - 1;
+            cells = std::unique_ptr<Cell[]>(new Cell[size]);
+            for (size_t i = 0; i < size; ++i)
+            {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpscQueue(const MpscQueue &) = delete;
+        MpscQueue &operator=(const MpscQueue &) = delete;
+
+        /**
+         * @brief Push an item. Any thread.
+         * 
+         * @return true if the item went into the ring; false if it went into the overflow queue.
+         */
+        bool push(const T &value)
+        {
+            // while there's overflow, keep using it so that items from one producer stay in order.
+            if (overflowCount.load(std::memory_order_acquire) == 0 && TryPushRing(value))
+            {
+                return true;
+            }
+            std::lock_guard lock{overflowMutex};
+            overflow.push(value);
+            overflowCount.fetch_add(1, std::memory_order_release);
+            return false;
+        }
+
+        /**
+         * @brief Pop an item. Consumer thread only.
+         * 
+         * @return false if the queue is empty.
+         */
+        bool pop(T *value)
+        {
+            Cell &cell = cells[dequeuePosition & mask];
+            if (cell.sequence.load(std::memory_order_acquire) == dequeuePosition + 1)
+            {
+                *value = cell.value;
+                cell.sequence.store(dequeuePosition + mask + 1, std::memory_order_release);
+                ++dequeuePosition;
+                return true;
+            }
+            if (overflowCount.load(std::memory_order_acquire) == 0)
+            {
+                return false;
+            }
+            if (enqueuePosition.load(std::memory_order_acquire) != dequeuePosition)
+            {
+                // a push into the ring is still in progress; overflow items are newer.
+                return false;
+            }
+            std::lock_guard lock{overflowMutex};
+            if (overflow.empty())
+            {
+                return false;
+            }
+            *value = overflow.pop();
+            overflowCount.fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Is the queue empty? Consumer thread only.
+         * 
+         * An item whose push() is still in progress may not be counted.
+         */
+        bool empty() const
+        {
+            return cells[dequeuePosition & mask].sequence.load(std::memory_order_acquire) != dequeuePosition + 1
+                && overflowCount.load(std::memory_order_acquire) == 0;
+        }
+
+    private:
+        bool TryPushRing(const T &value)
+        {
+            size_t position = enqueuePosition.load(std::memory_order_relaxed);
+            Cell *cell;
+            while (true)
+            {
+                cell = &cells[position & mask];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+                if (diff == 0)
+                {
+                    if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false; // full.
+                }
+                else
+                {
+                    position = enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+            cell->value = value;
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+
+        alignas(64) std::atomic<size_t> enqueuePosition = 0;
+        alignas(64) size_t dequeuePosition = 0;
+        std::atomic<size_t> overflowCount = 0;
+
+        std::mutex overflowMutex;
+        Fifo<T> overflow;
+    };
+} // namespace
@@ -0,0 +1,186 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Robin E. R. Davies
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <coroutine>
+#include "CoClock.h"
+#include "CoPriority.h"
+#include "InplaceFunction.h"
+
+namespace cotask
+{
+    /**
+     * @brief Priority queue of delayed functions and delayed coroutines, ordered by expiry time.
+     * 
+     * Private implementation used by CoDispatcher.
+     * 
+     * Implemented as a 4-ary min-heap of (time, sequence, slot) entries. Timers live in 
+     * a slot table; each slot records the position of its entry in the heap, so Cancel()
+     * can remove an entry without searching. Insert() and Cancel() are O(log4 N); 
+     * peeking at the next expiry time is O(1).
+     * 
+     * Handles encode a slot index and a generation count, so a handle that has already 
+     * fired (or been cancelled) can't cancel a later timer that reuses the same slot.
+     * 
+     * Entries with identical expiry times are dispatched in insertion order.
+     * 
+     * Not thread-safe. CoDispatcher provides locking.
+     */
+    class TimerQueue
+    {
+    public:
+        using Duration = CoDuration;
+        using TimerHandle = uint64_t;
+        using callback_type = InplaceFunction<void(void)>;
+
+        /**
+         * @brief A timer action: either a function to call, or a coroutine to resume.
+         * 
+         */
+        struct Timer
+        {
+            callback_type fn;
+            std::coroutine_handle<> coroutine;
+            CoPriority priority = CoPriority::Normal; // (the dispatcher runs Fire() at this priority.)
+
+            void Fire()
+            {
+                if (coroutine)
+                {
+                    coroutine.resume();
+                }
+                else
+                {
+                    fn();
+                }
+            }
+        };
+
+        /**
+         * @brief Add a timer.
+         * 
+         * @param time Absolute expiry time.
+         * @param fn Function to call when the timer expires.
+         * @param priority The priority at which to call it.
+         * @return TimerHandle A non-zero handle that can be passed to Cancel().
+         */
+        TimerHandle Insert(Duration time, callback_type &&fn, CoPriority priority = CoPriority::Normal)
+        {
+            return Insert(time, Timer{std::move(fn), nullptr, priority});
+        }
+        /**
+         * @brief Add a timer that resumes a coroutine.
+         * 
+         * @param time Absolute expiry time.
+         * @param coroutine The coroutine to resume when the timer expires.
+         * @param priority The priority at which to resume it.
+         * @return TimerHandle A non-zero handle that can be passed to Cancel().
+         */
+        TimerHandle Insert(Duration time, std::coroutine_handle<> coroutine, CoPriority priority = CoPriority::Normal)
+        {
+            return Insert(time, Timer{nullptr, coroutine, priority});
+        }
+        /**
+         * @brief Add a timer.
+         * 
+         * @param time Absolute expiry time.
+         * @param timer The action to take when the timer expires.
+         * @return TimerHandle A non-zero handle that can be passed to Cancel().
+         */
+        TimerHandle Insert(Duration time, Timer &&timer);
+        /**
+         * @brief Remove a pending timer.
+         * 
+         * @param handle A handle returned by Insert()
+         * @return true if the timer was removed.
+         * @return false if the timer has already been removed, or has already been popped.
+         * 
+         * Cancelling a coroutine timer does not resume the coroutine.
+         */
+        bool Cancel(TimerHandle handle);
+
+        bool empty() const { return heap.empty(); }
+        size_t size() const { return heap.size(); }
+
+        /**
+         * @brief The expiry time of the earliest timer.
+         * 
+         * Undefined if empty().
+         */
+        Duration NextTime() const { return heap[0].time; }
+
+        /**
+         * @brief Remove the earliest timer if it has expired.
+         * 
+         * @param now The current time.
+         * @param pResult Receives the expired timer.
+         * @return true if a timer was removed.
+         * @return false if there are no timers that expire at or before now.
+         */
+        bool PopExpired(Duration now, Timer *pResult);
+
+    private:
+        static constexpr size_t ARITY = 4;
+        static constexpr uint32_t INVALID_INDEX = (uint32_t)-1;
+
+        struct HeapEntry
+        {
+            Duration time;
+            uint64_t sequence;
+            uint32_t slot;
+        };
+        struct Slot
+        {
+            Timer timer;
+            uint32_t generation = 1;
+            uint32_t heapIndex = INVALID_INDEX;
+        };
+
+        static bool Before(const HeapEntry &left, const HeapEntry &right)
+        {
+            if (left.time != right.time)
+                return left.time < right.time;
+            return left.sequence < right.sequence;
+        }
+
+        void Place(size_t heapIndex, const HeapEntry &entry)
+        {
+            heap[heapIndex] = entry;
+            slots[entry.slot].heapIndex = (uint32_t)heapIndex;
+        }
+        void SiftUp(size_t heapIndex);
+        void SiftDown(size_t heapIndex);
+        void RemoveAt(size_t heapIndex);
+        void FreeSlot(uint32_t slot);
+
+        uint64_t nextSequence = 0;
+        std::vector<HeapEntry> heap;
+        std::vector<Slot> slots;
+        std::vector<uint32_t> freeSlots;
+    };
+} // namespace
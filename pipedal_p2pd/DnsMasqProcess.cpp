@@ -65,8 +65,9 @@ void DnsMasqProcess::Start(std::shared_ptr<ILog> log, const std::string &interfa
     process.Execute("sudo", args);
     running = true;
 
-    Dispatcher().StartThread(CopyStderrToErrorLog());
-    Dispatcher().StartThread(CopyStdoutToDebugLog());
+    // (log copying yields to enrollment and event handling.)
+    Dispatcher().StartThread(CoPriority::Idle, [this] { return CopyStderrToErrorLog(); });
+    Dispatcher().StartThread(CoPriority::Idle, [this] { return CopyStdoutToDebugLog(); });
 }
 
 CoTask<> DnsMasqProcess::Stop()
@@ -102,13 +103,12 @@ CoTask<> DnsMasqProcess::Stop()
 
 CoTask<> DnsMasqProcess::CopyStdoutToDebugLog()
 {
-    std::string line;
-
-    while (co_await process.Stdout().CoReadLine(&line))
+    auto lines = process.Stdout().Lines();
+    for (auto line = co_await lines.begin(); line != lines.end(); co_await ++line)
     {
-        if (line.length() != 0)
+        if (line->length() != 0)
         {
-            log->Debug("dnsmasq: " + line);
+            log->Debug("dnsmasq: " + *line);
         }
     }
     cv.Notify([this]() {
@@ -117,13 +117,12 @@ CoTask<> DnsMasqProcess::CopyStdoutToDebugLog()
 }
 CoTask<> DnsMasqProcess::CopyStderrToErrorLog()
 {
-    std::string line;
-
-    while (co_await process.Stderr().CoReadLine(&line))
+    auto lines = process.Stderr().Lines();
+    for (auto line = co_await lines.begin(); line != lines.end(); co_await ++line)
     {
-        if (line.length() != 0)
+        if (line->length() != 0)
         {
-            log->Error("dnsmasq: " + line);
+            log->Error("dnsmasq: " + *line);
         }
     }
     cv.Notify([this]() {
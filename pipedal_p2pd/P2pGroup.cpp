@@ -109,13 +109,9 @@ CoTask<> P2pGroup::PingProc()
 {
     try
     {
-        while (true)
+        while (co_await this->TryDelay(23s))
         {
-            while (true)
-            {
-                co_await this->Delay(23s);
-                co_await Ping();
-            }
+            co_await Ping();
         }
     }
     catch (const std::exception &e)
@@ -127,7 +123,7 @@ CoTask<> P2pGroup::OpenChannel()
 {
     co_await base::OpenChannel(interfaceName, true);
 
-    Dispatcher().StartThread(PingProc());
+    Dispatcher().StartThread(CoPriority::Idle, [this] { return PingProc(); });
 
     std::string configMethod = gP2pConfiguration.p2p_config_method;
     if (configMethod == "none")
@@ -30,6 +30,7 @@
 #include "ss.h"
 #include <cassert>
 #include "cotask/CoExec.h"
+#include "cotask/CoCombinators.h"
 #include "includes/WifiP2pDnsSdServiceInfo.h"
 
 using namespace p2p;
@@ -106,8 +107,13 @@ CoTask<> P2pSessionManager::UpdateStationCount()
     if (this->activeGroups.size() > 0)
     {
         try {
-            auto stations =  co_await this->activeGroups[0]->ListSta();
-            connectedStations = stations.size();
+            size_t count = 0;
+            auto stations = this->activeGroups[0]->Stations();
+            while (co_await stations.Next())
+            {
+                ++count;
+            }
+            connectedStations = count;
         } catch (const std::exception &e)
         {
             connectedStations = 0;
@@ -162,8 +168,8 @@ CoTask<> P2pSessionManager::OnEvent(const WpaEvent &event)
             // <3>AP-STA-DISCONNECTED d6:a5:7a:10:50:11 p2p_dev_addr=6e:00:18:2b:3b:ac
             Log().Info(SS("Station disconnected: " << event.getParameter(0)));
 
-            co_await UpdateStationCount();
-            co_await P2pStopFind();
+            // (the group's channel and ours are independent, so the requests can overlap.)
+            co_await WhenAll(UpdateStationCount(), P2pStopFind());
         }
         break;
         case WpaEventMessage::P2P_EVENT_PROV_DISC_PBC_REQ:
@@ -270,8 +276,8 @@ CoTask<> P2pSessionManager::CoOnInit()
     co_await CleanUpNetworks();
     co_await InitWpaConfig();
 
-    CoDispatcher::CurrentDispatcher().StartThread(KeepAliveProc());
-    CoDispatcher::CurrentDispatcher().StartThread(ScanProc());
+    CoDispatcher::CurrentDispatcher().StartThread(CoPriority::Idle, [this] { return KeepAliveProc(); });
+    CoDispatcher::CurrentDispatcher().StartThread(CoPriority::Idle, [this] { return ScanProc(); });
 
     this->networkId = co_await FindNetwork();
 
@@ -602,7 +608,7 @@ CoTask<> P2pSessionManager::SetUpPersistentGroup()
     Log().Info("Ready");
 }
 
-void P2pSessionManager::SynchronousWaitForEvent(WpaEventMessage message, std::chrono::milliseconds timeout)
+void P2pSessionManager::SynchronousWaitForEvent(WpaEventMessage message, CoDispatcher::Duration timeout)
 {
     auto &dispatcher = CoDispatcher::CurrentDispatcher();
     auto endTime = dispatcher.Now() + timeout;
@@ -878,10 +884,12 @@ CoTask<> P2pSessionManager::ScanProc()
         start:
             while (connectedStations != 0)
             {
-                co_await Delay(2s);
+                if (!co_await TryDelay(2s))
+                    co_return; // disconnected.
             }
             co_await P2pFind();
-            co_await Delay(63s);
+            if (!co_await TryDelay(63s))
+                co_return; // disconnected.
             if (connectedStations != 0)
                 goto start; // REMAIN in Listen mode if we are connected.
 
@@ -889,13 +897,15 @@ CoTask<> P2pSessionManager::ScanProc()
 
             for (int i = 0; i < 10; ++i)
             {
-                co_await Delay(120s);
+                if (!co_await TryDelay(120s))
+                    co_return; // disconnected.
                 if (connectedStations != 0)
                     goto start;
 
                 co_await P2pFind();
 
-                co_await Delay(15s);
+                if (!co_await TryDelay(15s))
+                    co_return; // disconnected.
                 if (connectedStations != 0)
                     goto start;
 
@@ -903,12 +913,14 @@ CoTask<> P2pSessionManager::ScanProc()
             }
             while (true)
             {
-                co_await Delay(321s);
+                if (!co_await TryDelay(321s))
+                    co_return; // disconnected.
                 if (connectedStations != 0)
                     goto start;
 
                 co_await P2pFind();
-                co_await Delay(15s);
+                if (!co_await TryDelay(15s))
+                    co_return; // disconnected.
                 if (connectedStations != 0)
                     goto start;
 
@@ -918,7 +930,7 @@ CoTask<> P2pSessionManager::ScanProc()
     }
     catch (const std::exception &e)
     {
-        // we arrive here normally during shutdown.
+        // we arrive here during shutdown if a request was in flight.
         // but if there are other issues, here is not the place ot deal with them.
         Log().Debug(SS("Listen thread terminated. " << e.what()));
     }
@@ -1011,7 +1023,7 @@ CoTask<> P2pSessionManager::OnDeviceLost(std::string p2p_dev_addr)
 CoTask<> P2pSessionManager::CloseGroup(P2pGroup* group)
 {
     Dispatcher().PostDelayedFunction(
-        Dispatcher().Now(),
+        0ms,
         [this,group] () {
             for (size_t i = 0; i < activeGroups.size(); ++i)
             {
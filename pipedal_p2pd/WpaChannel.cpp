@@ -50,8 +50,16 @@ CoTask<> WpaChannel::RequestOK(const std::string message)
 }
 
 CoTask<std::vector<std::string>> WpaChannel::Request(
-    const std::string message)
+    const std::string message, CoCancellationToken cancellationToken)
 {
+    // Cancelled by the caller, or when the channel is disconnected.
+    CoCancellationToken requestCancellation = disconnectCancellation.Token();
+    std::optional<CoCancellationSource> linkedCancellation;
+    if (cancellationToken.CanBeCancelled())
+    {
+        linkedCancellation.emplace(requestCancellation, cancellationToken);
+        requestCancellation = linkedCancellation->Token();
+    }
 
     CoLockGuard lock;
     co_await lock.CoLock(requestMutex);
@@ -64,9 +72,22 @@ CoTask<std::vector<std::string>> WpaChannel::Request(
     {
         Log().Info(SS(logPrefix << "> " << message.substr(0, message.length() - 1)));
     }
-    size_t len = co_await commandSocket.CoRequest(
-        message.c_str(), message.length() - 1,
-        requestReplyBuffer, sizeof(requestReplyBuffer));
+    size_t len;
+    try
+    {
+        len = co_await commandSocket.CoRequest(
+            message.c_str(), message.length() - 1,
+            requestReplyBuffer, sizeof(requestReplyBuffer),
+            requestCancellation);
+    }
+    catch (const CoCancelledException &)
+    {
+        if (IsDisconnected())
+        {
+            throw WpaDisconnectedException();
+        }
+        throw;
+    }
     requestReplyBuffer[len] = 0;
 
     vector<string> result;
@@ -102,9 +123,7 @@ CoTask<std::vector<std::string>> WpaChannel::Request(
 }
 void WpaChannel::SetDisconnected()
 {
-    cvDelay.NotifyAll([this]() {
-        this->disconnected = true;
-    });
+    disconnectCancellation.Cancel();
 }
 
 WpaChannel::~WpaChannel()
@@ -205,7 +224,8 @@ CoTask<> WpaChannel::OpenChannel(const std::string &interfaceName, bool withEven
         });
         Dispatcher().StartThread(ReadEventsProc(interfaceName));
 
-        Dispatcher().StartThread(ForegroundEventHandler());
+        // Event handling (which includes enrollment) never waits behind housekeeping.
+        Dispatcher().StartThread(CoPriority::High, [this] { return ForegroundEventHandler(); });
     }
     else
     {
@@ -250,7 +270,12 @@ CoTask<> WpaChannel::ReadEventsProc(std::string interfaceName)
         while (true)
         {
 
-            size_t len = co_await eventSocket.CoRecv(buffer, sizeof(buffer));
+            CoResult<size_t> received = co_await eventSocket.TryRecv(buffer, sizeof(buffer));
+            if (!received)
+            {
+                break; // closed (normal shutdown).
+            }
+            size_t len = received.value;
 
             buffer[len] = 0;
 
@@ -262,28 +287,15 @@ CoTask<> WpaChannel::ReadEventsProc(std::string interfaceName)
                     Log().Info(SS(logPrefix << ":p: " + message));
                 }
             }
-            WpaEvent *evt = new WpaEvent();
-            if (evt->ParseLine(buffer))
+            WpaEvent evt;
+            if (evt.ParseLine(buffer))
             {
-                try
-                {
-                    co_await eventMessageQueue.Push(evt);
-                    evt = nullptr;
-                }
-                catch (const std::exception &e)
-                {
-                    delete evt;
-                    throw;
-                }
+                co_await eventMessageQueue.Push(std::move(evt));
                 if (Dispatcher().IsForeground()) // don't think this happens. but be safe.
                 {
                     throw logic_error("Event queue overflowed."); // can only happen if we got suspended trying to push.
                 }
             }
-            else
-            {
-                delete evt;
-            }
         }
     }
     catch (const std::exception &e)
@@ -305,40 +317,36 @@ CoTask<> WpaChannel::ReadEventsProc(std::string interfaceName)
 }
 bool WpaChannel::IsDisconnected()
 {
-    return cvDelay.Test<bool>([this]() -> bool {
-        return disconnected;
-    });
+    return disconnectCancellation.IsCancelled();
 }
 
-CoTask<> WpaChannel::Delay(std::chrono::milliseconds time)
+CoTask<> WpaChannel::Delay(CoDispatcher::Duration time)
 {
-    try
+    if (!co_await TryDelay(time))
     {
-        co_await cvDelay.Wait(time,
-                              [this]() {
-                                  if (this->disconnected)
-                                  {
-                                      throw WpaDisconnectedException();
-                                  }
-                                  return false;
-                              });
+        throw WpaDisconnectedException();
     }
-    catch (const CoTimedOutException &)
-    {
-        co_return;
-    }
-    co_return; // never actually gets here.
+}
+
+CoTask<bool> WpaChannel::TryDelay(CoDispatcher::Duration time)
+{
+    CoStatus status = co_await cotask::TryDelay(time, disconnectCancellation.Token());
+    co_return status == CoStatus::Ok;
 }
 
 CoTask<> WpaChannel::ForegroundEventHandler()
 {
     try
     {
+        // drain bursts of events with a single resume.
+        std::vector<WpaEvent> events(16);
         while (true)
         {
-            WpaEvent *event = co_await eventMessageQueue.Take();
-            co_await OnEvent(*event);
-            delete event;
+            size_t nEvents = co_await eventMessageQueue.TakeMany(events);
+            for (size_t i = 0; i < nEvents; ++i)
+            {
+                co_await OnEvent(events[i]);
+            }
         }
     }
     catch (const CoIoClosedException &)
@@ -396,7 +404,7 @@ CoTask<std::string> WpaChannel::RequestString(const std::string request, bool th
     throw WpaFailedException("Wrong size", request);
 }
 
-CoTask<std::vector<StationInfo>> WpaChannel::ListSta()
+AsyncGenerator<StationInfo> WpaChannel::Stations()
 {
     CoLockGuard lock;
     co_await lock.CoLock(requestMutex);
@@ -406,11 +414,24 @@ CoTask<std::vector<StationInfo>> WpaChannel::ListSta()
         Log().Info(SS(logPrefix << "> ListSta"));
     }
 
-    std::vector<StationInfo> result;
+    size_t count = 0;
     std::string cmd = "STA-FIRST";
-    size_t len = co_await commandSocket.CoRequest(
-        cmd.c_str(), cmd.length(),
-        this->requestReplyBuffer, sizeof(this->requestReplyBuffer) - 1);
+    size_t len;
+    try
+    {
+        len = co_await commandSocket.CoRequest(
+            cmd.c_str(), cmd.length(),
+            this->requestReplyBuffer, sizeof(this->requestReplyBuffer) - 1,
+            disconnectCancellation.Token());
+    }
+    catch (const CoCancelledException &)
+    {
+        if (IsDisconnected())
+        {
+            throw WpaDisconnectedException();
+        }
+        throw;
+    }
     requestReplyBuffer[len] = '\0';
 
     while (true)
@@ -421,7 +442,7 @@ CoTask<std::vector<StationInfo>> WpaChannel::ListSta()
         if (strcmp(requestReplyBuffer, "FAIL\n") == 0)
         {
             Log().Debug(SS(logPrefix << " ListSta() failed."));
-            co_return result;
+            co_return;
         }
         if (strcmp(requestReplyBuffer, "UNKNOWN COMMAND\n") == 0)
         {
@@ -432,26 +453,43 @@ CoTask<std::vector<StationInfo>> WpaChannel::ListSta()
         StationInfo stationInfo{requestReplyBuffer};
         std::string nextRequest = SS("STA-NEXT " << stationInfo.address);
 
-        result.push_back(std::move(stationInfo));
+        if (traceMessages)
+        {
+            Log().Info(SS(logPrefix << "< " << stationInfo.ToString()));
+        }
+        ++count;
+        co_yield stationInfo; // (the consumer may move from it.)
 
-        len = co_await commandSocket.CoRequest(
-            nextRequest.c_str(), nextRequest.length(),
-            this->requestReplyBuffer, sizeof(this->requestReplyBuffer) - 1);
-        requestReplyBuffer[len] = '\0';
-    }
-    if (traceMessages)
-    {
-        if (result.size() == 0)
+        try
         {
-            Log().Info(SS(logPrefix << "< "));
+            len = co_await commandSocket.CoRequest(
+                nextRequest.c_str(), nextRequest.length(),
+                this->requestReplyBuffer, sizeof(this->requestReplyBuffer) - 1,
+                disconnectCancellation.Token());
         }
-        else
+        catch (const CoCancelledException &)
         {
-            for (const StationInfo &stationInfo : result)
+            if (IsDisconnected())
             {
-                Log().Info(SS(logPrefix << "< " << stationInfo.ToString()));
+                throw WpaDisconnectedException();
             }
+            throw;
         }
+        requestReplyBuffer[len] = '\0';
+    }
+    if (traceMessages && count == 0)
+    {
+        Log().Info(SS(logPrefix << "< "));
+    }
+}
+
+CoTask<std::vector<StationInfo>> WpaChannel::ListSta()
+{
+    std::vector<StationInfo> result;
+    auto stations = Stations();
+    while (co_await stations.Next())
+    {
+        result.push_back(std::move(stations.Value()));
     }
     co_return result;
 }
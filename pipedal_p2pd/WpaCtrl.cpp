@@ -312,13 +312,14 @@ void WpaCtrl::Close()
 }
 
 
-CoTask<size_t>  WpaCtrl::CoRequest(const char *cmd, size_t cmd_len,
-		     char *reply, size_t reply_buffer_length)
+LazyTask<size_t>  WpaCtrl::CoRequest(const char *cmd, size_t cmd_len,
+		     char *reply, size_t reply_buffer_length,
+             CoCancellationToken cancellationToken)
 {
     
 
     try {
-        co_await coFile.CoSend(cmd,cmd_len,DEFAULT_TIMEOUT); // the datagram interface doesn't want the final '\n'. (Maybe other interfaces do)
+        co_await coFile.CoSend(cmd,cmd_len,DEFAULT_TIMEOUT,cancellationToken); // the datagram interface doesn't want the final '\n'. (Maybe other interfaces do)
     } catch (const CoTimedOutException& e)
     {
         throw ;
@@ -326,7 +327,7 @@ CoTask<size_t>  WpaCtrl::CoRequest(const char *cmd, size_t cmd_len,
 
 
     while (true) {
-        size_t received = co_await coFile.CoRecv(reply,reply_buffer_length,DEFAULT_TIMEOUT);
+        size_t received = co_await coFile.CoRecv(reply,reply_buffer_length,DEFAULT_TIMEOUT,cancellationToken);
         reply[received] = '\0'; // always zero-terminate.
         if ((received > 0 && reply[0] == '<')  
         || (received > 6 && strncmp(reply,"IFNAME=",7) == 0))
@@ -369,7 +370,7 @@ CoTask<> WpaCtrl::Detach() {
 
 }
 
-CoTask<> WpaCtrl::AttachHelper(const std::string&cmd) {
+LazyTask<> WpaCtrl::AttachHelper(const std::string&cmd) {
 
     co_await coFile.CoSend(cmd.c_str(),cmd.length(),DEFAULT_TIMEOUT); // the datagram interface doesn't want the final '\n'. (Maybe other interfaces do)
 
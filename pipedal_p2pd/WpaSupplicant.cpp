@@ -76,7 +76,7 @@ CoTask<> WpaSupplicant::Open(const std::string&interfaceName)
 
         open = true;
 
-        CoDispatcher::CurrentDispatcher().StartThread(KeepAliveProc());
+        CoDispatcher::CurrentDispatcher().StartThread(CoPriority::Idle, [this] { return KeepAliveProc(); });
 
         co_await CoOnInit();
     }
@@ -324,9 +324,8 @@ CoTask<> WpaSupplicant::KeepAliveProc()
     // Ping every 15 seconds, just to make sure wpa_supplicant is responsive.
     try
     {
-        while (true)
+        while (co_await this->TryDelay(17s))
         {
-            co_await this->Delay(17s);
             co_await Ping(); // check for dead sockets.
         }
     }
@@ -133,7 +133,7 @@ namespace p2p
 
         bool addingGroup = false;
         WpaEventMessage synchronousEventToWaitFor = WpaEventMessage::WPA_INVALID_MESSAGE;
-        void SynchronousWaitForEvent(WpaEventMessage message, std::chrono::milliseconds timeout);
+        void SynchronousWaitForEvent(WpaEventMessage message, CoDispatcher::Duration timeout);
 
         int persistentGroup = -1;
         bool wpaConfigChanged = false;
@@ -30,7 +30,9 @@
 #include <memory>
 #include "cotask/CoTask.h"
 #include "cotask/CoFile.h"
-#include "cotask/CoBlockingQueue.h"
+#include "cotask/CoChannel.h"
+#include "cotask/CoCancellation.h"
+#include "cotask/AsyncGenerator.h"
 #include "includes/WpaCtrl.h"
 
 
@@ -89,11 +91,17 @@ namespace p2p
          * @param time how long to wait.
          * @throws WpaDisconnectedException if the current connect has been disconnected.
          */
-        CoTask<> Delay(std::chrono::milliseconds time);
+        CoTask<> Delay(CoDispatcher::Duration time);
 
-        CoTask<> Delay(std::chrono::seconds time) {
-            return Delay(std::chrono::duration_cast<std::chrono::milliseconds>(time));
-        }
+        /**
+         * @brief Delay, without throwing if disconnected.
+         * 
+         * For polling loops that run until the connection is lost.
+         * 
+         * @param time how long to wait.
+         * @return true if the delay elapsed; false if the channel has been disconnected.
+         */
+        CoTask<bool> TryDelay(CoDispatcher::Duration time);
 
         /**
          * @brief Ping the channel to make sure it's alive.
@@ -108,11 +116,15 @@ namespace p2p
          * @brief Send a request to wpa_supplicant.
          * 
          * @param request The request to execute.
+         * @param cancellationToken (optional) Cancels the request.
          * @return std::vector<std::string> Data returned by wpa_supplicant
          * @throws WpaDisconnectedException if the wap_suplicant connection drops.
          * @throws WpaIoException if an i/o error occurs on the wpa_supplicant channel.
+         * @throws CoCancelledException if cancellationToken is cancelled.
+         * 
+         * Pending requests are also cancelled (with WpaDisconnectedException) when the channel is closed.
          */
-        CoTask<std::vector<std::string>> Request(const std::string request);
+        CoTask<std::vector<std::string>> Request(const std::string request, CoCancellationToken cancellationToken = CoCancellationToken());
 
         /**
          * @brief Send a request to wpa_supplicant, checking for an OK response.
@@ -152,6 +164,15 @@ namespace p2p
          */
         CoTask<std::vector<StationInfo>> ListSta();
 
+        /**
+         * @brief Stream the connected stations.
+         * 
+         * Pages through the stations with STA-FIRST/STA-NEXT requests, yielding each station 
+         * as it arrives. The request mutex is held until the sequence ends (or the generator 
+         * is destroyed), so don't make other requests on this channel while iterating.
+         */
+        AsyncGenerator<StationInfo> Stations();
+
 
         bool TraceMessages() const { return traceMessages; }
         void TraceMessages(bool value, const std::string&logPrefix) { traceMessages = value; this->logPrefix = logPrefix; }
@@ -178,10 +199,9 @@ namespace p2p
         std::shared_ptr<ILog> pLog;
         ILog*rawLog = nullptr; // ILog is thread-safe shared_ptr<ILog> is not!
 
-        bool disconnected = false;
-        CoConditionVariable cvDelay;
+        CoCancellationSource disconnectCancellation; // cancelled on disconnect.
 
-        CoBlockingQueue<WpaEvent> eventMessageQueue { 512};
+        CoChannel<WpaEvent, ChannelKind::Spsc> eventMessageQueue { 512};
 
         std::stringstream lineResult;
 
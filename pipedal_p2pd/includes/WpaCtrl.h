@@ -28,6 +28,7 @@
 #include "cotask/CoFile.h"
 #include <filesystem>
 #include "cotask/CoEvent.h"
+#include "cotask/LazyTask.h"
 
 namespace p2p {
     using namespace cotask;
@@ -91,23 +92,38 @@ namespace p2p {
              * 
              * @param buffer The buffer into which data is stored.
              * @param size 
-            *  @param timeout in milliseconds (optionaL) 
+            *  @param timeout (optional) Timeout, or NO_TIMEOUT. 
 
              * @return CoTask<size_t> 
              * @throws WapIoException on errors.
              * @throws WapClosedException on close.
              */
-            CoTask<size_t> CoRecv(void *buffer, size_t size, std::chrono::milliseconds timeout = NO_TIMEOUT);
+            CoTask<size_t> CoRecv(void *buffer, size_t size, CoDispatcher::Duration timeout = NO_TIMEOUT);
+
+            /**
+             * @brief Non-throwing CoRecv().
+             * 
+             * Reports timeouts and closing through the status of the result instead of throwing.
+             * @throws WapIoException on errors.
+             */
+            CoTask<CoResult<size_t>> TryRecv(void *buffer, size_t size, CoDispatcher::Duration timeout = NO_TIMEOUT);
 
             CoTask<> Attach();
             CoTask<> Detach();
 
-            CoTask<size_t> CoRequest(
+            /**
+             * @brief Send a request, and receive the reply.
+             * 
+             * @param cancellationToken (optional) Cancels the request, which then throws CoCancelledException.
+             * @return LazyTask<size_t> The length of the reply. (Starts when co_awaited.)
+             */
+            LazyTask<size_t> CoRequest(
                 const char *cmd, size_t cmd_len,
-		        char *reply, size_t buffer_length);
+		        char *reply, size_t buffer_length,
+                CoCancellationToken cancellationToken = CoCancellationToken());
 
         private:
-            CoTask<> AttachHelper(const std::string &message);
+            LazyTask<> AttachHelper(const std::string &message);
 
             void Open2(const std::string &fullPath);
             class detail::wpa_ctrl *ctrl = nullptr; // os-dependent data
@@ -116,10 +132,14 @@ namespace p2p {
     };
 
 
-    inline CoTask<size_t> WpaCtrl::CoRecv(void *buffer, size_t size, std::chrono::milliseconds timeout)
+    inline CoTask<size_t> WpaCtrl::CoRecv(void *buffer, size_t size, CoDispatcher::Duration timeout)
     {
         return coFile.CoRecv(buffer,size,timeout);
     }
+    inline CoTask<CoResult<size_t>> WpaCtrl::TryRecv(void *buffer, size_t size, CoDispatcher::Duration timeout)
+    {
+        return coFile.TryRecv(buffer,size,timeout);
+    }
 
 
 }
\ No newline at end of file
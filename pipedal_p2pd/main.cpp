@@ -342,7 +342,8 @@ CoTask<int> CoMain(int argc, const char *const *argv)
     bool hadWrongInterface = false;
     try
     {
-        AsyncIo::GetInstance().Start();
+        // wait for i/o, posts and timers in a single epoll wait on the dispatcher thread.
+        Dispatcher().SetForegroundIo(true);
 
 #ifdef __linux__
         if (systemd)